@@ -7,7 +7,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <rg/GLObject.h>
+#include <rg/ShaderPermutations.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 using namespace std;
@@ -28,93 +31,219 @@ struct Vertex {
 
 
 struct Texture {
-    unsigned int id;
+    unsigned int id = 0;
     string type;
     string path;
+    // true when the image has an alpha channel that isn't fully opaque
+    bool hasAlpha = false;
+    // most of the texels that aren't opaque are partly transparent rather than cut out
+    bool softAlpha = false;
+    // layer of the GL_TEXTURE_2D_ARRAY id refers to when the texture is streamed, -1 for a plain 2D texture
+    int layer = -1;
+    // index in the TextureStreamer, -1 when not streamed
+    int stream = -1;
 };
 
-class Mesh {
+// per-instance vertex attributes of the instanced draws: the model matrix at locations 5-8, last frame's at 9-12
+struct InstanceData {
+    glm::mat4 model;
+    glm::mat4 previousModel;
+};
+
+// the texture unit every kind of material texture is bound to, the same for all materials
+enum TextureSlot {
+    SLOT_DIFFUSE,
+    SLOT_SPECULAR,
+    SLOT_NORMAL,
+    SLOT_HEIGHT,
+    SLOT_ORM,
+    SLOT_EMISSIVE,
+    SLOT_COUNT
+};
+
+// A mesh's textures resolved at import into what a draw needs: the texture objects to bind and the per-draw
+// constants. The samplers point at the fixed units once per program link (setSamplerUnits), and the constants
+// go into generic vertex attributes at fixed locations instead of uniforms, which GL 3.3 can't place at fixed
+// locations; so a draw binds textures and sets three attributes, no names, no lookups.
+//   location 13  ivec4  array layers of the diffuse, specular, normal and ORM textures
+//   location 14  int    array layer of the emissive texture
+//   location 15  float  opacity of translucent meshes
+class Material {
 public:
-    // mesh Data
-    vector<Vertex>       vertices;
-    vector<unsigned int> indices;
-    vector<Texture>      textures;
+    // multiplies the diffuse alpha of translucent meshes
+    float opacity = 1.0f;
 
-    unsigned int VAO;
-    std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Material() = default;
+
+    // the first texture of each type, the shaders have no second one
+    explicit Material(const vector<Texture> &textures)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        bool filled[SLOT_COUNT] = {};
+        for (const Texture &texture : textures)
+        {
+            int slot = slotOf(texture.type);
+            if (slot < 0 || filled[slot])
+                continue;
+            filled[slot] = true;
+            bindings.push_back(Binding{texture.layer >= 0 ? (GLenum)GL_TEXTURE_2D_ARRAY : (GLenum)GL_TEXTURE_2D,
+                                       texture.id, (GLenum)(GL_TEXTURE0 + slot)});
+            layers[slot] = std::max(texture.layer, 0);
+        }
+    }
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+    // the sampler uniforms of a program, named after the texture types with prefix in front, to their slots;
+    // call with the program in use whenever it (re)links, e.g. from Shader::setOnLink
+    static void setSamplerUnits(Shader &shader, const std::string &prefix)
+    {
+        const char *names[SLOT_COUNT] = {"texture_diffuse1", "texture_specular1", "texture_normal1", "texture_height1",
+                                         "texture_orm1", "texture_emissive1"};
+        for (int slot = 0; slot < SLOT_COUNT; slot++)
+            shader.setInt(prefix + names[slot], slot);
     }
 
-    // render the mesh
-    void Draw(Shader &shader)
+    void bind() const
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
+        for (const Binding &binding : bindings)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            glActiveTexture(binding.unit);
+            glBindTexture(binding.target, binding.texture);
         }
+    }
 
+    void setConstants() const
+    {
+        glVertexAttribI4i(13, layers[SLOT_DIFFUSE], layers[SLOT_SPECULAR], layers[SLOT_NORMAL], layers[SLOT_ORM]);
+        glVertexAttribI4i(14, layers[SLOT_EMISSIVE], 0, 0, 0);
+        glVertexAttrib1f(15, opacity);
+    }
 
+    // true when bind() of both binds the same textures to the same units
+    bool sharesTextures(const Material &other) const
+    {
+        if (bindings.size() != other.bindings.size())
+            return false;
+        for (size_t i = 0; i < bindings.size(); i++)
+            if (bindings[i].texture != other.bindings[i].texture || bindings[i].unit != other.bindings[i].unit)
+                return false;
+        return true;
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // orders materials so the ones that share textures end up next to each other
+    bool texturesBefore(const Material &other) const
+    {
+        for (size_t i = 0; i < bindings.size() && i < other.bindings.size(); i++)
+        {
+            if (bindings[i].unit != other.bindings[i].unit)
+                return bindings[i].unit < other.bindings[i].unit;
+            if (bindings[i].texture != other.bindings[i].texture)
+                return bindings[i].texture < other.bindings[i].texture;
+        }
+        return bindings.size() < other.bindings.size();
     }
 
 private:
-    // render data
-    unsigned int VBO, EBO;
+    struct Binding {
+        GLenum target;
+        GLuint texture;
+        GLenum unit;
+    };
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    vector<Binding> bindings;
+    GLint layers[SLOT_COUNT] = {};
+
+    static int slotOf(const string &type)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        const char *types[SLOT_COUNT] = {"texture_diffuse", "texture_specular", "texture_normal", "texture_height",
+                                         "texture_orm", "texture_emissive"};
+        for (int slot = 0; slot < SLOT_COUNT; slot++)
+            if (type == types[slot])
+                return slot;
+        return -1;
+    }
+};
+
+// which meshes of a model a draw call covers: the buckets a material falls in at import. Alpha-tested meshes can't
+// take part in the depth pre-pass, translucent ones go to the weighted blended OIT pass
+enum MeshSelection {
+    ALL_MESHES,
+    OPAQUE_MESHES,
+    ALPHA_TESTED_MESHES,
+    TRANSLUCENT_MESHES
+};
+
+// Owns its GL objects, so it moves but doesn't copy. The vertices and indices only stay on the CPU after the
+// upload when the mesh is created with keepCpuGeometry, for code that queries the geometry
+class Mesh {
+public:
+    // mesh Data, empty after the upload unless kept
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures;
+
+    GLVertexArray VAO;
+    // positions only, tightly packed, for depth-only passes
+    GLVertexArray depthVAO;
+    GLsizei indexCount = 0;
+    // bytes of vertex and index data the mesh was built from, what it kept on the CPU before keepCpuGeometry
+    size_t uploadedBytes = 0;
+    // the textures as the draws bind them, rebuild with UpdateMaterial after changing textures
+    Material material;
+    // shader features this mesh's material needs (ShaderFeature bits), picked from the textures it actually has
+    unsigned int features = 0;
+    // object-space bounding box of the vertices
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // constructor, pass the vectors with std::move to hand them over without a copy. Vertex arrays aren't shared
+    // between contexts: a mesh built on the upload thread passes false for withVertexArrays, and the render thread
+    // calls CreateVertexArrays once the buffers are there
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool keepCpuGeometry = false,
+         bool withVertexArrays = true)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
+    {
+        material = Material(this->textures);
+
+        for (const Texture& texture : this->textures)
+        {
+            if (texture.type == "texture_specular")
+                features |= SHADER_HAS_SPECULAR;
+            else if (texture.type == "texture_normal")
+                features |= SHADER_HAS_NORMALMAP;
+            else if (texture.type == "texture_diffuse" && texture.hasAlpha)
+                features |= SHADER_ALPHA_TEST;
+            else if (texture.type == "texture_orm")
+                features |= SHADER_PBR;
+            else if (texture.type == "texture_emissive")
+                features |= SHADER_HAS_EMISSIVE;
+        }
 
+        if (!this->vertices.empty())
+        {
+            boundsMin = boundsMax = this->vertices[0].Position;
+            for (const Vertex& vertex : this->vertices)
+            {
+                boundsMin = glm::min(boundsMin, vertex.Position);
+                boundsMax = glm::max(boundsMax, vertex.Position);
+            }
+        }
+
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        uploadBuffers();
+        if (withVertexArrays)
+            CreateVertexArrays();
+        if (!keepCpuGeometry)
+        {
+            vector<Vertex>().swap(this->vertices);
+            vector<unsigned int>().swap(this->indices);
+        }
+    }
+
+    // the attribute layouts over the buffers, on the context that draws the mesh
+    void CreateVertexArrays()
+    {
+        VAO = GLVertexArray::create();
         glBindVertexArray(VAO);
-        // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -133,7 +262,150 @@ private:
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
+        // the positions-only stream, sharing the index buffer with the full VAO
+        depthVAO = GLVertexArray::create();
+        glBindVertexArray(depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // bytes the mesh still holds on the CPU for its vertices and indices
+    size_t cpuGeometryBytes() const
+    {
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+    }
+
+    bool alphaTested() const
+    {
+        return (features & SHADER_ALPHA_TEST) != 0;
+    }
+
+    bool translucent() const
+    {
+        return (features & SHADER_TRANSLUCENT) != 0;
+    }
+
+    // blended instead of alpha tested, with the diffuse alpha scaled by opacity
+    void makeTranslucent(float opacity)
+    {
+        features = (features & ~SHADER_ALPHA_TEST) | SHADER_TRANSLUCENT;
+        material.opacity = opacity;
+    }
+
+    void UpdateMaterial()
+    {
+        float opacity = material.opacity;
+        material = Material(textures);
+        material.opacity = opacity;
+    }
+
+    MeshSelection bucket() const
+    {
+        return translucent() ? TRANSLUCENT_MESHES : alphaTested() ? ALPHA_TESTED_MESHES : OPAQUE_MESHES;
+    }
+
+    bool selectedBy(MeshSelection selection) const
+    {
+        return selection == ALL_MESHES || selection == bucket();
+    }
+
+    // render the mesh; the program's samplers have to be set up with Material::setSamplerUnits
+    void Draw(Shader &shader)
+    {
+        material.bind();
+        material.setConstants();
+
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // render count instances, their InstanceData starting at byte instanceOffset of instanceBuffer. bindTextures
+    // false keeps the textures bound by the previous mesh, for meshes whose material has the same bind list
+    void DrawInstanced(unsigned int instanceBuffer, size_t instanceOffset, int count, bool bindTextures = true)
+    {
+        if (bindTextures)
+            material.bind();
+        material.setConstants();
+        glBindVertexArray(VAO);
+        pointInstanceAttributes(instanceBuffer, instanceOffset, true);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // render only the positions, the bound program needs nothing but attribute 0
+    void DrawDepth()
+    {
+        glBindVertexArray(depthVAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+    }
+
+    // DrawDepth for count instances, the bound program reads the model matrix from InstanceData
+    void DrawDepthInstanced(unsigned int instanceBuffer, size_t instanceOffset, int count)
+    {
+        glBindVertexArray(depthVAO);
+        pointInstanceAttributes(instanceBuffer, instanceOffset, false);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+    }
+
+private:
+    // render data
+    GLBuffer VBO, EBO, positionVBO;
+
+    // creates the buffers and uploads the vertices and indices; no vertex array is bound, so every buffer goes
+    // through the GL_ARRAY_BUFFER target, whatever it's used as later
+    void uploadBuffers()
+    {
+        VBO = GLBuffer::create();
+        EBO = GLBuffer::create();
+        positionVBO = GLBuffer::create();
+        indexCount = (GLsizei)indices.size();
+        uploadedBytes = vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int);
+
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+        // again translates to 3/2 floats which translates to a byte array.
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+        // a second stream with just the positions: 12 bytes per vertex instead of 56 for the depth pre-pass
+        vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // points the instance attributes of the bound VAO at the InstanceData from byte base on. There is no base
+    // instance in GL 3.3, so every draw moves the pointers instead
+    static void pointInstanceAttributes(unsigned int instanceBuffer, size_t base, bool withPrevious)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int column = 0; column < (withPrevious ? 8 : 4); column++)
+        {
+            size_t offset = base + (column < 4 ? offsetof(InstanceData, model) : offsetof(InstanceData, previousModel))
+                            + (column % 4) * sizeof(glm::vec4);
+            glEnableVertexAttribArray(5 + column);
+            glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offset);
+            glVertexAttribDivisor(5 + column, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 };
 #endif
\ No newline at end of file
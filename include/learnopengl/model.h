@@ -12,7 +12,10 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <rg/AlphaCoverage.h>
+#include <rg/TextureStreamer.h>
 
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -21,7 +24,8 @@
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, bool *hasAlpha = nullptr,
+                             bool *softAlpha = nullptr, GLenum target = GL_TEXTURE_2D);
 
 
 
@@ -30,14 +34,34 @@ class Model
 public:
     // model data
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    // owns the texture objects of textures_loaded, when they aren't streamed
+    vector<GLTexture> textureObjects;
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
-
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // object-space bounding box of all meshes
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // constructor, expects a filepath to a 3D model. keepCpuGeometry keeps the meshes' vertices and indices around
+    // after the upload; with a streamer the textures are registered with it instead of loaded, and have no texture
+    // object until its build(), without one each is a single-layer array, as the lighting shader samples arrays only.
+    // A model loaded on the upload thread passes false for withVertexArrays and gets them
+    // from CreateVertexArrays on the render thread
+    Model(string const &path, bool gamma = false, bool keepCpuGeometry = false, TextureStreamer *streamer = nullptr,
+          bool withVertexArrays = true)
+        : gammaCorrection(gamma), keepCpuGeometry(keepCpuGeometry), streamer(streamer),
+          withVertexArrays(withVertexArrays)
     {
         loadModel(path);
+        if (streamer)
+            for (Mesh &mesh : meshes)
+                streamer->attach(mesh);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            boundsMin = i == 0 ? meshes[i].boundsMin : glm::min(boundsMin, meshes[i].boundsMin);
+            boundsMax = i == 0 ? meshes[i].boundsMax : glm::max(boundsMax, meshes[i].boundsMax);
+        }
     }
 
     // draws the model, and thus all its meshes
@@ -47,12 +71,85 @@ public:
             meshes[i].Draw(shader);
     }
 
-    void SetShaderTextureNamePrefix(std::string prefix) {
-        for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
+    // depth-only draw of the opaque meshes, and of the translucent ones for shadows; the caller has the depth
+    // program bound with its model matrix set
+    void DrawDepth(bool withTranslucent = false)
+    {
+        for (Mesh &mesh : meshes)
+            if (mesh.bucket() == OPAQUE_MESHES || (withTranslucent && mesh.translucent()))
+                mesh.DrawDepth();
+    }
+
+    void CreateVertexArrays()
+    {
+        for (Mesh &mesh : meshes)
+            mesh.CreateVertexArrays();
+    }
+
+    // bytes of geometry uploaded to the GPU and still held on the CPU
+    size_t UploadedGeometryBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.uploadedBytes;
+        return bytes;
+    }
+
+    size_t CpuGeometryBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.cpuGeometryBytes();
+        return bytes;
+    }
+
+    bool HasMeshes(MeshSelection selection) const
+    {
+        for (const Mesh &mesh : meshes)
+            if (mesh.selectedBy(selection))
+                return true;
+        return false;
+    }
+
+    // makes every mesh translucent, for assets whose files don't say they are
+    void SetOpacity(float opacity)
+    {
+        for (Mesh &mesh : meshes)
+            mesh.makeTranslucent(opacity);
+    }
+
+    // the variants this model can ask for, each once
+    std::vector<unsigned int> ShaderFeatures(const std::vector<unsigned int> &globalFeatureSets) const
+    {
+        std::vector<unsigned int> features;
+        for (const Mesh &mesh : meshes)
+            for (unsigned int globalFeatures : globalFeatureSets)
+                if (std::find(features.begin(), features.end(), globalFeatures | mesh.features) == features.end())
+                    features.push_back(globalFeatures | mesh.features);
+        return features;
+    }
+
+    // compiles the variants this model can ask for up front, so the first frame doesn't stall on the driver
+    void PrepareShaders(ShaderPermutations &shaders, std::vector<unsigned int> globalFeatureSets)
+    {
+        for (unsigned int features : ShaderFeatures(globalFeatureSets))
+            shaders.get(features);
+    }
+
+    // shifts the mip level every texture of the model samples from, positive is blurrier and cheaper
+    void SetLodBias(float bias) {
+        for (const Texture& texture : textures_loaded) {
+            GLenum target = texture.layer >= 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+            glBindTexture(target, texture.id);
+            glTexParameterf(target, GL_TEXTURE_LOD_BIAS, bias);
+            glBindTexture(target, 0);
         }
     }
 private:
+    bool keepCpuGeometry;
+    TextureStreamer *streamer;
+    bool withVertexArrays;
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
@@ -81,7 +178,7 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            processMesh(mesh, scene);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
@@ -91,12 +188,15 @@ private:
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // builds the mesh in place at the end of meshes
+    void processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
         vector<Vertex> vertices;
         vector<unsigned int> indices;
         vector<Texture> textures;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -159,6 +259,8 @@ private:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
+        // orm: texture_ormN, occlusion/roughness/metallic of the PBR variant
+        // emissive: texture_emissiveN
         aiColor3D color(0.0f, 0.0f, 0.0f);
         material->Get(AI_MATKEY_COLOR_AMBIENT, color);
 
@@ -166,20 +268,49 @@ private:
         // 1. diffuse maps
         vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
         textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        // 2. glTF metallic-roughness materials get an ORM texture instead of a specular map, see ormTexturePath
+        string ormPath = ormTexturePath(material, diffuseMaps);
+        if (!ormPath.empty())
+        {
+            textures.push_back(loadTexture(ormPath.c_str(), "texture_orm"));
+        }
+        else
+        {
+            vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+            textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        }
+        // 3. normal maps (glTF and FBX report them as NORMALS, OBJ bump maps come in as HEIGHT)
+        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_NORMALS, "texture_normal");
+        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
         textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
         // 4. height maps
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        // 5. emissive maps, only used by the PBR variant
+        if (!ormPath.empty())
+        {
+            std::vector<Texture> emissiveMaps = loadMaterialTextures(material, aiTextureType_EMISSIVE, "texture_emissive");
+            textures.insert(textures.end(), emissiveMaps.begin(), emissiveMaps.end());
+        }
 
 
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // translucent when the material says so: an opacity below 1, or glTF's BLEND mode over a diffuse texture
+        // that really is partly transparent (exporters set BLEND on plenty of cut-out or opaque materials)
+        float opacity = 1.0f;
+        material->Get(AI_MATKEY_OPACITY, opacity);
+        aiString alphaMode;
+        bool blendMode = material->Get("$mat.gltf.alphaMode", 0, 0, alphaMode) == aiReturn_SUCCESS &&
+                         std::strcmp(alphaMode.C_Str(), "BLEND") == 0;
+        bool softAlpha = false;
+        for (const Texture &texture : textures)
+            softAlpha = softAlpha || (texture.type == "texture_diffuse" && texture.softAlpha);
+        // a mesh object created from the extracted mesh data, which it takes over
+        meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures), keepCpuGeometry,
+                            withVertexArrays);
+        if (opacity < 1.0f || (blendMode && softAlpha))
+            meshes.back().makeTranslucent(opacity);
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -191,33 +322,69 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadTexture(str.C_Str(), typeName));
         }
         return textures;
     }
+
+    // loads the texture at a path relative to the model, once for the entire model
+    Texture loadTexture(const char *path, const string &typeName)
+    {
+        // check if texture was loaded before and if so, skip loading a new texture
+        for(unsigned int j = 0; j < textures_loaded.size(); j++)
+        {
+            if(std::strcmp(textures_loaded[j].path.data(), path) == 0 && textures_loaded[j].type == typeName)
+                return textures_loaded[j];
+        }
+        Texture texture;
+        if (streamer)
+        {
+            texture.stream = streamer->add(this->directory + '/' + path, &texture.hasAlpha, &texture.softAlpha);
+        }
+        else
+        {
+            texture.id = TextureFromFile(path, this->directory, false, &texture.hasAlpha, &texture.softAlpha,
+                                         GL_TEXTURE_2D_ARRAY);
+            texture.layer = 0;
+            textureObjects.emplace_back(texture.id);
+        }
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
+
+    // the occlusion/roughness/metallic texture of a material, empty if it has none: the <material name>_orm.tga
+    // tools/pack_orm writes next to the base color, or the glTF metallicRoughness map when the material names it
+    // as its occlusion map too, which makes it packed that way already
+    string ormTexturePath(aiMaterial *material, const vector<Texture> &diffuseMaps)
+    {
+        aiString name;
+        material->Get(AI_MATKEY_NAME, name);
+        string folder;
+        if (!diffuseMaps.empty())
+        {
+            size_t slash = diffuseMaps[0].path.find_last_of("/\\");
+            if (slash != string::npos)
+                folder = diffuseMaps[0].path.substr(0, slash + 1);
+        }
+        string packed = folder + name.C_Str() + "_orm.tga";
+        if (name.length > 0 && std::ifstream(directory + '/' + packed))
+            return packed;
+        // assimp reports glTF's metallicRoughness texture as UNKNOWN and the occlusion texture as LIGHTMAP
+        aiString metallicRoughness, occlusion;
+        if (material->GetTexture(aiTextureType_UNKNOWN, 0, &metallicRoughness) == aiReturn_SUCCESS &&
+            material->GetTexture(aiTextureType_LIGHTMAP, 0, &occlusion) == aiReturn_SUCCESS &&
+            std::strcmp(metallicRoughness.C_Str(), occlusion.C_Str()) == 0)
+            return metallicRoughness.C_Str();
+        return "";
+    }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// target GL_TEXTURE_2D_ARRAY makes it an array with the image as its only layer
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, bool *hasAlpha, bool *softAlpha,
+                             GLenum target)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
@@ -237,14 +404,25 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (hasAlpha)
+            *hasAlpha = false;
+        if (softAlpha)
+            *softAlpha = false;
+        if (nrComponents == 4 && (hasAlpha || softAlpha))
+            classifyAlpha(data, (size_t)width * height, hasAlpha, softAlpha);
+
+        glBindTexture(target, textureID);
+        if (target == GL_TEXTURE_2D_ARRAY)
+            glTexImage3D(target, 0, format, width, height, 1, 0, format, GL_UNSIGNED_BYTE, data);
+        else
+            glTexImage2D(target, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(target);
+
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(target, 0);
 
         stbi_image_free(data);
     }
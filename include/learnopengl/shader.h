@@ -8,101 +8,171 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <regex>
+#include <vector>
 #include <common.h>
+#include <rg/GLObject.h>
 class Shader
 {
 public:
-    unsigned int ID;
-    // constructor generates the shader on the fly
-    // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
-    {
-        std::string vertexPathString(vertexPath);
-        std::string fragmentPathString(fragmentPath);
-
-        vertexPath = vertexPathString.c_str();
-        fragmentPath= fragmentPathString.c_str();
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                std::string geometryPathString(geometryPath);
-                geometryPath = geometryPathString.c_str();
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
+    // the program, deleted with the Shader; converts to its name
+    GLProgram ID;
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;
+    // "#define" bodies inserted after the #version line of every stage, e.g. {"BLINN", "PARALLAX_STEPS 16"}
+    std::vector<std::string> defines;
+    // log of the last failed build, empty when the current program is up to date
+    std::string lastError;
+
+    // files the program was built from: the stages and everything they #include
+    std::vector<std::string> files;
+
+    // one preprocessed stage; files[i] is the file that "#line n i" directives in code refer to
+    struct Stage
+    {
+        std::string code;
+        std::vector<std::string> files;
+    };
+    // shader sources as read from disk, kept separate from compilation so that files
+    // can be (re)read on a worker thread while the GL work stays on the render thread
+    struct Sources
+    {
+        Stage vertex;
+        Stage fragment;
+        Stage geometry;
+        std::string error;
+
+        std::vector<std::string> allFiles() const
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            std::vector<std::string> all;
+            for (const Stage* stage : {&vertex, &fragment, &geometry})
+                for (const std::string& file : stage->files)
+                    if (std::find(all.begin(), all.end(), file) == all.end())
+                        all.push_back(file);
+            return all;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
-        if(geometryPath != nullptr)
+    };
+
+    // constructor generates the shader on the fly
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           std::vector<std::string> defines = std::vector<std::string>())
+        : vertexPath(vertexPath), fragmentPath(fragmentPath),
+          geometryPath(geometryPath != nullptr ? geometryPath : ""), defines(std::move(defines))
+    {
+        if (!rebuild(loadSources()))
+            std::cout << lastError << std::endl;
+    }
+
+    // reads and preprocesses all stages; touches no GL state so it is safe to call from any thread
+    // ------------------------------------------------------------------------
+    Sources loadSources() const
+    {
+        Sources sources;
+        sources.vertex = loadStage(vertexPath, sources.error);
+        sources.fragment = loadStage(fragmentPath, sources.error);
+        if (!geometryPath.empty())
+            sources.geometry = loadStage(geometryPath, sources.error);
+        return sources;
+    }
+
+    // a compiled and linked program that hasn't replaced the current one yet, see compile() and adopt()
+    struct Build
+    {
+        GLProgram program;
+        std::vector<std::string> files;
+        std::string log;
+    };
+
+    // compiles and links the given sources. On success the new program replaces the current one,
+    // on failure the current program is kept and the compiler output is stored in lastError.
+    // ------------------------------------------------------------------------
+    bool rebuild(const Sources& sources)
+    {
+        return adopt(compile(sources));
+    }
+
+    // compiles and links without touching the Shader, so it can run on another context sharing objects with
+    // this one's; the program is empty if the build failed
+    // ------------------------------------------------------------------------
+    static Build compile(const Sources& sources)
+    {
+        Build build;
+        // keep the dependencies even if the build fails, fixing an included file has to trigger a reload
+        build.files = sources.allFiles();
+        if (!sources.error.empty())
         {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            build.log = sources.error;
+            return build;
         }
+        unsigned int vertex = compileStage(GL_VERTEX_SHADER, sources.vertex, "VERTEX", build.log);
+        unsigned int fragment = compileStage(GL_FRAGMENT_SHADER, sources.fragment, "FRAGMENT", build.log);
+        unsigned int geometry = 0;
+        if (!sources.geometry.code.empty())
+            geometry = compileStage(GL_GEOMETRY_SHADER, sources.geometry, "GEOMETRY", build.log);
         // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        if (geometry != 0)
+            glAttachShader(program, geometry);
+        glLinkProgram(program);
+        bool linked = checkCompileErrors(program, "PROGRAM", build.log);
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if(geometryPath != nullptr)
+        if (geometry != 0)
             glDeleteShader(geometry);
 
+        if (!linked || !build.log.empty())
+            glDeleteProgram(program);
+        else
+            build.program.reset(program);
+        return build;
+    }
+
+    // swaps in a program from compile(), on the thread that owns this context; a failed build keeps the current
+    // program and leaves its log in lastError
+    // ------------------------------------------------------------------------
+    bool adopt(Build build)
+    {
+        files = std::move(build.files);
+        if (build.program == 0)
+        {
+            lastError = build.log;
+            return false;
+        }
+        // swap in the new program, uniforms have to be set up again on the new object
+        GLint previous = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+        if ((unsigned int)previous == ID)
+            previous = build.program;
+        ID = std::move(build.program);
+        lastError.clear();
+        if (onLink)
+        {
+            glUseProgram(ID);
+            onLink(*this);
+        }
+        glUseProgram(previous);
+        return true;
     }
+
+    // registers uniform setup that has to survive a rebuild (sampler units and the like)
+    // ------------------------------------------------------------------------
+    void setOnLink(std::function<void(Shader&)> callback)
+    {
+        onLink = callback;
+        if (ID != 0)
+        {
+            use();
+            onLink(*this);
+        }
+    }
+
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
@@ -169,9 +239,126 @@ public:
     }
 
 private:
+    std::function<void(Shader&)> onLink;
+
+    static std::string readStage(const std::string& path, std::string& error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error += "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " + path + "\n";
+            return "";
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        return stream.str();
+    }
+
+    Stage loadStage(const std::string& path, std::string& error) const
+    {
+        Stage stage;
+        stage.code = injectDefines(expandIncludes(path, stage.files, error));
+        return stage;
+    }
+
+    // replaces every #include "file" (relative to the including file) with the file's contents.
+    // Each included file gets its own source string number and #line directives around it,
+    // so compiler messages can be mapped back to file and line, see translateLog.
+    // A file is only pasted the first time it is included.
+    static std::string expandIncludes(const std::string& path, std::vector<std::string>& files, std::string& error)
+    {
+        int index = (int)files.size();
+        files.push_back(path);
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+        std::istringstream in(readStage(path, error));
+        std::string line;
+        std::string out;
+        int number = 0;
+        while (std::getline(in, line))
+        {
+            ++number;
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            {
+                out += line + '\n';
+                continue;
+            }
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+            if (close == std::string::npos)
+            {
+                error += path + ":" + std::to_string(number) + ": malformed #include\n";
+                continue;
+            }
+            std::string included = directory + line.substr(open + 1, close - open - 1);
+            if (std::find(files.begin(), files.end(), included) == files.end())
+            {
+                out += "#line 1 " + std::to_string(files.size()) + "\n";
+                out += expandIncludes(included, files, error);
+            }
+            out += "#line " + std::to_string(number + 1) + " " + std::to_string(index) + "\n";
+        }
+        return out;
+    }
+
+    // rewrites "N:L", "N(L)" source references of the common driver log formats into "file:L"
+    static std::string translateLog(const std::string& log, const std::vector<std::string>& files)
+    {
+        static const std::regex mesaStyle("^(\\s*(?:ERROR: |WARNING: )?)(\\d+):(\\d+)");
+        static const std::regex nvidiaStyle("^(\\s*)(\\d+)\\((\\d+)\\)");
+        std::istringstream in(log);
+        std::string line;
+        std::string out;
+        while (std::getline(in, line))
+        {
+            std::smatch match;
+            if (std::regex_search(line, match, mesaStyle) || std::regex_search(line, match, nvidiaStyle))
+            {
+                size_t source = std::stoul(match[2].str());
+                if (source < files.size())
+                    line = match[1].str() + files[source] + ":" + match[3].str() + line.substr(match[0].length());
+            }
+            out += line + '\n';
+        }
+        return out;
+    }
+
+    // #version has to stay the first directive, so the defines go right after it followed by a #line
+    // that restores the original numbering for compiler messages
+    std::string injectDefines(const std::string& source) const
+    {
+        if (defines.empty())
+            return source;
+        size_t version = source.find("#version");
+        if (version == std::string::npos)
+            return source;
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return source;
+        int nextLine = 2 + (int)std::count(source.begin(), source.begin() + version, '\n');
+        std::string block;
+        for (const std::string& define : defines)
+            block += "#define " + define + "\n";
+        block += "#line " + std::to_string(nextLine) + "\n";
+        return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+    }
+
+    static unsigned int compileStage(GLenum type, const Stage& stage, const std::string& name, std::string& log)
+    {
+        const char* code = stage.code.c_str();
+        unsigned int shader = glCreateShader(type);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        std::string stageLog;
+        if (!checkCompileErrors(shader, name, stageLog))
+            log += translateLog(stageLog, stage.files);
+        return shader;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type, std::string& log)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -181,7 +368,7 @@ private:
             if(!success)
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                log += "ERROR::SHADER_COMPILATION_ERROR of type: " + type + "\n" + infoLog + "\n -- --------------------------------------------------- -- \n";
             }
         }
         else
@@ -190,9 +377,10 @@ private:
             if(!success)
             {
                 glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                log += "ERROR::PROGRAM_LINKING_ERROR of type: " + type + "\n" + infoLog + "\n -- --------------------------------------------------- -- \n";
             }
         }
+        return success;
     }
 };
 #endif
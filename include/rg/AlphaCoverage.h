@@ -0,0 +1,24 @@
+#ifndef PROJECT_BASE_ALPHACOVERAGE_H
+#define PROJECT_BASE_ALPHACOVERAGE_H
+
+#include <cstddef>
+
+// Sorts an RGBA image by its alpha channel, for picking the material's shader variant. hasAlpha when any texel is
+// noticeably transparent, so an image that is opaque everywhere doesn't need the alpha-tested variant; softAlpha when
+// more texels are partly transparent than cut out, so it wants blending rather than the alpha test.
+inline void classifyAlpha(const unsigned char* rgba, size_t texels, bool* hasAlpha, bool* softAlpha) {
+    size_t transparent = 0, partial = 0;
+    for (size_t i = 0; i < texels; i++) {
+        unsigned char alpha = rgba[i * 4 + 3];
+        if (alpha < 26)
+            transparent++;
+        else if (alpha < 230)
+            partial++;
+    }
+    if (hasAlpha)
+        *hasAlpha = transparent + partial > 0;
+    if (softAlpha)
+        *softAlpha = partial > transparent;
+}
+
+#endif //PROJECT_BASE_ALPHACOVERAGE_H
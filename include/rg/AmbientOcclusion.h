@@ -0,0 +1,151 @@
+#ifndef PROJECT_BASE_AMBIENTOCCLUSION_H
+#define PROJECT_BASE_AMBIENTOCCLUSION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+enum AmbientOcclusionQuality {
+    AO_OFF,
+    AO_LOW,
+    AO_MEDIUM,
+    AO_HIGH,
+};
+
+// Screen-space ambient occlusion from the depth pre-pass, darkening the ambient terms of the lit shaders.
+// It runs at half resolution: compute() samples a hemisphere kernel with interleaved rotations, blur() is one
+// direction of a separable bilateral blur that also averages the interleaving out, and upsample() brings the result
+// to the scene resolution with depth-aware weights. The lit shaders read the full resolution texture once per
+// fragment, the AMBIENT_OCCLUSION variant of lighting.glsl.
+// The targets come from the frame graph, every step draws into the bound framebuffer: RG16F (occlusion and linear
+// depth) at half resolution, R8 at full resolution for the last.
+class AmbientOcclusion {
+public:
+    static const int TEXTURE_UNIT = 13;
+    static const int MAX_SAMPLES = 16;
+
+    AmbientOcclusionQuality quality = AO_MEDIUM;
+    // view-space radius of the sampled hemisphere
+    float radius = 0.8f;
+    float bias = 0.03f;
+    // exponent on the result, above 1 darkens
+    float intensity = 1.5f;
+    // relative depth difference the blur and upsample still treat as one surface
+    float depthTolerance = 0.05f;
+
+    explicit AmbientOcclusion(ShaderWatcher* watcher = nullptr)
+        : ssaoShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao.fs"),
+          blurShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao_blur.fs"),
+          upsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao_upsample.fs") {
+        ssaoShader.setOnLink([](Shader& s) {
+            s.setInt("depth", 0);
+            // a hemisphere spread evenly by the golden angle, most samples close to the center where the
+            // occlusion matters most
+            for (int i = 0; i < MAX_SAMPLES; i++) {
+                float t = (i + 0.5f) / MAX_SAMPLES;
+                float cosTheta = 1.0f - t;
+                float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+                float phi = i * 2.39996323f;
+                float length = 0.1f + 0.9f * t * t;
+                glm::vec3 sample(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, std::max(cosTheta, 0.1f));
+                s.setVec3("kernel[" + std::to_string(i) + "]", glm::normalize(sample) * length);
+            }
+        });
+        blurShader.setOnLink([](Shader& s) { s.setInt("source", 0); });
+        upsampleShader.setOnLink([](Shader& s) {
+            s.setInt("source", 0);
+            s.setInt("depth", 1);
+        });
+        if (watcher)
+            for (Shader* shader : {&ssaoShader, &blurShader, &upsampleShader})
+                watcher->watch(*shader);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~AmbientOcclusion() {
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    AmbientOcclusion(const AmbientOcclusion&) = delete;
+    AmbientOcclusion& operator=(const AmbientOcclusion&) = delete;
+
+    bool enabled() const {
+        return quality != AO_OFF;
+    }
+
+    int sampleCount() const {
+        const int tierSamples[] = {0, 6, 10, MAX_SAMPLES};
+        return tierSamples[quality];
+    }
+
+    // size of the half resolution targets for a scene of size
+    static int halfSize(int size) {
+        return (size + 1) / 2;
+    }
+
+    // occlusion of the scene depth into the bound half resolution target; projection is the one the depth was
+    // rendered with
+    void compute(GLuint depth, const glm::mat4& projection) {
+        ssaoShader.use();
+        ssaoShader.setMat4("projection", projection);
+        ssaoShader.setMat4("inverseProjection", glm::inverse(projection));
+        ssaoShader.setInt("sampleCount", sampleCount());
+        ssaoShader.setFloat("radius", radius);
+        ssaoShader.setFloat("bias", bias);
+        ssaoShader.setFloat("intensity", intensity);
+        draw(depth, 0);
+    }
+
+    void blur(GLuint source, bool vertical) {
+        blurShader.use();
+        glUniform2i(glGetUniformLocation(blurShader.ID, "direction"), vertical ? 0 : 1, vertical ? 1 : 0);
+        blurShader.setFloat("depthTolerance", depthTolerance);
+        draw(source, 0);
+    }
+
+    // the blurred occlusion into the bound full resolution target, with the planes of the scene projection
+    void upsample(GLuint source, GLuint depth, float nearPlane, float farPlane) {
+        upsampleShader.use();
+        upsampleShader.setFloat("nearPlane", nearPlane);
+        upsampleShader.setFloat("farPlane", farPlane);
+        upsampleShader.setFloat("depthTolerance", depthTolerance);
+        draw(source, depth);
+    }
+
+    // makes the full resolution result available to the lit shaders
+    void bind(GLuint occlusion) const {
+        glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, occlusion);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    static void setUniforms(Shader& shader) {
+        shader.setInt("ambientOcclusion", TEXTURE_UNIT);
+    }
+
+private:
+    Shader ssaoShader;
+    Shader blurShader;
+    Shader upsampleShader;
+    GLuint emptyVAO;
+
+    void draw(GLuint texture0, GLuint texture1) {
+        glDisable(GL_DEPTH_TEST);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, texture1);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture0);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+};
+
+#endif //PROJECT_BASE_AMBIENTOCCLUSION_H
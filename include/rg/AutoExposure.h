@@ -0,0 +1,151 @@
+#ifndef PROJECT_BASE_AUTOEXPOSURE_H
+#define PROJECT_BASE_AUTOEXPOSURE_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+#include <algorithm>
+
+// Automatic exposure from a luminance histogram of the HDR scene, entirely on the GPU.
+// GL 3.3 has no compute shaders, so the histogram is scattered instead: one point per sample of the scene lands on
+// its bin's pixel in a BINS x 1 float target and additive blending counts it. A second pass turns the histogram
+// into an exposure and eases it towards that over time, writing a 1x1 texture the tonemap pass reads directly.
+// The exposure textures ping-pong so the adaptation can read last frame's value.
+class AutoExposure {
+public:
+    static const int BINS = 64;
+    // the histogram samples at most this many points across the screen
+    static const int MAX_SAMPLES_X = 256;
+
+    // log2 luminance range the histogram covers
+    float minLogLuminance = -8.0f;
+    float maxLogLuminance = 4.0f;
+    float lowPercent = 0.5f;
+    float highPercent = 0.95f;
+    float keyValue = 0.4f;
+    float minExposure = 0.1f;
+    float maxExposure = 8.0f;
+    float speedUp = 3.0f;
+    float speedDown = 1.5f;
+
+    explicit AutoExposure(ShaderWatcher* watcher = nullptr)
+        : histogramShader("resources/shaders/histogram.vs", "resources/shaders/histogram.fs"),
+          exposureShader("resources/shaders/fullscreen.vs", "resources/shaders/exposure.fs") {
+        histogramShader.setOnLink([](Shader& s) { s.setInt("scene", 0); });
+        exposureShader.setOnLink([](Shader& s) {
+            s.setInt("histogram", 0);
+            s.setInt("previousExposure", 1);
+        });
+        if (watcher) {
+            watcher->watch(histogramShader);
+            watcher->watch(exposureShader);
+        }
+        glGenVertexArrays(1, &emptyVAO);
+
+        createTarget(histogramTexture, histogramFBO, BINS, nullptr);
+        // start from exposure 1, the same as without auto exposure
+        float one = 1.0f;
+        for (int i = 0; i < 2; i++)
+            createTarget(exposureTextures[i], exposureFBOs[i], 1, &one);
+    }
+
+    ~AutoExposure() {
+        glDeleteFramebuffers(1, &histogramFBO);
+        glDeleteTextures(1, &histogramTexture);
+        glDeleteFramebuffers(2, exposureFBOs);
+        glDeleteTextures(2, exposureTextures);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    AutoExposure(const AutoExposure&) = delete;
+    AutoExposure& operator=(const AutoExposure&) = delete;
+
+    // builds the histogram of the scene texture and adapts the exposure; restores the framebuffer and viewport
+    void update(GLuint sceneTexture, int width, int height, float deltaTime) {
+        GLint previousViewport[4], previousFramebuffer;
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+
+        int stride = std::max(1, width / MAX_SAMPLES_X);
+        int samplesX = std::max(1, width / stride), samplesY = std::max(1, height / stride);
+        float logRange = std::max(maxLogLuminance - minLogLuminance, 1e-3f);
+        glBindFramebuffer(GL_FRAMEBUFFER, histogramFBO);
+        glViewport(0, 0, BINS, 1);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        histogramShader.use();
+        glUniform2i(glGetUniformLocation(histogramShader.ID, "sampleGrid"), samplesX, samplesY);
+        histogramShader.setFloat("minLogLuminance", minLogLuminance);
+        histogramShader.setFloat("inverseLogRange", 1.0f / logRange);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sceneTexture);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_POINTS, 0, samplesX * samplesY);
+
+        glDisable(GL_BLEND);
+        int previous = current;
+        current = 1 - current;
+        glBindFramebuffer(GL_FRAMEBUFFER, exposureFBOs[current]);
+        glViewport(0, 0, 1, 1);
+        exposureShader.use();
+        exposureShader.setFloat("minLogLuminance", minLogLuminance);
+        exposureShader.setFloat("logRange", logRange);
+        exposureShader.setFloat("lowPercent", lowPercent);
+        exposureShader.setFloat("highPercent", std::max(highPercent, lowPercent));
+        exposureShader.setFloat("keyValue", keyValue);
+        exposureShader.setFloat("minExposure", minExposure);
+        exposureShader.setFloat("maxExposure", maxExposure);
+        exposureShader.setFloat("deltaTime", deltaTime);
+        exposureShader.setFloat("speedUp", speedUp);
+        exposureShader.setFloat("speedDown", speedDown);
+        glBindTexture(GL_TEXTURE_2D, histogramTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, exposureTextures[previous]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    }
+
+    // 1x1 R32F texture with the current exposure, for the tonemap pass
+    GLuint exposureTexture() const {
+        return exposureTextures[current];
+    }
+
+    // the texture the next update() writes
+    GLuint nextExposureTexture() const {
+        return exposureTextures[1 - current];
+    }
+
+private:
+    Shader histogramShader;
+    Shader exposureShader;
+    GLuint emptyVAO;
+    GLuint histogramTexture, histogramFBO;
+    GLuint exposureTextures[2], exposureFBOs[2];
+    int current = 0;
+
+    static void createTarget(GLuint& texture, GLuint& fbo, int width, const float* data) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, 1, 0, GL_RED, GL_FLOAT, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif //PROJECT_BASE_AUTOEXPOSURE_H
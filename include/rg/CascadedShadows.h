@@ -0,0 +1,278 @@
+#ifndef PROJECT_BASE_CASCADEDSHADOWS_H
+#define PROJECT_BASE_CASCADEDSHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+// something that casts a shadow: a depth-only draw plus the box it fits in
+struct ShadowCaster {
+    glm::mat4 transform;
+    // object-space bounds, transformed by `transform`
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // static casters never move, only they are drawn into the cached far cascades
+    bool isStatic;
+    // draws positions only with the shadow program bound and its model matrix set
+    std::function<void()> draw;
+    // ShadowAtlas id of a light inside this caster, which it doesn't shadow (a lamp around its own bulb)
+    int housedLight = -1;
+};
+
+// Cascaded shadow maps for the directional light, one layer of a depth texture array per cascade.
+// The cascades split the view frustum up to `distance`. Each one is a light-space square around the bounding
+// sphere of its slice of the frustum, snapped to whole texels so it doesn't shimmer as the camera moves, with a
+// depth range fitted to the casters' bounds. Casters are culled per cascade.
+// Cascades from FIRST_CACHED on hold only static casters and snap to a coarse grid, so their matrix, and with it
+// the rendered map, only changes when the light turns or the camera crosses a grid cell.
+class CascadedShadows {
+public:
+    static const int CASCADES = 4;
+    // the full resolution, setResolution() can lower it
+    static const int SIZE = 2048;
+    static const int FIRST_CACHED = 2;
+    static const int TEXTURE_UNIT = 11;
+
+    // blend between logarithmic and uniform split distances, 1 is fully logarithmic
+    float splitLambda = 0.8f;
+    float distance = 100.0f;
+    bool caching = true;
+
+    CascadedShadows() {
+        glGenTextures(1, &depthArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, CASCADES, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        // hardware 2x2 PCF on every lookup
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        // outside the map is lit
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (Cascade& cascade : cascades)
+            cascade.valid = false;
+    }
+
+    ~CascadedShadows() {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &depthArray);
+    }
+
+    CascadedShadows(const CascadedShadows&) = delete;
+    CascadedShadows& operator=(const CascadedShadows&) = delete;
+
+    // forces the cached cascades to redraw, e.g. after static geometry changed
+    void invalidate() {
+        for (Cascade& cascade : cascades)
+            cascade.valid = false;
+    }
+
+    // reallocates the cascades at size x size texels, at most SIZE; they all redraw next frame
+    void setResolution(int size) {
+        size = std::min(std::max(size, 64), SIZE);
+        if (size == this->size)
+            return;
+        this->size = size;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, CASCADES, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        invalidate();
+    }
+
+    int resolution() const { return size; }
+
+    // fits the cascades to the camera and renders the ones that changed; shader must be depth.vs/fs
+    void render(const std::vector<ShadowCaster>& casters, Shader& shader, const glm::mat4& view, float fovY,
+                float aspect, float nearPlane, const glm::vec3& lightDirection) {
+        glm::vec3 direction = glm::normalize(lightDirection);
+        // light space rotation around the origin; translating it with the camera would defeat the texel snapping
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+        if (direction != lastDirection) {
+            invalidate();
+            lastDirection = direction;
+        }
+
+        // light-space boxes of every caster and of the static ones, for culling and depth ranges
+        std::vector<glm::vec3> casterMin(casters.size()), casterMax(casters.size());
+        glm::vec3 allMin(1e30f), allMax(-1e30f), staticMin(1e30f), staticMax(-1e30f);
+        for (size_t i = 0; i < casters.size(); i++) {
+            transformBounds(lightRotation * casters[i].transform, casters[i].boundsMin, casters[i].boundsMax,
+                            casterMin[i], casterMax[i]);
+            allMin = glm::min(allMin, casterMin[i]);
+            allMax = glm::max(allMax, casterMax[i]);
+            if (casters[i].isStatic) {
+                staticMin = glm::min(staticMin, casterMin[i]);
+                staticMax = glm::max(staticMax, casterMax[i]);
+            }
+        }
+
+        GLint previousViewport[4], previousFramebuffer;
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, size, size);
+        // slope scaled bias against acne, applied while rendering instead of per lookup
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.0f);
+        shader.use();
+        shader.setMat4("view", glm::mat4(1.0f));
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanHalfY = std::tan(fovY * 0.5f), tanHalfX = tanHalfY * aspect;
+        renderedCascades = 0;
+        for (int i = 0; i < CASCADES; i++) {
+            Cascade& cascade = cascades[i];
+            bool cached = caching && i >= FIRST_CACHED;
+            float sliceNear = splitDistance(i, nearPlane), sliceFar = splitDistance(i + 1, nearPlane);
+            cascade.splitFar = sliceFar;
+
+            // bounding sphere of the frustum slice, its size only depends on the projection
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int c = 0; c < 8; c++) {
+                float depth = (c & 4) ? sliceFar : sliceNear;
+                glm::vec4 corner(((c & 1) ? 1.0f : -1.0f) * depth * tanHalfX, ((c & 2) ? 1.0f : -1.0f) * depth * tanHalfY,
+                                 -depth, 1.0f);
+                corners[c] = glm::vec3(inverseView * corner);
+                center += corners[c] / 8.0f;
+            }
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            // round up so float noise doesn't change the texel size from frame to frame
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // snap the center in light space: to texels, or for cached cascades to a coarse grid, widening the
+            // square so the slice stays covered anywhere within a cell
+            glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+            float snap = cached ? radius * 0.25f : 2.0f * radius / size;
+            if (cached)
+                radius += snap;
+            lightCenter.x = std::floor(lightCenter.x / snap) * snap;
+            lightCenter.y = std::floor(lightCenter.y / snap) * snap;
+
+            // depth range from the casters that can land in the map; lookups past the far end count as lit
+            glm::vec3 rangeMin = cached ? staticMin : allMin;
+            glm::vec3 rangeMax = cached ? staticMax : allMax;
+            if (rangeMin.z > rangeMax.z) {
+                // nothing to cast, keep a valid projection around the slice
+                rangeMin.z = lightCenter.z - radius;
+                rangeMax.z = lightCenter.z + radius;
+            }
+            glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+                                              lightCenter.y - radius, lightCenter.y + radius,
+                                              -rangeMax.z - 1.0f, -rangeMin.z + 1.0f);
+            glm::mat4 matrix = projection * lightRotation;
+
+            if (cached && cascade.valid && matrix == cascade.matrix) {
+                cascade.drawnCasters = 0;
+                continue;
+            }
+            cascade.matrix = matrix;
+            cascade.valid = cached;
+            renderedCascades++;
+
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            shader.setMat4("projection", matrix);
+            cascade.drawnCasters = 0;
+            for (size_t c = 0; c < casters.size(); c++) {
+                if (cached && !casters[c].isStatic)
+                    continue;
+                // per-cascade culling against the square; depth is covered by the fitted range
+                if (casterMax[c].x < lightCenter.x - radius || casterMin[c].x > lightCenter.x + radius ||
+                    casterMax[c].y < lightCenter.y - radius || casterMin[c].y > lightCenter.y + radius)
+                    continue;
+                shader.setMat4("model", casters[c].transform);
+                casters[c].draw();
+                cascade.drawnCasters++;
+            }
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    }
+
+    void bind() const {
+        glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // uniforms of CalcShadow in lighting.glsl
+    void setUniforms(Shader& shader) const {
+        // maps light clip space [-1, 1] to texture coordinates and depth [0, 1]
+        const glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+        shader.setInt("shadowMap", TEXTURE_UNIT);
+        for (int i = 0; i < CASCADES; i++) {
+            std::string index = "[" + std::to_string(i) + "]";
+            shader.setMat4("shadowMatrices" + index, bias * cascades[i].matrix);
+            shader.setFloat("cascadeSplits" + index, cascades[i].splitFar);
+        }
+    }
+
+    int renderedCascadeCount() const { return renderedCascades; }
+    int drawnCasters(int cascade) const { return cascades[cascade].drawnCasters; }
+    float splitFar(int cascade) const { return cascades[cascade].splitFar; }
+
+private:
+    struct Cascade {
+        glm::mat4 matrix;
+        float splitFar;
+        // the layer holds what `matrix` describes, only kept for cached cascades
+        bool valid;
+        int drawnCasters = 0;
+    };
+
+    GLuint depthArray;
+    GLuint fbo;
+    int size = SIZE;
+    Cascade cascades[CASCADES];
+    glm::vec3 lastDirection = glm::vec3(0.0f);
+    int renderedCascades = 0;
+
+    float splitDistance(int split, float nearPlane) const {
+        float t = (float)split / CASCADES;
+        float logarithmic = nearPlane * std::pow(distance / nearPlane, t);
+        float uniform = nearPlane + (distance - nearPlane) * t;
+        return splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+    }
+
+    static void transformBounds(const glm::mat4& matrix, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                                glm::vec3& outMin, glm::vec3& outMax) {
+        outMin = glm::vec3(1e30f);
+        outMax = glm::vec3(-1e30f);
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 corner((c & 1) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y,
+                             (c & 4) ? boundsMax.z : boundsMin.z);
+            glm::vec3 transformed = glm::vec3(matrix * glm::vec4(corner, 1.0f));
+            outMin = glm::min(outMin, transformed);
+            outMax = glm::max(outMax, transformed);
+        }
+    }
+};
+
+#endif //PROJECT_BASE_CASCADEDSHADOWS_H
@@ -0,0 +1,364 @@
+#ifndef PROJECT_BASE_CLUSTEREDLIGHTS_H
+#define PROJECT_BASE_CLUSTEREDLIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/DynamicRing.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CLUSTERED_LIGHTS_SSE
+#endif
+
+struct PointLight {
+    glm::vec3 position;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    // first of its six tiles in the shadow atlas, -1 for no shadow, see ShadowAtlas
+    int shadowTile = -1;
+};
+
+// Clustered forward lighting. The view frustum is split into TILES_X x TILES_Y screen tiles and SLICES exponential
+// depth slices; every frame each point light is binned on the CPU into the clusters its range sphere touches.
+// Lights, the per-cluster (offset, count) grid and the flat light index list go to the GPU as texture buffers,
+// and lighting.glsl loops only over the lights of the fragment's cluster. All three are written straight into one
+// DynamicRing; the texture buffers view the whole ring and clusterBase says where this frame's data starts.
+class ClusteredLights {
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+    static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    // lights past this in a single cluster are dropped, see overflowedClusters()
+    static const int MAX_LIGHTS_PER_CLUSTER = 256;
+    // the three buffer textures sit on these units, above anything a material uses
+    static const int FIRST_TEXTURE_UNIT = 8;
+    // a light's range ends where it adds less than this to any channel
+    static constexpr float CUTOFF = 5.0f / 256.0f;
+
+    ClusteredLights() : ring(GL_TEXTURE_BUFFER, 256 * 1024) {
+        glGenTextures(3, textures);
+        attachRing();
+        clusterLights.resize(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+        clusterCounts.resize(CLUSTER_COUNT);
+    }
+
+    ~ClusteredLights() {
+        glDeleteTextures(3, textures);
+    }
+
+    ClusteredLights(const ClusteredLights&) = delete;
+    ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+    void clear() {
+        lights.clear();
+    }
+
+    void add(const PointLight& light) {
+        if (lights.size() < 65535)
+            lights.push_back(light);
+    }
+
+    size_t size() const {
+        return lights.size();
+    }
+
+    // distance at which 1 / (constant + linear * d + quadratic * d^2) brings the brightest channel below CUTOFF
+    static float range(const PointLight& light) {
+        glm::vec3 peak = glm::max(light.ambient + light.diffuse, light.specular);
+        return range(std::max(peak.x, std::max(peak.y, peak.z)), light.constant, light.linear, light.quadratic);
+    }
+
+    static float range(float intensity, float constant, float linear, float quadratic) {
+        float c = constant - intensity / CUTOFF;
+        if (c >= 0.0f)
+            return 0.0f;
+        if (quadratic > 0.0f)
+            return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+        if (linear > 0.0f)
+            return -c / linear;
+        // no falloff at all, reaches everything
+        return 1e30f;
+    }
+
+    // bins the lights for this camera and uploads lights, grid and index list
+    void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane, int viewportWidth, int viewportHeight) {
+        if (fovY != boundsFovY || aspect != boundsAspect || nearPlane != boundsNear || farPlane != boundsFar)
+            buildClusterBounds(fovY, aspect, nearPlane, farPlane);
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        this->viewportWidth = viewportWidth;
+        this->viewportHeight = viewportHeight;
+
+        std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+        ranges.resize(lights.size());
+        visibleLights = 0;
+        for (size_t i = 0; i < lights.size(); i++) {
+            const PointLight& light = lights[i];
+            ranges[i] = range(light);
+            if (ranges[i] > 0.0f && bin((uint16_t)i, glm::vec3(view * glm::vec4(light.position, 1.0f)), ranges[i]))
+                visibleLights++;
+        }
+
+        // the sizes first, the ring needs them before anything is written
+        indexTotal = 0;
+        overflowed = 0;
+        maxLightsPerCluster = 0;
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+            int count = clusterCounts[cluster];
+            if (count > MAX_LIGHTS_PER_CLUSTER) {
+                overflowed++;
+                count = MAX_LIGHTS_PER_CLUSTER;
+            }
+            maxLightsPerCluster = std::max(maxLightsPerCluster, count);
+            indexTotal += count;
+        }
+        size_t lightFloats = std::max<size_t>(lights.size(), 1) * 20;
+        size_t indexCount = std::max<size_t>(indexTotal, 1);
+        ring.beginFrame(lightFloats * sizeof(float) + CLUSTER_COUNT * 2 * sizeof(uint32_t) +
+                        indexCount * sizeof(uint16_t) + 3 * DynamicRing::ALIGNMENT);
+        if (ring.buffer() != attachedBuffer)
+            attachRing();
+
+        RingAllocation<float> lightData = ring.allocate<float>(lightFloats);
+        for (size_t i = 0; i < lights.size(); i++)
+            packLight(lights[i], ranges[i], lightData.data + i * 20);
+        // compact the fixed size per-cluster lists into one index list
+        RingAllocation<uint32_t> grid = ring.allocate<uint32_t>(CLUSTER_COUNT * 2);
+        RingAllocation<uint16_t> indices = ring.allocate<uint16_t>(indexCount);
+        uint32_t next = 0;
+        indices.data[0] = 0;
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+            int count = std::min(clusterCounts[cluster], MAX_LIGHTS_PER_CLUSTER);
+            grid.data[cluster * 2 + 0] = next;
+            grid.data[cluster * 2 + 1] = (uint32_t)count;
+            const uint16_t* list = &clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER];
+            std::copy(list, list + count, indices.data + next);
+            next += count;
+        }
+        ring.flush();
+        // in texels of each buffer's format
+        base = glm::ivec3(lightData.offset / 16, grid.offset / 8, indices.offset / 2);
+    }
+
+    void bind() const {
+        for (int i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE0 + FIRST_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // per-frame uniforms of the cluster lookup in lighting.glsl
+    void setUniforms(Shader& shader) const {
+        shader.setInt("clusterLights", FIRST_TEXTURE_UNIT);
+        shader.setInt("clusterGrid", FIRST_TEXTURE_UNIT + 1);
+        shader.setInt("clusterLightIndices", FIRST_TEXTURE_UNIT + 2);
+        glUniform3ui(glGetUniformLocation(shader.ID, "clusterDims"), TILES_X, TILES_Y, SLICES);
+        glUniform3i(glGetUniformLocation(shader.ID, "clusterBase"), base.x, base.y, base.z);
+        setViewportSize(shader, viewportWidth, viewportHeight);
+        shader.setFloat("clusterNear", nearPlane);
+        shader.setFloat("clusterFar", farPlane);
+    }
+
+    // for a shader that draws into a target of another size than the one update() was given, the shader is bound
+    void setViewportSize(Shader& shader, int width, int height) const {
+        shader.setVec2("clusterTileScale", glm::vec2((float)TILES_X / width, (float)TILES_Y / height));
+    }
+
+    int visibleLightCount() const { return visibleLights; }
+    size_t indexCount() const { return indexTotal; }
+    int maxLightsInCluster() const { return maxLightsPerCluster; }
+    int overflowedClusters() const { return overflowed; }
+
+private:
+    std::vector<PointLight> lights;
+
+    DynamicRing ring;
+    // the ring buffer the textures view, it changes when the ring grows
+    GLuint attachedBuffer = 0;
+    GLuint textures[3];
+    // where this frame's lights, grid and indices start in the ring, in texels
+    glm::ivec3 base = glm::ivec3(0);
+
+    // view-space bounds of every cluster, structure of arrays so four clusters along x test in one SSE op.
+    // z is the positive distance in front of the camera
+    std::vector<float> minX, maxX, minY, maxY, minZ, maxZ;
+    float boundsFovY = 0.0f, boundsAspect = 0.0f, boundsNear = 0.0f, boundsFar = 0.0f;
+    float tanHalfX = 1.0f, tanHalfY = 1.0f;
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    int viewportWidth = 1, viewportHeight = 1;
+
+    std::vector<uint16_t> clusterLights;
+    std::vector<int> clusterCounts;
+    std::vector<float> ranges;
+    size_t indexTotal = 0;
+
+    int visibleLights = 0;
+    int maxLightsPerCluster = 0;
+    int overflowed = 0;
+
+    static int clusterIndex(int x, int y, int z) {
+        return x + TILES_X * (y + TILES_Y * z);
+    }
+
+    float sliceDepth(int slice) const {
+        return nearPlane * std::pow(farPlane / nearPlane, (float)slice / SLICES);
+    }
+
+    int sliceOf(float depth) const {
+        int slice = (int)std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * SLICES);
+        return std::min(std::max(slice, 0), SLICES - 1);
+    }
+
+    void buildClusterBounds(float fovY, float aspect, float nearPlane, float farPlane) {
+        boundsFovY = fovY;
+        boundsAspect = aspect;
+        boundsNear = this->nearPlane = nearPlane;
+        boundsFar = this->farPlane = farPlane;
+        tanHalfY = std::tan(fovY * 0.5f);
+        tanHalfX = tanHalfY * aspect;
+        for (std::vector<float>* bounds : {&minX, &maxX, &minY, &maxY, &minZ, &maxZ})
+            bounds->resize(CLUSTER_COUNT);
+        for (int z = 0; z < SLICES; z++) {
+            float z0 = sliceDepth(z), z1 = sliceDepth(z + 1);
+            for (int y = 0; y < TILES_Y; y++) {
+                float y0 = (-1.0f + 2.0f * y / TILES_Y) * tanHalfY, y1 = (-1.0f + 2.0f * (y + 1) / TILES_Y) * tanHalfY;
+                for (int x = 0; x < TILES_X; x++) {
+                    float x0 = (-1.0f + 2.0f * x / TILES_X) * tanHalfX, x1 = (-1.0f + 2.0f * (x + 1) / TILES_X) * tanHalfX;
+                    int i = clusterIndex(x, y, z);
+                    // the tile's frustum widens with depth, so the box spans both its near and far face
+                    minX[i] = std::min(x0 * z0, x0 * z1);
+                    maxX[i] = std::max(x1 * z0, x1 * z1);
+                    minY[i] = std::min(y0 * z0, y0 * z1);
+                    maxY[i] = std::max(y1 * z0, y1 * z1);
+                    minZ[i] = z0;
+                    maxZ[i] = z1;
+                }
+            }
+        }
+    }
+
+    // four floats per texel: position/range, ambient/constant, diffuse/linear, specular/quadratic, shadow tile
+    static void packLight(const PointLight& light, float range, float* data) {
+        const glm::vec3* vectors[4] = {&light.position, &light.ambient, &light.diffuse, &light.specular};
+        float scalars[4] = {range, light.constant, light.linear, light.quadratic};
+        for (int i = 0; i < 4; i++) {
+            data[i * 4 + 0] = vectors[i]->x;
+            data[i * 4 + 1] = vectors[i]->y;
+            data[i * 4 + 2] = vectors[i]->z;
+            data[i * 4 + 3] = scalars[i];
+        }
+        data[16] = (float)light.shadowTile;
+        data[17] = data[18] = data[19] = 0.0f;
+    }
+
+    // ndc x/y range of the sphere, false if it's entirely off screen. Spheres reaching behind the near plane
+    // get the whole screen
+    bool screenBounds(const glm::vec3& center, float depth, float r, int& x0, int& x1, int& y0, int& y1) const {
+        x0 = 0; x1 = TILES_X - 1;
+        y0 = 0; y1 = TILES_Y - 1;
+        float nearest = depth - r, farthest = depth + r;
+        if (nearest <= nearPlane)
+            return true;
+        // extremes of the sphere's view-space box, each divided by the depth that pushes it furthest out
+        float left = (center.x - r) / (tanHalfX * (center.x - r < 0.0f ? nearest : farthest));
+        float right = (center.x + r) / (tanHalfX * (center.x + r > 0.0f ? nearest : farthest));
+        float bottom = (center.y - r) / (tanHalfY * (center.y - r < 0.0f ? nearest : farthest));
+        float top = (center.y + r) / (tanHalfY * (center.y + r > 0.0f ? nearest : farthest));
+        if (right < -1.0f || left > 1.0f || top < -1.0f || bottom > 1.0f)
+            return false;
+        x0 = std::max(0, (int)std::floor((left + 1.0f) * 0.5f * TILES_X));
+        x1 = std::min(TILES_X - 1, (int)std::floor((right + 1.0f) * 0.5f * TILES_X));
+        y0 = std::max(0, (int)std::floor((bottom + 1.0f) * 0.5f * TILES_Y));
+        y1 = std::min(TILES_Y - 1, (int)std::floor((top + 1.0f) * 0.5f * TILES_Y));
+        return true;
+    }
+
+    void append(int cluster, uint16_t light) {
+        int count = clusterCounts[cluster]++;
+        if (count < MAX_LIGHTS_PER_CLUSTER)
+            clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER + count] = light;
+    }
+
+    // adds the light to every cluster its sphere overlaps, returns false if it overlaps none
+    bool bin(uint16_t light, const glm::vec3& center, float r) {
+        float depth = -center.z;
+        if (depth + r < nearPlane || depth - r > farPlane)
+            return false;
+        int x0, x1, y0, y1;
+        if (!screenBounds(center, depth, r, x0, x1, y0, y1))
+            return false;
+        int z0 = sliceOf(std::max(depth - r, nearPlane)), z1 = sliceOf(std::min(depth + r, farPlane));
+        float r2 = r * r;
+        bool any = false;
+#ifdef CLUSTERED_LIGHTS_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(depth);
+        const __m128 radius2 = _mm_set1_ps(r2);
+#endif
+        for (int z = z0; z <= z1; z++) {
+            for (int y = y0; y <= y1; y++) {
+#ifdef CLUSTERED_LIGHTS_SSE
+                // TILES_X is a multiple of 4, start on a group of four and test the whole group at once
+                for (int x = x0 & ~3; x <= x1; x += 4) {
+                    int i = clusterIndex(x, y, z);
+                    // squared distance from the sphere center to each box, 0 on an axis where the center is inside
+                    __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[i]), cx), zero),
+                                           _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&maxX[i])), zero));
+                    __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[i]), cy), zero),
+                                           _mm_max_ps(_mm_sub_ps(cy, _mm_loadu_ps(&maxY[i])), zero));
+                    __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[i]), cz), zero),
+                                           _mm_max_ps(_mm_sub_ps(cz, _mm_loadu_ps(&maxZ[i])), zero));
+                    __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2));
+                    for (int lane = 0; lane < 4; lane++) {
+                        // lanes left of x0 or right of x1 are outside the sphere's screen bounds
+                        if ((mask & (1 << lane)) && x + lane >= x0 && x + lane <= x1) {
+                            append(i + lane, light);
+                            any = true;
+                        }
+                    }
+                }
+#else
+                for (int x = x0; x <= x1; x++) {
+                    int i = clusterIndex(x, y, z);
+                    float dx = std::max(minX[i] - center.x, 0.0f) + std::max(center.x - maxX[i], 0.0f);
+                    float dy = std::max(minY[i] - center.y, 0.0f) + std::max(center.y - maxY[i], 0.0f);
+                    float dz = std::max(minZ[i] - depth, 0.0f) + std::max(depth - maxZ[i], 0.0f);
+                    if (dx * dx + dy * dy + dz * dz <= r2) {
+                        append(i, light);
+                        any = true;
+                    }
+                }
+#endif
+            }
+        }
+        return any;
+    }
+
+    void attachRing() {
+        GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+        for (int i = 0; i < 3; i++) {
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], ring.buffer());
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        attachedBuffer = ring.buffer();
+    }
+};
+
+#endif //PROJECT_BASE_CLUSTEREDLIGHTS_H
@@ -0,0 +1,129 @@
+#ifndef PROJECT_BASE_DRAWBATCHER_H
+#define PROJECT_BASE_DRAWBATCHER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <rg/DynamicRing.h>
+#include <rg/ShaderPermutations.h>
+
+#include <algorithm>
+#include <vector>
+
+// Collects the scene's model instances every frame and draws them with as few calls and state changes as
+// GL 3.3 allows. All instances of a model go into one instance buffer, so each of its meshes is a single
+// instanced draw with the transforms as per-instance attributes, whatever the number of copies. Where the depth
+// buffer already holds the final depth the draws of all models are sorted by program and by the texture objects they
+// bind: with the textures in TextureStreamer's arrays, meshes of different models follow each other with only their
+// array layers changing. Where it doesn't, the models stay front to back and only each model's meshes are sorted
+// that way. Merging different meshes into one call as well would take gl_DrawID or a base instance, neither of which
+// 3.3 has.
+// The instances are written straight into a DynamicRing, so a frame's transforms cost one copy and no driver sync.
+enum DrawOrder {
+    // fewest program and texture changes, for passes whose depth test only passes the visible fragment anyway
+    DRAW_BY_STATE,
+    // models in the order their nearest instance was added, so the depth test can reject what's behind
+    DRAW_FRONT_TO_BACK,
+};
+
+class DrawBatcher {
+public:
+    // draw calls the last draw() made
+    int drawCalls = 0;
+
+    DrawBatcher() : instanceRing(GL_ARRAY_BUFFER, 64 * 1024) {}
+
+    // starts a new frame's instances
+    void clear() {
+        groups.clear();
+    }
+
+    // instances of a model keep the order they were added in, and models the order of their first instance: front
+    // to back if the caller sorts them that way
+    void add(Model* model, const glm::mat4& transform, const glm::mat4& previousTransform) {
+        auto group = std::find_if(groups.begin(), groups.end(), [model](const Group& g) { return g.model == model; });
+        if (group == groups.end()) {
+            groups.push_back(Group{model, {}, 0});
+            group = groups.end() - 1;
+        }
+        group->instances.push_back(InstanceData{transform, previousTransform});
+    }
+
+    // uploads the instances added since clear(), once per frame before the first draw
+    void upload() {
+        size_t count = 0;
+        for (const Group& group : groups)
+            count += group.instances.size();
+        instanceRing.beginFrame(count * sizeof(InstanceData) + DynamicRing::ALIGNMENT);
+        RingAllocation<InstanceData> instances = instanceRing.allocate<InstanceData>(count);
+        for (Group& group : groups) {
+            group.offset = instances.offset;
+            instances.data = std::copy(group.instances.begin(), group.instances.end(), instances.data);
+            instances.offset += group.instances.size() * sizeof(InstanceData);
+        }
+        instanceRing.flush();
+    }
+
+    // draws the selected meshes of every instance with the variant matching their material; globalFeatures are
+    // added to each mesh's own features
+    void draw(ShaderPermutations& shaders, unsigned int globalFeatures, MeshSelection selection, DrawOrder order) {
+        struct Item {
+            Shader* shader;
+            Mesh* mesh;
+            const Group* group;
+        };
+        std::vector<Item> items;
+        for (const Group& group : groups)
+            for (Mesh& mesh : group.model->meshes)
+                if (mesh.selectedBy(selection))
+                    items.push_back(Item{&shaders.get(globalFeatures | mesh.features), &mesh, &group});
+        // by program, then by texture objects, so equal ones end up next to each other; front to back keeps the
+        // models' order first, groups is a vector so their addresses follow it
+        std::stable_sort(items.begin(), items.end(), [order](const Item& a, const Item& b) {
+            if (order == DRAW_FRONT_TO_BACK && a.group != b.group)
+                return a.group < b.group;
+            if (a.shader->ID != b.shader->ID)
+                return a.shader->ID < b.shader->ID;
+            return a.mesh->material.texturesBefore(b.mesh->material);
+        });
+        drawCalls = 0;
+        const Item* previous = nullptr;
+        for (const Item& item : items) {
+            bool newProgram = !previous || previous->shader != item.shader;
+            if (newProgram)
+                item.shader->use();
+            bool bindTextures = !previous || !item.mesh->material.sharesTextures(previous->mesh->material);
+            item.mesh->DrawInstanced(instanceRing.buffer(), item.group->offset, (int)item.group->instances.size(),
+                                     bindTextures);
+            drawCalls++;
+            previous = &item;
+        }
+    }
+
+    // whether the instances go through a persistently mapped ring or the glBufferSubData fallback
+    bool persistentMapping() const {
+        return instanceRing.persistent();
+    }
+
+    // depth-only draw of the opaque meshes; the caller has the INSTANCED variant of the depth program bound
+    void drawDepth() {
+        for (const Group& group : groups)
+            for (Mesh& mesh : group.model->meshes)
+                if (mesh.bucket() == OPAQUE_MESHES)
+                    mesh.DrawDepthInstanced(instanceRing.buffer(), group.offset, (int)group.instances.size());
+    }
+
+private:
+    struct Group {
+        Model* model;
+        std::vector<InstanceData> instances;
+        // bytes into the instance ring
+        size_t offset = 0;
+    };
+
+    std::vector<Group> groups;
+    DynamicRing instanceRing;
+};
+
+#endif //PROJECT_BASE_DRAWBATCHER_H
@@ -0,0 +1,163 @@
+#ifndef PROJECT_BASE_DYNAMICRING_H
+#define PROJECT_BASE_DYNAMICRING_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <rg/GLObject.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// GL_ARB_buffer_storage isn't in the 3.3 loader, it's looked up at runtime
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_RG)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// where allocate() put the data: write count elements through data, point the GL at offset in the ring's buffer
+template <typename T>
+struct RingAllocation {
+    T* data;
+    size_t offset;
+};
+
+// Per-frame dynamic data, written once straight where the GPU reads it. With GL_ARB_buffer_storage the buffer holds
+// FRAMES regions and stays persistently and coherently mapped: each frame writes its own region, and a fence on
+// the region from FRAMES frames ago (long passed, normally) is all the synchronization there is, no driver copy
+// and no implicit wait. Without the extension the buffer is one region that beginFrame() orphans, the data is
+// written to client memory and flush() hands it over with glBufferSubData.
+// Allocations are aligned to ALIGNMENT bytes, so their offsets divide into texels of any texture buffer format.
+// beginFrame() grows the ring when a frame asks for more than a region holds; that makes a new buffer, which
+// consumers that attach buffer() somewhere have to re-attach.
+class DynamicRing {
+public:
+    static const int FRAMES = 3;
+    static const size_t ALIGNMENT = 256;
+
+    DynamicRing(GLenum target, size_t frameBytes) : target(target) {
+        if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+            bufferStorage = (PFNGLBUFFERSTORAGEPROC_RG)glfwGetProcAddress("glBufferStorage");
+        create(alignUp(std::max(frameBytes, ALIGNMENT)));
+    }
+
+    ~DynamicRing() {
+        dropFences();
+    }
+
+    DynamicRing(const DynamicRing&) = delete;
+    DynamicRing& operator=(const DynamicRing&) = delete;
+
+    // starts a frame that needs about bytes, counting ALIGNMENT per allocation; waits for the GPU only if it is
+    // FRAMES frames behind
+    void beginFrame(size_t bytes) {
+        if (persistent()) {
+            if (begun)
+                fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region = (region + 1) % FRAMES;
+        }
+        begun = true;
+        if (bytes > regionBytes)
+            create(alignUp(std::max(bytes, regionBytes * 2)));
+        if (fences[region]) {
+            while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+        if (!persistent()) {
+            glBindBuffer(target, ringBuffer);
+            // a new store, the draws still reading last frame's keep the old one
+            glBufferData(target, regionBytes, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(target, 0);
+        }
+        used = flushed = 0;
+    }
+
+    // count elements of this frame's data; data is null if the frame's region is full
+    template <typename T>
+    RingAllocation<T> allocate(size_t count) {
+        size_t start = alignUp(used);
+        size_t bytes = count * sizeof(T);
+        if (start + bytes > regionBytes)
+            return RingAllocation<T>{nullptr, 0};
+        used = start + bytes;
+        if (persistent())
+            return RingAllocation<T>{(T*)(mapped + region * regionBytes + start), region * regionBytes + start};
+        return RingAllocation<T>{(T*)(staging.data() + start), start};
+    }
+
+    // makes what was allocated since the last flush visible to the GL; before the draws that read it
+    void flush() {
+        if (persistent() || used == flushed)
+            return;
+        glBindBuffer(target, ringBuffer);
+        glBufferSubData(target, flushed, used - flushed, staging.data() + flushed);
+        glBindBuffer(target, 0);
+        flushed = used;
+    }
+
+    GLuint buffer() const {
+        return ringBuffer;
+    }
+
+    bool persistent() const {
+        return mapped != nullptr;
+    }
+
+    // per frame
+    size_t capacity() const {
+        return regionBytes;
+    }
+
+private:
+    GLenum target;
+    PFNGLBUFFERSTORAGEPROC_RG bufferStorage = nullptr;
+    GLBuffer ringBuffer;
+    unsigned char* mapped = nullptr;
+    // the fallback's client-side copy of the frame
+    std::vector<unsigned char> staging;
+    size_t regionBytes = 0;
+    int region = 0;
+    bool begun = false;
+    size_t used = 0, flushed = 0;
+    GLsync fences[FRAMES] = {};
+
+    static size_t alignUp(size_t bytes) {
+        return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    // a new buffer; the old one goes with whatever the GPU still reads from it, the GL keeps it alive until then
+    void create(size_t bytes) {
+        dropFences();
+        regionBytes = bytes;
+        ringBuffer = GLBuffer::create();
+        glBindBuffer(target, ringBuffer);
+        mapped = nullptr;
+        if (bufferStorage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage(target, regionBytes * FRAMES, nullptr, flags);
+            mapped = (unsigned char*)glMapBufferRange(target, 0, regionBytes * FRAMES, flags);
+        }
+        if (!mapped) {
+            // the storage is immutable if bufferStorage got that far, start over with a mutable one
+            ringBuffer = GLBuffer::create();
+            glBindBuffer(target, ringBuffer);
+            glBufferData(target, regionBytes, nullptr, GL_STREAM_DRAW);
+            staging.resize(regionBytes);
+            region = 0;
+        }
+        glBindBuffer(target, 0);
+    }
+
+    void dropFences() {
+        for (GLsync& fence : fences)
+            if (fence) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+    }
+};
+
+#endif //PROJECT_BASE_DYNAMICRING_H
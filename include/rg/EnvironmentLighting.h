@@ -0,0 +1,440 @@
+#ifndef PROJECT_BASE_ENVIRONMENTLIGHTING_H
+#define PROJECT_BASE_ENVIRONMENTLIGHTING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Image-based lighting from the skybox cubemap, replacing the flat ambient term of the sun. The diffuse part is the
+// cubemap projected to L2 spherical harmonics and convolved with the cosine lobe, nine coefficients the shader
+// evaluates per fragment. The specular part is a GGX-prefiltered copy of the cubemap, rougher at every mip, looked
+// up in the reflected direction and scaled by a split-sum BRDF lookup table.
+// All of it is computed on the CPU at load time, spread over every core, and cached in a file next to the skybox
+// keyed by a hash of the cubemap texels, so later runs only read it back.
+class EnvironmentLighting {
+public:
+    static const int ENVIRONMENT_UNIT = 14;
+    static const int BRDF_UNIT = 15;
+    // size of the sharpest prefiltered level, each of the LEVELS after it halves it and adds roughness
+    static const int SIZE = 128;
+    static const int LEVELS = 5;
+    static const int LUT_SIZE = 64;
+    static const int PREFILTER_SAMPLES = 64;
+    static const int LUT_SAMPLES = 256;
+
+    // scales both the diffuse and the specular environment light
+    float intensity = 1.0f;
+
+    EnvironmentLighting() {
+        glGenTextures(1, &environmentMap);
+        glGenTextures(1, &brdfLut);
+    }
+
+    ~EnvironmentLighting() {
+        glDeleteTextures(1, &environmentMap);
+        glDeleteTextures(1, &brdfLut);
+    }
+
+    EnvironmentLighting(const EnvironmentLighting&) = delete;
+    EnvironmentLighting& operator=(const EnvironmentLighting&) = delete;
+
+    // reads the cubemap back and precomputes from it, or loads the results from cachePath when they were made from
+    // the same texels
+    void build(GLuint cubemap, const std::string& cachePath) {
+        int sourceSize = 0;
+        std::vector<unsigned char> source = readCubemap(cubemap, sourceSize);
+        if (source.empty()) {
+            std::cout << "EnvironmentLighting: couldn't read the cubemap" << std::endl;
+            return;
+        }
+        uint64_t hash = hashOf(source);
+        if (!loadCache(cachePath, hash)) {
+            compute(source, sourceSize);
+            saveCache(cachePath, hash);
+        }
+        upload();
+        built = true;
+    }
+
+    bool ready() const { return built; }
+
+    void bind() const {
+        glActiveTexture(GL_TEXTURE0 + ENVIRONMENT_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+        glActiveTexture(GL_TEXTURE0 + BRDF_UNIT);
+        glBindTexture(GL_TEXTURE_2D, brdfLut);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // uniforms of the IBL variant of lighting.glsl
+    void setUniforms(Shader& shader) const {
+        shader.setInt("environmentMap", ENVIRONMENT_UNIT);
+        shader.setInt("environmentBrdf", BRDF_UNIT);
+        shader.setFloat("environmentMaxLod", (float)(LEVELS - 1));
+        shader.setFloat("environmentIntensity", intensity);
+        for (int i = 0; i < 9; i++)
+            shader.setVec3("environmentSH[" + std::to_string(i) + "]", sh[i]);
+    }
+
+private:
+    // RGB float faces of one cube level, face after face in the GL order +x, -x, +y, -y, +z, -z
+    struct CubeLevel {
+        int size = 0;
+        std::vector<float> texels;
+
+        glm::vec3 texel(int face, int x, int y) const {
+            const float* t = &texels[(((size_t)face * size + y) * size + x) * 3];
+            return glm::vec3(t[0], t[1], t[2]);
+        }
+
+        // bilinear within the face the direction points into
+        glm::vec3 sample(const glm::vec3& dir) const {
+            int face;
+            glm::vec2 st = faceCoordinates(dir, face);
+            glm::vec2 p = st * (float)size - 0.5f;
+            int x0 = (int)std::floor(p.x), y0 = (int)std::floor(p.y);
+            glm::vec2 f = p - glm::vec2(x0, y0);
+            auto at = [&](int x, int y) {
+                return texel(face, std::min(std::max(x, 0), size - 1), std::min(std::max(y, 0), size - 1));
+            };
+            return glm::mix(glm::mix(at(x0, y0), at(x0 + 1, y0), f.x), glm::mix(at(x0, y0 + 1), at(x0 + 1, y0 + 1), f.x),
+                            f.y);
+        }
+    };
+
+    GLuint environmentMap;
+    GLuint brdfLut;
+    bool built = false;
+    // premultiplied by the cosine lobe convolution and the basis constants, the shader only multiplies by the
+    // direction terms
+    glm::vec3 sh[9];
+    std::vector<CubeLevel> prefiltered;
+    std::vector<float> lut;
+
+    static const uint32_t CACHE_MAGIC = 0x314c4249; // "IBL1"
+
+    // direction through the center of a texel, the GL cube map face layout
+    static glm::vec3 direction(int face, float s, float t) {
+        float sc = s * 2.0f - 1.0f, tc = t * 2.0f - 1.0f;
+        switch (face) {
+            case 0: return glm::normalize(glm::vec3(1.0f, -tc, -sc));
+            case 1: return glm::normalize(glm::vec3(-1.0f, -tc, sc));
+            case 2: return glm::normalize(glm::vec3(sc, 1.0f, tc));
+            case 3: return glm::normalize(glm::vec3(sc, -1.0f, -tc));
+            case 4: return glm::normalize(glm::vec3(sc, -tc, 1.0f));
+            default: return glm::normalize(glm::vec3(-sc, -tc, -1.0f));
+        }
+    }
+
+    // the inverse of direction(): face and texture coordinates in [0, 1]
+    static glm::vec2 faceCoordinates(const glm::vec3& dir, int& face) {
+        glm::vec3 a = glm::abs(dir);
+        float sc, tc, ma;
+        if (a.x >= a.y && a.x >= a.z) {
+            face = dir.x > 0.0f ? 0 : 1;
+            sc = dir.x > 0.0f ? -dir.z : dir.z;
+            tc = -dir.y;
+            ma = a.x;
+        } else if (a.y >= a.z) {
+            face = dir.y > 0.0f ? 2 : 3;
+            sc = dir.x;
+            tc = dir.y > 0.0f ? dir.z : -dir.z;
+            ma = a.y;
+        } else {
+            face = dir.z > 0.0f ? 4 : 5;
+            sc = dir.z > 0.0f ? dir.x : -dir.x;
+            tc = -dir.y;
+            ma = a.z;
+        }
+        return glm::vec2(sc / ma + 1.0f, tc / ma + 1.0f) * 0.5f;
+    }
+
+    // runs body(0 .. count - 1) on every core
+    template <typename Body>
+    static void parallelFor(int count, const Body& body) {
+        unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::atomic<int> next(0);
+        std::vector<std::thread> threads;
+        for (unsigned int i = 0; i < threadCount; i++)
+            threads.emplace_back([&]() {
+                for (int item = next++; item < count; item = next++)
+                    body(item);
+            });
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    static glm::vec2 hammersley(unsigned int i, unsigned int count) {
+        unsigned int bits = i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return glm::vec2((float)i / count, bits * 2.3283064365386963e-10f);
+    }
+
+    // GGX half vector around n for a uniform sample xi
+    static glm::vec3 importanceSampleGGX(glm::vec2 xi, const glm::vec3& n, float alpha) {
+        float phi = 2.0f * glm::pi<float>() * xi.x;
+        float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+        glm::vec3 bitangent = glm::cross(n, tangent);
+        return glm::normalize(tangent * (std::cos(phi) * sinTheta) + bitangent * (std::sin(phi) * sinTheta) +
+                              n * cosTheta);
+    }
+
+    static std::vector<unsigned char> readCubemap(GLuint cubemap, int& size) {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+        std::vector<unsigned char> texels;
+        if (size <= 0) {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            return texels;
+        }
+        texels.resize((size_t)6 * size * size * 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int face = 0; face < 6; face++)
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                          &texels[(size_t)face * size * size * 3]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return texels;
+    }
+
+    // FNV-1a over the texels and the parameters that shape the results
+    static uint64_t hashOf(const std::vector<unsigned char>& texels) {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](unsigned char byte) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        };
+        for (unsigned char byte : texels)
+            add(byte);
+        for (int parameter : {SIZE, LEVELS, LUT_SIZE, PREFILTER_SAMPLES, LUT_SAMPLES})
+            for (int i = 0; i < 4; i++)
+                add((unsigned char)(parameter >> (i * 8)));
+        return hash;
+    }
+
+    void compute(const std::vector<unsigned char>& source, int sourceSize) {
+        // the source as a float mip chain down to 1x1, box filtered
+        std::vector<CubeLevel> chain(1);
+        chain[0].size = sourceSize;
+        chain[0].texels.assign(source.begin(), source.end());
+        for (float& value : chain[0].texels)
+            value /= 255.0f;
+        while (chain.back().size > 1) {
+            const CubeLevel& above = chain.back();
+            CubeLevel level;
+            level.size = above.size / 2;
+            level.texels.resize((size_t)6 * level.size * level.size * 3);
+            for (int face = 0; face < 6; face++)
+                for (int y = 0; y < level.size; y++)
+                    for (int x = 0; x < level.size; x++) {
+                        glm::vec3 sum = above.texel(face, 2 * x, 2 * y) + above.texel(face, 2 * x + 1, 2 * y) +
+                                        above.texel(face, 2 * x, 2 * y + 1) + above.texel(face, 2 * x + 1, 2 * y + 1);
+                        float* out = &level.texels[(((size_t)face * level.size + y) * level.size + x) * 3];
+                        out[0] = sum.r * 0.25f;
+                        out[1] = sum.g * 0.25f;
+                        out[2] = sum.b * 0.25f;
+                    }
+            chain.push_back(level);
+        }
+        auto sampleLod = [&](const glm::vec3& dir, float lod) {
+            lod = std::min(std::max(lod, 0.0f), (float)(chain.size() - 1));
+            int lower = (int)lod;
+            int upper = std::min(lower + 1, (int)chain.size() - 1);
+            return glm::mix(chain[lower].sample(dir), chain[upper].sample(dir), lod - lower);
+        };
+
+        // specular: every output level is a row-parallel pass over its faces
+        prefiltered.assign(LEVELS, CubeLevel());
+        float sourceTexelSolidAngle = 4.0f * glm::pi<float>() / (6.0f * sourceSize * sourceSize);
+        for (int levelIndex = 0; levelIndex < LEVELS; levelIndex++) {
+            CubeLevel& level = prefiltered[levelIndex];
+            level.size = std::max(1, SIZE >> levelIndex);
+            level.texels.resize((size_t)6 * level.size * level.size * 3);
+            float roughness = (float)levelIndex / (LEVELS - 1);
+            float alpha = roughness * roughness;
+            float baseLod = std::log2((float)sourceSize / level.size);
+            parallelFor(6 * level.size, [&](int row) {
+                int face = row / level.size, y = row % level.size;
+                for (int x = 0; x < level.size; x++) {
+                    glm::vec3 n = direction(face, (x + 0.5f) / level.size, (y + 0.5f) / level.size);
+                    glm::vec3 color(0.0f);
+                    if (levelIndex == 0) {
+                        color = sampleLod(n, baseLod);
+                    } else {
+                        float weight = 0.0f;
+                        for (int i = 0; i < PREFILTER_SAMPLES; i++) {
+                            glm::vec3 h = importanceSampleGGX(hammersley(i, PREFILTER_SAMPLES), n, alpha);
+                            float nDotH = std::max(glm::dot(n, h), 0.0f);
+                            glm::vec3 l = 2.0f * nDotH * h - n;
+                            float nDotL = glm::dot(n, l);
+                            if (nDotL <= 0.0f)
+                                continue;
+                            // fetch from the source mip whose texels cover about the solid angle of the sample
+                            float d = nDotH * nDotH * (alpha * alpha - 1.0f) + 1.0f;
+                            float D = alpha * alpha / (glm::pi<float>() * d * d);
+                            float pdf = D * 0.25f + 1e-4f;
+                            float sampleSolidAngle = 1.0f / (PREFILTER_SAMPLES * pdf);
+                            float lod = 0.5f * std::log2(sampleSolidAngle / sourceTexelSolidAngle) + 1.0f;
+                            color += sampleLod(l, lod) * nDotL;
+                            weight += nDotL;
+                        }
+                        color /= std::max(weight, 1e-4f);
+                    }
+                    float* out = &level.texels[(((size_t)face * level.size + y) * level.size + x) * 3];
+                    out[0] = color.r;
+                    out[1] = color.g;
+                    out[2] = color.b;
+                }
+            });
+        }
+
+        // diffuse: L2 projection of the sharpest level, one partial sum per face
+        const CubeLevel& base = prefiltered[0];
+        std::vector<glm::vec3> faceSums((size_t)6 * 9, glm::vec3(0.0f));
+        parallelFor(6, [&](int face) {
+            for (int y = 0; y < base.size; y++)
+                for (int x = 0; x < base.size; x++) {
+                    float u = (x + 0.5f) / base.size * 2.0f - 1.0f, v = (y + 0.5f) / base.size * 2.0f - 1.0f;
+                    // solid angle of the texel on the unit cube
+                    float solidAngle = 4.0f / (base.size * base.size * std::pow(1.0f + u * u + v * v, 1.5f));
+                    glm::vec3 dir = direction(face, (x + 0.5f) / base.size, (y + 0.5f) / base.size);
+                    glm::vec3 radiance = base.texel(face, x, y) * solidAngle;
+                    const float basis[9] = {1.0f, dir.y, dir.z, dir.x, dir.x * dir.y, dir.y * dir.z,
+                                            3.0f * dir.z * dir.z - 1.0f, dir.x * dir.z, dir.x * dir.x - dir.y * dir.y};
+                    for (int i = 0; i < 9; i++)
+                        faceSums[face * 9 + i] += radiance * basis[i];
+                }
+        });
+        // the basis constants squared (one from the projection, one from the evaluation) times the cosine
+        // lobe's A_l / pi, so the shader's sum is irradiance / pi
+        const float constants[9] = {0.282095f * 0.282095f, 0.488603f * 0.488603f * 2.0f / 3.0f,
+                                    0.488603f * 0.488603f * 2.0f / 3.0f, 0.488603f * 0.488603f * 2.0f / 3.0f,
+                                    1.092548f * 1.092548f * 0.25f, 1.092548f * 1.092548f * 0.25f,
+                                    0.315392f * 0.315392f * 0.25f, 1.092548f * 1.092548f * 0.25f,
+                                    0.546274f * 0.546274f * 0.25f};
+        for (int i = 0; i < 9; i++) {
+            sh[i] = glm::vec3(0.0f);
+            for (int face = 0; face < 6; face++)
+                sh[i] += faceSums[face * 9 + i];
+            sh[i] *= constants[i];
+        }
+
+        // split-sum BRDF: scale (r) and bias (g) on F0 by n.v (x) and roughness (y)
+        lut.assign((size_t)LUT_SIZE * LUT_SIZE * 2, 0.0f);
+        parallelFor(LUT_SIZE, [&](int y) {
+            float roughness = (y + 0.5f) / LUT_SIZE;
+            float alpha = roughness * roughness;
+            float k = alpha * 0.5f;
+            for (int x = 0; x < LUT_SIZE; x++) {
+                float nDotV = (x + 0.5f) / LUT_SIZE;
+                glm::vec3 v(std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV);
+                glm::vec3 n(0.0f, 0.0f, 1.0f);
+                float scale = 0.0f, bias = 0.0f;
+                for (int i = 0; i < LUT_SAMPLES; i++) {
+                    glm::vec3 h = importanceSampleGGX(hammersley(i, LUT_SAMPLES), n, alpha);
+                    float vDotH = std::max(glm::dot(v, h), 0.0f);
+                    glm::vec3 l = 2.0f * vDotH * h - v;
+                    float nDotL = std::max(l.z, 0.0f);
+                    float nDotH = std::max(h.z, 0.0f);
+                    if (nDotL <= 0.0f)
+                        continue;
+                    float g = nDotV / (nDotV * (1.0f - k) + k) * nDotL / (nDotL * (1.0f - k) + k);
+                    float visibility = g * vDotH / (nDotH * nDotV + 1e-6f);
+                    float fresnel = std::pow(1.0f - vDotH, 5.0f);
+                    scale += (1.0f - fresnel) * visibility;
+                    bias += fresnel * visibility;
+                }
+                lut[((size_t)y * LUT_SIZE + x) * 2] = scale / LUT_SAMPLES;
+                lut[((size_t)y * LUT_SIZE + x) * 2 + 1] = bias / LUT_SAMPLES;
+            }
+        });
+    }
+
+    bool loadCache(const std::string& path, uint64_t hash) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        uint32_t magic = 0;
+        uint64_t cachedHash = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&cachedHash, sizeof(cachedHash));
+        if (!file || magic != CACHE_MAGIC || cachedHash != hash)
+            return false;
+        file.read((char*)sh, sizeof(sh));
+        prefiltered.assign(LEVELS, CubeLevel());
+        for (int levelIndex = 0; levelIndex < LEVELS; levelIndex++) {
+            CubeLevel& level = prefiltered[levelIndex];
+            level.size = std::max(1, SIZE >> levelIndex);
+            level.texels.resize((size_t)6 * level.size * level.size * 3);
+            file.read((char*)level.texels.data(), level.texels.size() * sizeof(float));
+        }
+        lut.resize((size_t)LUT_SIZE * LUT_SIZE * 2);
+        file.read((char*)lut.data(), lut.size() * sizeof(float));
+        return (bool)file;
+    }
+
+    void saveCache(const std::string& path, uint64_t hash) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cout << "EnvironmentLighting: couldn't write the cache " << path << std::endl;
+            return;
+        }
+        uint32_t magic = CACHE_MAGIC;
+        file.write((const char*)&magic, sizeof(magic));
+        file.write((const char*)&hash, sizeof(hash));
+        file.write((const char*)sh, sizeof(sh));
+        for (const CubeLevel& level : prefiltered)
+            file.write((const char*)level.texels.data(), level.texels.size() * sizeof(float));
+        file.write((const char*)lut.data(), lut.size() * sizeof(float));
+    }
+
+    void upload() {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+        for (int levelIndex = 0; levelIndex < LEVELS; levelIndex++) {
+            const CubeLevel& level = prefiltered[levelIndex];
+            for (int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, levelIndex, GL_RGB16F, level.size, level.size, 0,
+                             GL_RGB, GL_FLOAT, &level.texels[(size_t)face * level.size * level.size * 3]);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, LEVELS - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        // the rough levels are a few texels wide, filtering across face edges hides the seams
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+        glBindTexture(GL_TEXTURE_2D, brdfLut);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, LUT_SIZE, LUT_SIZE, 0, GL_RG, GL_FLOAT, lut.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        // the CPU copies were only needed for the upload and the cache
+        prefiltered.clear();
+        lut.clear();
+    }
+};
+
+#endif //PROJECT_BASE_ENVIRONMENTLIGHTING_H
@@ -0,0 +1,434 @@
+#ifndef PROJECT_BASE_FRAMEGRAPH_H
+#define PROJECT_BASE_FRAMEGRAPH_H
+
+#include <glad/glad.h>
+#include "imgui.h"
+
+#include <rg/GpuTimer.h>
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+// a 2D texture the frame graph allocates; depth formats become depth attachments
+struct TextureDesc {
+    int width = 0;
+    int height = 0;
+    GLenum internalFormat = GL_RGBA8;
+    // min and mag filter
+    GLenum filter = GL_LINEAR;
+
+    bool operator==(const TextureDesc& other) const {
+        return width == other.width && height == other.height && internalFormat == other.internalFormat &&
+               filter == other.filter;
+    }
+};
+
+// The frame as a graph of passes, rebuilt every frame. Passes declare what they create, read and write in a setup
+// callback, then compile() culls the passes nothing visible depends on, orders the rest by their dependencies
+// (declaration order among independent ones) and works out how long each transient texture lives. execute() runs
+// the passes, each in its own GpuTimer section, handing out textures from a pool: a texture whose last reader has
+// run goes back to the pool and the next pass that creates one with the same description gets it, within the frame
+// and across frames. GL has no memory aliasing between formats, so reuse needs the exact same size and format.
+// Pooled textures unused for POOL_FRAMES frames are freed, which is what a resize or a resolution change leaves.
+// Writes to a resource are ordered after its earlier writes and reads. Passes that write the backbuffer or declare
+// a side effect are the roots the culling keeps. Textures owned elsewhere (histories, shadow maps) are imported;
+// an import with texture 0 stands for any other state a pass produces, like uploaded light lists, for ordering.
+class FrameGraph {
+public:
+    typedef int Resource;
+    // the default framebuffer, sized by beginFrame()
+    static const Resource BACKBUFFER = 0;
+    static const int POOL_FRAMES = 3;
+
+    class Builder {
+    public:
+        Resource create(const std::string& name, const TextureDesc& desc) {
+            Resource resource = graph.addResource(name, desc, 0, false);
+            graph.passes[pass].creates.push_back(resource);
+            return write(resource);
+        }
+
+        Resource read(Resource resource) {
+            graph.passes[pass].reads.push_back(resource);
+            return resource;
+        }
+
+        Resource write(Resource resource) {
+            graph.passes[pass].writes.push_back(resource);
+            return resource;
+        }
+
+        // keeps the pass even when nothing reads what it writes, e.g. a readback
+        void sideEffect() {
+            graph.passes[pass].sideEffect = true;
+        }
+
+    private:
+        friend class FrameGraph;
+        Builder(FrameGraph& graph, int pass) : graph(graph), pass(pass) {}
+        FrameGraph& graph;
+        int pass;
+    };
+
+    // what a pass's execute callback gets its GL objects from
+    class Resources {
+    public:
+        GLuint texture(Resource resource) const {
+            return graph.resources[resource].texture;
+        }
+
+        const TextureDesc& desc(Resource resource) const {
+            return graph.resources[resource].desc;
+        }
+
+        // a framebuffer with the given attachments, BACKBUFFER on its own is the default one
+        GLuint framebuffer(std::initializer_list<Resource> attachments) const {
+            return graph.framebuffer(attachments);
+        }
+
+        // binds framebuffer(attachments) and sets the viewport to the size of the first one
+        void bindFramebuffer(std::initializer_list<Resource> attachments) const {
+            const TextureDesc& size = graph.resources[*attachments.begin()].desc;
+            glBindFramebuffer(GL_FRAMEBUFFER, graph.framebuffer(attachments));
+            glViewport(0, 0, size.width, size.height);
+        }
+
+    private:
+        friend class FrameGraph;
+        explicit Resources(FrameGraph& graph) : graph(graph) {}
+        FrameGraph& graph;
+    };
+
+    FrameGraph() = default;
+
+    ~FrameGraph() {
+        releaseFramebuffers();
+        for (PooledTexture& pooled : pool)
+            glDeleteTextures(1, &pooled.texture);
+    }
+
+    FrameGraph(const FrameGraph&) = delete;
+    FrameGraph& operator=(const FrameGraph&) = delete;
+
+    // forgets last frame's passes and resources, the pool stays
+    void beginFrame(int backbufferWidth, int backbufferHeight) {
+        passes.clear();
+        resources.clear();
+        order.clear();
+        frame++;
+        TextureDesc backbuffer;
+        backbuffer.width = backbufferWidth;
+        backbuffer.height = backbufferHeight;
+        addResource("Backbuffer", backbuffer, 0, true);
+    }
+
+    Resource import(const std::string& name, GLuint texture, const TextureDesc& desc = TextureDesc()) {
+        return addResource(name, desc, texture, true);
+    }
+
+    void addPass(const std::string& name, const std::function<void(Builder&)>& setup,
+                 const std::function<void(const Resources&)>& execute) {
+        Pass pass;
+        pass.name = name;
+        pass.execute = execute;
+        passes.push_back(pass);
+        Builder builder(*this, (int)passes.size() - 1);
+        setup(builder);
+    }
+
+    // culls, orders and works out the transient lifetimes
+    void compile() {
+        int count = (int)passes.size();
+        // producers: the earlier passes whose results a pass consumes. A write also consumes the earlier writes,
+        // since the passes draw on top of each other
+        std::vector<std::vector<int>> producers(count), after(count);
+        std::vector<int> lastWriter(resources.size(), -1);
+        std::vector<std::vector<int>> readersSinceWrite(resources.size());
+        for (int p = 0; p < count; p++) {
+            Pass& pass = passes[p];
+            for (Resource resource : pass.reads) {
+                if (lastWriter[resource] >= 0)
+                    producers[p].push_back(lastWriter[resource]);
+                readersSinceWrite[resource].push_back(p);
+            }
+            for (Resource resource : pass.writes) {
+                if (lastWriter[resource] >= 0 && lastWriter[resource] != p)
+                    producers[p].push_back(lastWriter[resource]);
+                // and after whoever still reads the previous contents
+                for (int reader : readersSinceWrite[resource])
+                    if (reader != p)
+                        after[p].push_back(reader);
+                readersSinceWrite[resource].clear();
+                lastWriter[resource] = p;
+            }
+        }
+
+        std::vector<int> stack;
+        for (int p = 0; p < count; p++) {
+            Pass& pass = passes[p];
+            pass.alive = pass.sideEffect ||
+                         std::find(pass.writes.begin(), pass.writes.end(), BACKBUFFER) != pass.writes.end();
+            if (pass.alive)
+                stack.push_back(p);
+        }
+        while (!stack.empty()) {
+            int p = stack.back();
+            stack.pop_back();
+            for (int producer : producers[p])
+                if (!passes[producer].alive) {
+                    passes[producer].alive = true;
+                    stack.push_back(producer);
+                }
+        }
+
+        // topological order among the live passes, the earliest declared one first whenever there's a choice
+        std::vector<std::vector<int>> dependents(count);
+        std::vector<int> waitingFor(count, 0);
+        for (int p = 0; p < count; p++) {
+            if (!passes[p].alive)
+                continue;
+            std::vector<int> dependencies = producers[p];
+            dependencies.insert(dependencies.end(), after[p].begin(), after[p].end());
+            std::sort(dependencies.begin(), dependencies.end());
+            dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+            for (int dependency : dependencies)
+                if (passes[dependency].alive) {
+                    dependents[dependency].push_back(p);
+                    waitingFor[p]++;
+                }
+        }
+        std::priority_queue<int, std::vector<int>, std::greater<int>> ready;
+        for (int p = 0; p < count; p++)
+            if (passes[p].alive && waitingFor[p] == 0)
+                ready.push(p);
+        while (!ready.empty()) {
+            int p = ready.top();
+            ready.pop();
+            order.push_back(p);
+            for (int dependent : dependents[p])
+                if (--waitingFor[dependent] == 0)
+                    ready.push(dependent);
+        }
+
+        // lifetimes of the transient textures over the ordered passes
+        for (ResourceEntry& resource : resources) {
+            resource.firstUse = -1;
+            resource.lastUse = -1;
+        }
+        for (int i = 0; i < (int)order.size(); i++) {
+            Pass& pass = passes[order[i]];
+            for (const std::vector<Resource>* list : {&pass.reads, &pass.writes})
+                for (Resource resource : *list) {
+                    ResourceEntry& entry = resources[resource];
+                    if (entry.firstUse < 0)
+                        entry.firstUse = i;
+                    entry.lastUse = i;
+                }
+        }
+    }
+
+    // runs the ordered passes, timing each one
+    void execute(GpuTimer& timer) {
+        Resources access(*this);
+        transientBytes = 0;
+        peakBytes = 0;
+        size_t liveBytes = 0;
+        for (int i = 0; i < (int)order.size(); i++) {
+            Pass& pass = passes[order[i]];
+            for (Resource resource : pass.creates) {
+                ResourceEntry& entry = resources[resource];
+                entry.texture = acquire(entry.desc);
+                size_t bytes = byteSize(entry.desc);
+                transientBytes += bytes;
+                liveBytes += bytes;
+            }
+            peakBytes = std::max(peakBytes, liveBytes);
+
+            timer.begin(pass.name);
+            pass.execute(access);
+            timer.end();
+
+            for (ResourceEntry& entry : resources)
+                if (!entry.imported && entry.texture != 0 && entry.lastUse == i) {
+                    release(entry.texture);
+                    liveBytes -= byteSize(entry.desc);
+                }
+        }
+        trimPool();
+    }
+
+    // the passes in execution order with what they create, the culled ones, transient memory
+    void DrawImGui() {
+        ImGui::Begin("Frame graph");
+        for (int p : order) {
+            const Pass& pass = passes[p];
+            std::string created;
+            for (Resource resource : pass.creates)
+                created += (created.empty() ? " -> " : ", ") + resources[resource].name;
+            ImGui::Text("%s%s", pass.name.c_str(), created.c_str());
+        }
+        for (const Pass& pass : passes)
+            if (!pass.alive)
+                ImGui::TextDisabled("%s (culled)", pass.name.c_str());
+        size_t pooledBytes = 0;
+        for (const PooledTexture& pooled : pool)
+            pooledBytes += byteSize(pooled.desc);
+        ImGui::Text("Transient textures: %.1f MB requested, %.1f MB live at most", transientBytes / 1048576.0,
+                    peakBytes / 1048576.0);
+        ImGui::Text("Pool: %d textures, %.1f MB", (int)pool.size(), pooledBytes / 1048576.0);
+        ImGui::End();
+    }
+
+private:
+    struct Pass {
+        std::string name;
+        std::function<void(const Resources&)> execute;
+        std::vector<Resource> creates, reads, writes;
+        bool sideEffect = false;
+        bool alive = false;
+    };
+    struct ResourceEntry {
+        std::string name;
+        TextureDesc desc;
+        GLuint texture;
+        bool imported;
+        // indices into the execution order, -1 if no live pass touches it
+        int firstUse, lastUse;
+    };
+    struct PooledTexture {
+        TextureDesc desc;
+        GLuint texture;
+        bool inUse;
+        long long lastUsedFrame;
+    };
+
+    std::vector<Pass> passes;
+    std::vector<ResourceEntry> resources;
+    std::vector<int> order;
+    std::vector<PooledTexture> pool;
+    // framebuffers by their attachments, dropped whenever a pooled texture is freed
+    std::map<std::vector<GLuint>, GLuint> framebuffers;
+    long long frame = 0;
+    size_t transientBytes = 0, peakBytes = 0;
+
+    Resource addResource(const std::string& name, const TextureDesc& desc, GLuint texture, bool imported) {
+        resources.push_back(ResourceEntry{name, desc, texture, imported, -1, -1});
+        return (Resource)resources.size() - 1;
+    }
+
+    static bool isDepth(GLenum internalFormat) {
+        return internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24 ||
+               internalFormat == GL_DEPTH_COMPONENT32F || internalFormat == GL_DEPTH24_STENCIL8;
+    }
+
+    static size_t byteSize(const TextureDesc& desc) {
+        size_t texel = 4;
+        switch (desc.internalFormat) {
+            case GL_R8: texel = 1; break;
+            case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: texel = 2; break;
+            case GL_RGBA16F: texel = 8; break;
+            case GL_RGBA32F: texel = 16; break;
+            default: break;
+        }
+        return texel * desc.width * desc.height;
+    }
+
+    GLuint acquire(const TextureDesc& desc) {
+        for (PooledTexture& pooled : pool)
+            if (!pooled.inUse && pooled.desc == desc) {
+                pooled.inUse = true;
+                pooled.lastUsedFrame = frame;
+                return pooled.texture;
+            }
+        PooledTexture pooled{desc, 0, true, frame};
+        glGenTextures(1, &pooled.texture);
+        glBindTexture(GL_TEXTURE_2D, pooled.texture);
+        if (isDepth(desc.internalFormat)) {
+            bool stencil = desc.internalFormat == GL_DEPTH24_STENCIL8;
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0,
+                         stencil ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT,
+                         stencil ? GL_UNSIGNED_INT_24_8 : GL_FLOAT, nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        pool.push_back(pooled);
+        return pooled.texture;
+    }
+
+    void release(GLuint texture) {
+        for (PooledTexture& pooled : pool)
+            if (pooled.texture == texture)
+                pooled.inUse = false;
+    }
+
+    void trimPool() {
+        bool freed = false;
+        for (auto it = pool.begin(); it != pool.end();) {
+            if (!it->inUse && frame - it->lastUsedFrame > POOL_FRAMES) {
+                glDeleteTextures(1, &it->texture);
+                it = pool.erase(it);
+                freed = true;
+            } else {
+                ++it;
+            }
+        }
+        if (freed)
+            releaseFramebuffers();
+    }
+
+    void releaseFramebuffers() {
+        for (auto& entry : framebuffers)
+            glDeleteFramebuffers(1, &entry.second);
+        framebuffers.clear();
+    }
+
+    GLuint framebuffer(std::initializer_list<Resource> attachments) {
+        if (attachments.size() == 1 && *attachments.begin() == BACKBUFFER)
+            return 0;
+        std::vector<GLuint> key;
+        for (Resource resource : attachments)
+            key.push_back(resources[resource].texture);
+        auto it = framebuffers.find(key);
+        if (it != framebuffers.end())
+            return it->second;
+
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        std::vector<GLenum> drawBuffers;
+        for (Resource resource : attachments) {
+            const ResourceEntry& entry = resources[resource];
+            if (isDepth(entry.desc.internalFormat)) {
+                GLenum point = entry.desc.internalFormat == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT
+                                                                                : GL_DEPTH_ATTACHMENT;
+                glFramebufferTexture2D(GL_FRAMEBUFFER, point, GL_TEXTURE_2D, entry.texture, 0);
+            } else {
+                GLenum point = GL_COLOR_ATTACHMENT0 + (GLenum)drawBuffers.size();
+                glFramebufferTexture2D(GL_FRAMEBUFFER, point, GL_TEXTURE_2D, entry.texture, 0);
+                drawBuffers.push_back(point);
+            }
+        }
+        if (drawBuffers.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "FrameGraph: framebuffer for " << resources[*attachments.begin()].name << " is incomplete"
+                      << std::endl;
+        framebuffers[key] = fbo;
+        return fbo;
+    }
+};
+
+#endif //PROJECT_BASE_FRAMEGRAPH_H
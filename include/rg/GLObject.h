@@ -0,0 +1,84 @@
+#ifndef PROJECT_BASE_GLOBJECT_H
+#define PROJECT_BASE_GLOBJECT_H
+
+#include <glad/glad.h>
+
+// An owning handle for one GL object name: it deletes the object when it goes away or is reset, and can be moved
+// but not copied, so classes built from these get correct copy and move behaviour without writing a destructor.
+// Converts to the name, so it passes straight into GL calls.
+template <typename Traits>
+class GLObject {
+public:
+    GLObject() = default;
+
+    // takes ownership of an existing name
+    explicit GLObject(GLuint name) : name(name) {}
+
+    ~GLObject() {
+        reset();
+    }
+
+    GLObject(GLObject&& other) noexcept : name(other.release()) {}
+
+    GLObject& operator=(GLObject&& other) noexcept {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    GLObject(const GLObject&) = delete;
+    GLObject& operator=(const GLObject&) = delete;
+
+    // a newly generated object
+    static GLObject create() {
+        return GLObject(Traits::create());
+    }
+
+    operator GLuint() const {
+        return name;
+    }
+
+    // gives up ownership without deleting
+    GLuint release() {
+        GLuint released = name;
+        name = 0;
+        return released;
+    }
+
+    // deletes the current object and owns replacement instead
+    void reset(GLuint replacement = 0) {
+        if (name != 0)
+            Traits::destroy(name);
+        name = replacement;
+    }
+
+private:
+    GLuint name = 0;
+};
+
+struct GLBufferTraits {
+    static GLuint create() { GLuint name; glGenBuffers(1, &name); return name; }
+    static void destroy(GLuint name) { glDeleteBuffers(1, &name); }
+};
+
+struct GLVertexArrayTraits {
+    static GLuint create() { GLuint name; glGenVertexArrays(1, &name); return name; }
+    static void destroy(GLuint name) { glDeleteVertexArrays(1, &name); }
+};
+
+struct GLTextureTraits {
+    static GLuint create() { GLuint name; glGenTextures(1, &name); return name; }
+    static void destroy(GLuint name) { glDeleteTextures(1, &name); }
+};
+
+struct GLProgramTraits {
+    static GLuint create() { return glCreateProgram(); }
+    static void destroy(GLuint name) { glDeleteProgram(name); }
+};
+
+using GLBuffer = GLObject<GLBufferTraits>;
+using GLVertexArray = GLObject<GLVertexArrayTraits>;
+using GLTexture = GLObject<GLTextureTraits>;
+using GLProgram = GLObject<GLProgramTraits>;
+
+#endif //PROJECT_BASE_GLOBJECT_H
@@ -0,0 +1,175 @@
+#ifndef PROJECT_BASE_GPUTIMER_H
+#define PROJECT_BASE_GPUTIMER_H
+
+#include <glad/glad.h>
+#include "imgui.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+// Measures named sections of the frame on the GPU with GL_TIMESTAMP queries, and on the CPU alongside.
+// Query results are collected LATENCY frames later so reading them never waits for the GPU.
+// Sections can nest; begin/end pairs must match within a frame.
+class GpuTimer {
+public:
+    static const int LATENCY = 4;
+
+    GpuTimer() = default;
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    ~GpuTimer() {
+        for (Frame& frame : frames)
+            if (!frame.queries.empty())
+                glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+    }
+
+    // starts a new frame: harvests the frame that used this slot LATENCY frames ago, returns whether it had results
+    bool beginFrame() {
+        current = (current + 1) % LATENCY;
+        Frame& frame = frames[current];
+        if (!frame.sections.empty()) {
+            GLint available = 0;
+            glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            // the GPU is more than LATENCY frames behind, drop the sample instead of stalling
+            if (available)
+                collect(frame);
+            collected = available != 0;
+        } else {
+            collected = false;
+        }
+        frame.sections.clear();
+        frame.usedQueries = 0;
+        stack.clear();
+        return collected;
+    }
+
+    void begin(const std::string& name) {
+        Frame& frame = frames[current];
+        Section section;
+        section.name = name;
+        section.depth = (int)stack.size();
+        section.startQuery = timestamp(frame);
+        section.cpuStart = std::chrono::steady_clock::now();
+        stack.push_back((int)frame.sections.size());
+        frame.sections.push_back(section);
+    }
+
+    void end() {
+        Frame& frame = frames[current];
+        Section& section = frame.sections[stack.back()];
+        stack.pop_back();
+        section.endQuery = timestamp(frame);
+        section.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - section.cpuStart).count();
+    }
+
+    // smoothed GPU time of a section in milliseconds, 0 if it hasn't been measured yet
+    double gpuMs(const std::string& name) const {
+        auto it = stats.find(name);
+        return it == stats.end() ? 0.0 : it->second.gpuMs;
+    }
+
+    // GPU time of a section in the frame beginFrame() last collected, unsmoothed
+    double latestGpuMs(const std::string& name) const {
+        auto it = stats.find(name);
+        return it == stats.end() ? 0.0 : it->second.latestGpuMs;
+    }
+
+    double cpuMs(const std::string& name) const {
+        auto it = stats.find(name);
+        return it == stats.end() ? 0.0 : it->second.cpuMs;
+    }
+
+    void DrawImGui() {
+        ImGui::Begin("Profiler");
+        ImGui::Text("%-24s %8s %8s", "Section", "GPU ms", "CPU ms");
+        for (const std::string& name : order) {
+            const Stat& stat = stats[name];
+            ImGui::Text("%*s%-*s %8.3f %8.3f", stat.depth * 2, "", 24 - stat.depth * 2, name.c_str(), stat.gpuMs, stat.cpuMs);
+        }
+        ImGui::End();
+    }
+
+private:
+    struct Section {
+        std::string name;
+        int depth;
+        int startQuery;
+        int endQuery;
+        std::chrono::steady_clock::time_point cpuStart;
+        double cpuMs;
+    };
+    struct Frame {
+        std::vector<GLuint> queries;
+        int usedQueries = 0;
+        std::vector<Section> sections;
+    };
+    struct Stat {
+        int depth = 0;
+        double gpuMs = 0.0;
+        double latestGpuMs = 0.0;
+        double cpuMs = 0.0;
+    };
+
+    Frame frames[LATENCY];
+    int current = 0;
+    bool collected = false;
+    std::vector<int> stack;
+    std::map<std::string, Stat> stats;
+    // sections in the order they were first seen, which is frame order
+    std::vector<std::string> order;
+
+    int timestamp(Frame& frame) {
+        if (frame.usedQueries == (int)frame.queries.size()) {
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queries.push_back(query);
+        }
+        glQueryCounter(frame.queries[frame.usedQueries], GL_TIMESTAMP);
+        return frame.usedQueries++;
+    }
+
+    void collect(const Frame& frame) {
+        for (const Section& section : frame.sections) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[section.startQuery], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.queries[section.endQuery], GL_QUERY_RESULT, &end);
+            double gpuMs = (double)(end - start) / 1.0e6;
+
+            auto it = stats.find(section.name);
+            if (it == stats.end()) {
+                order.push_back(section.name);
+                Stat stat;
+                stat.depth = section.depth;
+                stat.gpuMs = gpuMs;
+                stat.latestGpuMs = gpuMs;
+                stat.cpuMs = section.cpuMs;
+                stats[section.name] = stat;
+            } else {
+                it->second.gpuMs = it->second.gpuMs * 0.9 + gpuMs * 0.1;
+                it->second.latestGpuMs = gpuMs;
+                it->second.cpuMs = it->second.cpuMs * 0.9 + section.cpuMs * 0.1;
+            }
+        }
+    }
+};
+
+// begins a GpuTimer section for the lifetime of the object
+class GpuScope {
+public:
+    GpuScope(GpuTimer& timer, const std::string& name) : timer(timer) {
+        timer.begin(name);
+    }
+    ~GpuScope() {
+        timer.end();
+    }
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    GpuTimer& timer;
+};
+
+#endif //PROJECT_BASE_GPUTIMER_H
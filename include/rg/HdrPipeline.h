@@ -0,0 +1,166 @@
+#ifndef PROJECT_BASE_HDRPIPELINE_H
+#define PROJECT_BASE_HDRPIPELINE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+#include <algorithm>
+#include <vector>
+
+enum BloomQuality {
+    BLOOM_OFF,
+    BLOOM_LOW,
+    BLOOM_MEDIUM,
+    BLOOM_HIGH,
+};
+
+// one level of the bloom chain, a texture and a framebuffer around it from the frame graph
+struct BloomLevel {
+    GLuint texture;
+    GLuint framebuffer;
+    int width, height;
+};
+
+// The scene renders into an R11F_G11F_B10F target instead of the 8-bit default framebuffer. Bloom takes what is
+// brighter than `threshold` down a dual filter chain that starts at half resolution (every step halves the size),
+// then back up again, each level added onto the next larger one. One last pass adds the bloom to the scene,
+// tonemaps it and writes the bound framebuffer.
+// The targets come from the frame graph: levelSizes() says which bloom levels to create, downsample(), upsample()
+// and composite() are separate so each is its own pass.
+class HdrPipeline {
+public:
+    static const int MAX_LEVELS = 7;
+
+    BloomQuality quality = BLOOM_MEDIUM;
+    float threshold = 1.0f;
+    float knee = 0.5f;
+    float bloomStrength = 0.5f;
+    float exposure = 1.0f;
+
+    explicit HdrPipeline(ShaderWatcher* watcher = nullptr)
+        : prefilterShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_downsample.fs", nullptr, {"PREFILTER"}),
+          downsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_downsample.fs"),
+          upsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_upsample.fs"),
+          tonemapShader("resources/shaders/fullscreen.vs", "resources/shaders/tonemap.fs") {
+        for (Shader* shader : {&prefilterShader, &downsampleShader, &upsampleShader})
+            shader->setOnLink([](Shader& s) { s.setInt("source", 0); });
+        tonemapShader.setOnLink([](Shader& s) {
+            s.setInt("scene", 0);
+            s.setInt("bloom", 1);
+            s.setInt("autoExposure", 2);
+        });
+        if (watcher)
+            for (Shader* shader : {&prefilterShader, &downsampleShader, &upsampleShader, &tonemapShader})
+                watcher->watch(*shader);
+        // the fullscreen triangle has no attributes, but core profile still wants a VAO bound to draw
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~HdrPipeline() {
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    HdrPipeline(const HdrPipeline&) = delete;
+    HdrPipeline& operator=(const HdrPipeline&) = delete;
+
+    // sizes of the bloom levels the current quality tier uses for a width x height scene, half resolution first
+    std::vector<glm::ivec2> levelSizes(int width, int height) const {
+        const int tierLevels[] = {0, 3, 5, MAX_LEVELS};
+        std::vector<glm::ivec2> sizes;
+        for (int level = 0; level < tierLevels[quality]; level++) {
+            width /= 2;
+            height /= 2;
+            if (width < 2 || height < 2)
+                break;
+            sizes.push_back(glm::ivec2(width, height));
+        }
+        return sizes;
+    }
+
+    // bright pass into the half resolution level, then down the rest of the chain
+    void downsample(GLuint source, int width, int height, const std::vector<BloomLevel>& levels) {
+        if (levels.empty())
+            return;
+        beginPostPass();
+        prefilterShader.use();
+        prefilterShader.setFloat("threshold", threshold);
+        prefilterShader.setFloat("knee", std::max(knee, 1e-4f));
+        drawLevel(prefilterShader, source, width, height, levels[0]);
+        downsampleShader.use();
+        for (size_t level = 1; level < levels.size(); level++)
+            drawLevel(downsampleShader, levels[level - 1].texture, levels[level - 1].width, levels[level - 1].height,
+                      levels[level]);
+        endPostPass();
+    }
+
+    // back up the chain, each level blended onto the one above it; the half resolution level ends up with the sum
+    void upsample(const std::vector<BloomLevel>& levels) {
+        if (levels.size() < 2)
+            return;
+        beginPostPass();
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        upsampleShader.use();
+        for (size_t level = levels.size() - 1; level > 0; level--)
+            drawLevel(upsampleShader, levels[level].texture, levels[level].width, levels[level].height,
+                      levels[level - 1]);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDisable(GL_BLEND);
+        endPostPass();
+    }
+
+    // scene plus the top level of a bloom chain of `levels`, tonemapped into the bound framebuffer and viewport.
+    // A 1x1 exposure texture from AutoExposure scales `exposure`, 0 uses `exposure` alone
+    void composite(GLuint source, GLuint bloom, int levels, GLuint exposureTexture = 0) {
+        beginPostPass();
+        tonemapShader.use();
+        tonemapShader.setFloat("exposure", exposure);
+        tonemapShader.setFloat("useAutoExposure", exposureTexture != 0 ? 1.0f : 0.0f);
+        // every level adds about the same energy, keep the strength independent of the quality tier
+        tonemapShader.setFloat("bloomStrength", levels > 0 ? bloomStrength / levels : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, levels > 0 ? bloom : 0);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, exposureTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        endPostPass();
+    }
+
+private:
+    Shader prefilterShader;
+    Shader downsampleShader;
+    Shader upsampleShader;
+    Shader tonemapShader;
+    GLuint emptyVAO;
+
+    static void beginPostPass() {
+        glDisable(GL_DEPTH_TEST);
+    }
+
+    // back to the scene state main.cpp sets up once
+    static void endPostPass() {
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // one fullscreen pass from the source texture into a bloom level; the shader is bound already
+    void drawLevel(Shader& shader, GLuint source, int sourceWidth, int sourceHeight, const BloomLevel& target) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glViewport(0, 0, target.width, target.height);
+        shader.setVec2("texelSize", glm::vec2(1.0f / sourceWidth, 1.0f / sourceHeight));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+    }
+};
+
+#endif //PROJECT_BASE_HDRPIPELINE_H
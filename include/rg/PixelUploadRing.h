@@ -0,0 +1,93 @@
+#ifndef PROJECT_BASE_PIXELUPLOADRING_H
+#define PROJECT_BASE_PIXELUPLOADRING_H
+
+#include <glad/glad.h>
+
+#include <rg/GLObject.h>
+
+#include <vector>
+
+// A round-robin ring of pixel unpack buffers for texture uploads that don't stall. The render thread maps the slots
+// the GPU is done with; whoever holds the pointer fills it, on any thread; back on the render thread the slot is
+// unmapped and bound while the caller issues glTexSubImage calls with offsets into it, which the driver copies
+// from asynchronously. A fence after those calls says when the slot can be mapped again, so a slot is never
+// written while the GPU may still read it, and nothing ever waits on one.
+class PixelUploadRing {
+public:
+    PixelUploadRing(int slotCount, size_t slotBytes) : slotBytes(slotBytes), slots(slotCount) {
+        for (Slot& slot : slots) {
+            slot.buffer = GLBuffer::create();
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slotBytes, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    ~PixelUploadRing() {
+        for (Slot& slot : slots)
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+    }
+
+    PixelUploadRing(const PixelUploadRing&) = delete;
+    PixelUploadRing& operator=(const PixelUploadRing&) = delete;
+
+    // the next slot in the ring if the GPU has finished reading it, mapped for writing; -1 otherwise
+    int map() {
+        for (int i = 0; i < (int)slots.size(); i++) {
+            int index = (next + i) % (int)slots.size();
+            Slot& slot = slots[index];
+            if (slot.mapped)
+                continue;
+            if (slot.fence) {
+                if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                    continue;
+                glDeleteSync(slot.fence);
+                slot.fence = nullptr;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            // the fence has passed, nothing to synchronize with; the old contents can go
+            slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                                                           GL_MAP_UNSYNCHRONIZED_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (!slot.mapped)
+                return -1;
+            next = (index + 1) % (int)slots.size();
+            return index;
+        }
+        return -1;
+    }
+
+    unsigned char* pointer(int slot) const {
+        return slots[slot].mapped;
+    }
+
+    // unmaps the slot and leaves it bound as the unpack buffer: pixel pointers of the caller's glTexSubImage calls
+    // are offsets into it until end()
+    void begin(int slot) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[slot].buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        slots[slot].mapped = nullptr;
+    }
+
+    // fences the uploads from the slot and unbinds it
+    void end(int slot) {
+        slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    const size_t slotBytes;
+
+private:
+    struct Slot {
+        GLBuffer buffer;
+        GLsync fence = nullptr;
+        unsigned char* mapped = nullptr;
+    };
+
+    std::vector<Slot> slots;
+    int next = 0;
+};
+
+#endif //PROJECT_BASE_PIXELUPLOADRING_H
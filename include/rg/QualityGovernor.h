@@ -0,0 +1,108 @@
+#ifndef PROJECT_BASE_QUALITYGOVERNOR_H
+#define PROJECT_BASE_QUALITYGOVERNOR_H
+
+#include <algorithm>
+
+// what a quality level sets; everything is relative to the settings in the ImGui window
+struct QualityLevel {
+    // fraction of the window size the scene renders at, Upscaler brings it back up
+    float renderScale;
+    // multiplies the parallax layer count of the ground
+    float parallaxScale;
+    // multiplies the shadow cascade resolution and the shadow atlas tile sizes
+    float shadowScale;
+    // added to the LOD bias of the material textures
+    float lodBias;
+};
+
+// Holds the GPU frame time under `targetMs` by walking a ladder of quality levels, one step at a time.
+// Render scale goes first, since the parallax ground costs per pixel, then the other knobs join in.
+// GPU timer results come in GpuTimer::LATENCY frames late, so after a change the governor waits for samples of the
+// new level, then judges a window of them: over the target drops a level, well under it for a few windows in a row
+// raises one. The gap between the two thresholds keeps it from bouncing between neighbouring levels.
+class QualityGovernor {
+public:
+    static const int LEVELS = 8;
+    // samples averaged per decision
+    static const int WINDOW = 8;
+
+    bool enabled = true;
+    float targetMs = 16.6f;
+    // raise a level only below this fraction of the target
+    float raiseBelow = 0.75f;
+    // windows in a row under raiseBelow before raising
+    int raiseWindows = 3;
+
+    static const QualityLevel& level(int index) {
+        static const QualityLevel levels[LEVELS] = {
+                {1.0f, 1.0f, 1.0f, 0.0f},
+                {0.9f, 1.0f, 1.0f, 0.0f},
+                {0.8f, 1.0f, 1.0f, 0.0f},
+                {0.8f, 0.75f, 0.5f, 0.0f},
+                {0.7f, 0.75f, 0.5f, 0.5f},
+                {0.6f, 0.5f, 0.5f, 0.5f},
+                {0.5f, 0.5f, 0.25f, 1.0f},
+                {0.5f, 0.25f, 0.25f, 1.0f},
+        };
+        return levels[std::min(std::max(index, 0), LEVELS - 1)];
+    }
+
+    // the level in effect, the full quality one while disabled
+    const QualityLevel& settings() const {
+        return level(enabled ? current : 0);
+    }
+
+    int levelIndex() const { return current; }
+
+    // jumps to a level and starts judging it from scratch
+    void setLevel(int index) {
+        current = std::min(std::max(index, 0), LEVELS - 1);
+        settle = SETTLE_SAMPLES;
+        sum = 0.0;
+        samples = 0;
+        goodWindows = 0;
+    }
+
+    // one GPU frame time in milliseconds, call once for every frame the timer collected
+    void addSample(double gpuMs) {
+        if (!enabled)
+            return;
+        // the first samples after a change still measured the previous level
+        if (settle > 0) {
+            settle--;
+            return;
+        }
+        sum += gpuMs;
+        if (++samples < WINDOW)
+            return;
+        double average = sum / samples;
+        sum = 0.0;
+        samples = 0;
+        lastAverageMs = (float)average;
+        if (average > targetMs) {
+            if (current < LEVELS - 1)
+                setLevel(current + 1);
+        } else if (average < targetMs * raiseBelow) {
+            if (++goodWindows >= raiseWindows && current > 0)
+                setLevel(current - 1);
+        } else {
+            goodWindows = 0;
+        }
+    }
+
+    // average of the last judged window, for display
+    float averageMs() const { return lastAverageMs; }
+
+private:
+    // GpuTimer::LATENCY, and the frame in flight when the level changed
+    static const int SETTLE_SAMPLES = 5;
+
+    int current = 0;
+    int settle = SETTLE_SAMPLES;
+    double sum = 0.0;
+    int samples = 0;
+    int goodWindows = 0;
+    float lastAverageMs = 0.0f;
+};
+
+#endif //PROJECT_BASE_QUALITYGOVERNOR_H
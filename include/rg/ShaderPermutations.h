@@ -0,0 +1,136 @@
+#ifndef PROJECT_BASE_SHADERPERMUTATIONS_H
+#define PROJECT_BASE_SHADERPERMUTATIONS_H
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// compile-time features of a program, each one becomes a #define in the shader sources
+enum ShaderFeature : unsigned int {
+    SHADER_BLINN = 1u << 0,
+    SHADER_HAS_SPECULAR = 1u << 1,
+    SHADER_HAS_NORMALMAP = 1u << 2,
+    SHADER_ALPHA_TEST = 1u << 3,
+    SHADER_CONE_STEP = 1u << 4,
+    SHADER_FETCH_HEATMAP = 1u << 5,
+    SHADER_SHADOWS = 1u << 6,
+    SHADER_TRANSLUCENT = 1u << 7,
+    SHADER_AMBIENT_OCCLUSION = 1u << 8,
+    SHADER_IBL = 1u << 9,
+    SHADER_PBR = 1u << 10,
+    SHADER_HAS_EMISSIVE = 1u << 11,
+    SHADER_DEPTH_ONLY = 1u << 12,
+};
+
+// All variants of one vertex/fragment pair. Variants are compiled the first time they are requested
+// and cached, so switching a feature on and off again never recompiles anything.
+class ShaderPermutations {
+public:
+    ShaderPermutations(std::string vertexPath, std::string fragmentPath, ShaderWatcher* watcher = nullptr)
+        : vertexPath(std::move(vertexPath)), fragmentPath(std::move(fragmentPath)), watcher(watcher) {}
+
+    ShaderPermutations(const ShaderPermutations&) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+    // parallaxSteps of 0 leaves PARALLAX_STEPS to the shader's default
+    Shader& get(unsigned int features, int parallaxSteps = 0) {
+        Key key(features, parallaxSteps);
+        auto it = variants.find(key);
+        if (it != variants.end())
+            return *it->second;
+        return adopt(features, parallaxSteps, compile(features, parallaxSteps));
+    }
+
+    bool has(unsigned int features, int parallaxSteps = 0) const {
+        return variants.count(Key(features, parallaxSteps)) > 0;
+    }
+
+    // compiles a variant without caching it. Touches nothing get() changes, so it can run on a thread whose context
+    // shares objects with the render thread's; that thread adopts the result once the compile is visible to it
+    std::unique_ptr<Shader> compile(unsigned int features, int parallaxSteps = 0) const {
+        return std::unique_ptr<Shader>(new Shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr,
+                                                  definesFor(features, parallaxSteps)));
+    }
+
+    // caches a variant from compile(), unless one with the same features got there first
+    Shader& adopt(unsigned int features, int parallaxSteps, std::unique_ptr<Shader> shader) {
+        Key key(features, parallaxSteps);
+        auto it = variants.find(key);
+        if (it != variants.end())
+            return *it->second;
+        if (onLink)
+            shader->setOnLink(onLink);
+        if (watcher)
+            watcher->watch(*shader);
+        Shader& result = *shader;
+        variants.emplace(key, std::move(shader));
+        return result;
+    }
+
+    // uniform setup that every variant needs after (re)linking, see Shader::setOnLink
+    void setOnLink(std::function<void(Shader&)> callback) {
+        onLink = callback;
+        for (auto& variant : variants)
+            variant.second->setOnLink(onLink);
+    }
+
+    // visits every variant compiled so far, used to push per-frame uniforms to all of them
+    void forEach(const std::function<void(Shader&)>& f) {
+        for (auto& variant : variants)
+            f(*variant.second);
+    }
+
+    size_t size() const {
+        return variants.size();
+    }
+
+    static std::vector<std::string> definesFor(unsigned int features, int parallaxSteps) {
+        std::vector<std::string> defines;
+        if (features & SHADER_BLINN)
+            defines.push_back("BLINN");
+        if (features & SHADER_HAS_SPECULAR)
+            defines.push_back("HAS_SPECULAR");
+        if (features & SHADER_HAS_NORMALMAP)
+            defines.push_back("HAS_NORMALMAP");
+        if (features & SHADER_ALPHA_TEST)
+            defines.push_back("ALPHA_TEST");
+        if (features & SHADER_CONE_STEP)
+            defines.push_back("CONE_STEP");
+        if (features & SHADER_FETCH_HEATMAP)
+            defines.push_back("FETCH_HEATMAP");
+        if (features & SHADER_SHADOWS)
+            defines.push_back("SHADOWS");
+        if (features & SHADER_TRANSLUCENT)
+            defines.push_back("TRANSLUCENT");
+        if (features & SHADER_AMBIENT_OCCLUSION)
+            defines.push_back("AMBIENT_OCCLUSION");
+        if (features & SHADER_IBL)
+            defines.push_back("IBL");
+        if (features & SHADER_PBR)
+            defines.push_back("PBR");
+        if (features & SHADER_HAS_EMISSIVE)
+            defines.push_back("HAS_EMISSIVE");
+        if (features & SHADER_DEPTH_ONLY)
+            defines.push_back("DEPTH_ONLY");
+        if (parallaxSteps > 0)
+            defines.push_back("PARALLAX_STEPS " + std::to_string(parallaxSteps));
+        return defines;
+    }
+
+private:
+    typedef std::pair<unsigned int, int> Key;
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    ShaderWatcher* watcher;
+    std::function<void(Shader&)> onLink;
+    std::map<Key, std::unique_ptr<Shader>> variants;
+};
+
+#endif //PROJECT_BASE_SHADERPERMUTATIONS_H
@@ -0,0 +1,220 @@
+#ifndef PROJECT_BASE_SHADERWATCHER_H
+#define PROJECT_BASE_SHADERWATCHER_H
+
+#include <learnopengl/shader.h>
+#include <rg/UploadThread.h>
+#include "imgui.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Watches a shader directory on a background thread and hot-reloads the programs whose files changed.
+// The worker only reads the sources from disk. With an UploadThread the programs compile and link on its shared
+// context and the render thread swaps the new ID in once the fence after them has passed, so a reload never waits
+// on the driver; without one update() compiles on the render thread. A program that fails to compile keeps running
+// the old version.
+class ShaderWatcher {
+public:
+    explicit ShaderWatcher(std::string directory)
+        : directory(std::move(directory)) {
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 &&
+            inotify_add_watch(inotifyFd, this->directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) >= 0) {
+            running = true;
+            worker = std::thread(&ShaderWatcher::watchLoop, this);
+        } else {
+            std::cout << "ShaderWatcher: can't watch " << this->directory << ", hot-reload disabled" << std::endl;
+        }
+#else
+        std::cout << "ShaderWatcher: hot-reload is only supported on Linux" << std::endl;
+#endif
+    }
+
+    ~ShaderWatcher() {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+#ifdef __linux__
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+#endif
+    }
+
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    void watch(Shader& shader) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(Entry{&shader, shader.files, shader.lastError, 0.0});
+    }
+
+    // compiles reloads on the thread's context from now on, nullptr before the thread goes away; reloads it hasn't
+    // handed back by then are dropped
+    void setUploadThread(UploadThread* thread) {
+        uploads = thread;
+    }
+
+    // call once per frame from the render thread, before the upload thread's poll(). Without an upload thread at most
+    // one program is rebuilt per call, so a save that touches several programs spreads the driver compile cost over
+    // consecutive frames.
+    void update(double time) {
+        now = time;
+        while (true) {
+            Pending next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pending.empty())
+                    return;
+                next = std::move(pending.front());
+                pending.pop_front();
+            }
+            if (!uploads) {
+                finish(next.shader, Shader::compile(next.sources));
+                return;
+            }
+            auto build = std::make_shared<Shader::Build>();
+            auto sources = std::make_shared<Shader::Sources>(std::move(next.sources));
+            Shader* shader = next.shader;
+            uploads->submit([build, sources]() {
+                *build = Shader::compile(*sources);
+            }, [this, build, shader]() {
+                finish(shader, std::move(*build));
+            });
+        }
+    }
+
+    void DrawImGui(double time) {
+        ImGui::Begin("Shaders");
+        ImGui::Text("Watching %s%s", directory.c_str(), running ? "" : " (inactive)");
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Entry& entry : entries) {
+            ImGui::Separator();
+            ImGui::Text("%s", entry.shader->fragmentPath.c_str());
+            for (const std::string& define : entry.shader->defines) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("%s", define.c_str());
+            }
+            if (entry.error.empty()) {
+                if (entry.reloadTime > 0.0)
+                    ImGui::Text("OK, reloaded %.1fs ago", time - entry.reloadTime);
+                else
+                    ImGui::Text("OK");
+            } else {
+                ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Failed, running previous version");
+                ImGui::TextWrapped("%s", entry.error.c_str());
+            }
+        }
+        ImGui::End();
+    }
+
+private:
+    struct Entry {
+        Shader* shader;
+        // copy of shader->files the worker can read under our mutex, includes every #included file
+        std::vector<std::string> files;
+        std::string error;
+        double reloadTime;
+    };
+    struct Pending {
+        Shader* shader = nullptr;
+        Shader::Sources sources;
+    };
+
+    std::string directory;
+    UploadThread* uploads = nullptr;
+    // time of the last update(), for the reloads the upload thread hands back
+    double now = 0.0;
+    std::vector<Entry> entries;
+    std::deque<Pending> pending;
+    std::mutex mutex;
+    std::atomic<bool> running{false};
+    std::thread worker;
+    int inotifyFd = -1;
+
+    void finish(Shader* shader, Shader::Build build) {
+        bool ok = shader->adopt(std::move(build));
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Entry& entry : entries) {
+            if (entry.shader == shader) {
+                entry.files = shader->files;
+                entry.error = shader->lastError;
+                entry.reloadTime = now;
+            }
+        }
+        if (ok)
+            std::cout << "Reloaded " << shader->fragmentPath << std::endl;
+        else
+            std::cout << shader->lastError << std::endl;
+    }
+
+#ifdef __linux__
+    // collects the names of changed files from all events currently queued on the inotify descriptor
+    void drainEvents(std::set<std::string>& changed) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* ptr = buffer; ptr < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                if (event->len > 0)
+                    changed.insert(directory + "/" + event->name);
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+    void watchLoop() {
+        pollfd pfd{inotifyFd, POLLIN, 0};
+        while (running) {
+            if (poll(&pfd, 1, 100) <= 0)
+                continue;
+            std::set<std::string> changed;
+            drainEvents(changed);
+            // editors usually save in bursts (truncate, write, rename), wait for the burst to settle
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            drainEvents(changed);
+
+            std::vector<Shader*> affected;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const Entry& entry : entries)
+                    for (const std::string& path : changed)
+                        if (std::find(entry.files.begin(), entry.files.end(), path) != entry.files.end()) {
+                            affected.push_back(entry.shader);
+                            break;
+                        }
+            }
+            for (Shader* shader : affected) {
+                Shader::Sources sources = shader->loadSources();
+                std::lock_guard<std::mutex> lock(mutex);
+                // a newer save replaces a reload that hasn't been compiled yet
+                bool queued = false;
+                for (Pending& p : pending)
+                    if (p.shader == shader) {
+                        p.sources = std::move(sources);
+                        queued = true;
+                        break;
+                    }
+                if (!queued)
+                    pending.push_back(Pending{shader, std::move(sources)});
+            }
+        }
+    }
+#endif
+};
+
+#endif //PROJECT_BASE_SHADERWATCHER_H
@@ -0,0 +1,536 @@
+#ifndef PROJECT_BASE_SHADOWATLAS_H
+#define PROJECT_BASE_SHADOWATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/CascadedShadows.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a point or spot light that should cast shadows this frame
+struct ShadowedLight {
+    glm::vec3 position;
+    // spot lights only: where the cone points and the cosine of its outer angle
+    glm::vec3 direction;
+    float outerCutOff;
+    // nothing past this distance is lit, see ClusteredLights::range
+    float range;
+    bool isPoint;
+};
+
+// Shadow maps for point and spot lights, all packed into one depth texture so the lights never switch render targets.
+// Each light gets square tiles sized by how large its range sphere is on screen: one for a spot light, six cube faces
+// for a point light. Tiles come from a quadtree allocator and keep their place while the light's size holds, so
+// their contents can be reused from frame to frame.
+// Static casters are drawn into a second, cached atlas only when a tile is assigned or its light moves; refreshing a
+// tile for moving casters copies that static depth over and draws just the dynamic ones on top. At most
+// updateBudget tiles are rendered per frame, most important first. Lookups use the matrix a tile was last rendered
+// with, so a tile that misses the budget lags behind instead of going wrong.
+class ShadowAtlas {
+public:
+    static const int SIZE = 2048;
+    static const int MAX_TILE = 512;
+    static const int MIN_TILE = 64;
+    // length of the tile arrays in lighting.glsl
+    static const int MAX_TILES = 24;
+    static const int TEXTURE_UNIT = 12;
+
+    // tiles rendered per frame at most
+    int updateBudget = 8;
+    // keep static casters in the cached atlas, off draws every caster into every updated tile
+    bool caching = true;
+    // scales the on-screen size tiles are picked by, below 1 gives every light smaller tiles
+    float resolutionScale = 1.0f;
+
+    ShadowAtlas() {
+        for (int i = 0; i < 2; i++) {
+            glGenTextures(1, &textures[i]);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glGenFramebuffers(1, &fbos[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[i], 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~ShadowAtlas() {
+        glDeleteFramebuffers(2, fbos);
+        glDeleteTextures(2, textures);
+    }
+
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    // starts the frame's light list; lights that aren't added again give their tiles back in update()
+    void clear() {
+        for (auto& entry : entries)
+            entry.second.present = false;
+    }
+
+    // id identifies the light across frames, its tiles are kept for the same id
+    void add(int id, const ShadowedLight& light) {
+        Entry& entry = entries[id];
+        entry.id = id;
+        entry.light = light;
+        entry.present = true;
+    }
+
+    // assigns tiles by screen size and renders the most urgent ones; shader must be depth.vs/fs
+    void update(const std::vector<ShadowCaster>& casters, Shader& shader, const glm::vec3& cameraPosition,
+                const glm::mat4& viewProjection, float fovY, int viewportHeight) {
+        std::vector<Entry*> wanted;
+        for (auto it = entries.begin(); it != entries.end();) {
+            Entry& entry = it->second;
+            if (!entry.present) {
+                release(entry);
+                it = entries.erase(it);
+                continue;
+            }
+            entry.faceCount = entry.light.isPoint ? 6 : 1;
+            entry.importance = screenSize(entry.light, cameraPosition, viewProjection, fovY, viewportHeight);
+            int size = tileSize(entry.importance * resolutionScale);
+            // only shrink at a quarter of the size, so a light near the boundary doesn't bounce between two sizes
+            if (entry.size != 0 && (size == 0 || (size > entry.size || size * 2 < entry.size)))
+                release(entry);
+            entry.wantedSize = size;
+            if (size != 0)
+                wanted.push_back(&entry);
+            ++it;
+        }
+        std::sort(wanted.begin(), wanted.end(), [](const Entry* a, const Entry* b) {
+            return a->importance > b->importance;
+        });
+        for (Entry* entry : wanted)
+            if (entry->size == 0)
+                assign(*entry, wanted);
+
+        // face matrices, and which tiles moving casters force a refresh of
+        std::vector<Update> updates;
+        for (Entry* entry : wanted) {
+            if (entry->size == 0)
+                continue;
+            for (int face = 0; face < entry->faceCount; face++) {
+                Face& f = entry->faces[face];
+                f.matrix = faceMatrix(entry->light, face, entry->size);
+                f.dynamicNow = false;
+                for (const ShadowCaster& caster : casters) {
+                    if (caster.isStatic || caster.housedLight == entry->id)
+                        continue;
+                    if (boxInFrustum(f.matrix * caster.transform, caster.boundsMin, caster.boundsMax)) {
+                        f.dynamicNow = true;
+                        break;
+                    }
+                }
+                Update update{entry, face, 0, 0.0f};
+                if (!f.rendered)
+                    update.tier = 0;
+                else if (f.matrix != f.renderedMatrix)
+                    update.tier = 1;
+                else if (f.dynamicNow || f.dynamicRendered)
+                    update.tier = 2;
+                else
+                    continue;
+                // among stale tiles, big ones that have waited long go first
+                update.priority = entry->importance * (float)(f.age + 1);
+                updates.push_back(update);
+            }
+        }
+        std::sort(updates.begin(), updates.end(), [](const Update& a, const Update& b) {
+            return a.tier != b.tier ? a.tier < b.tier : a.priority > b.priority;
+        });
+        if ((int)updates.size() > updateBudget)
+            updates.resize(updateBudget);
+        for (Entry* entry : wanted)
+            for (int face = 0; face < entry->faceCount; face++)
+                entry->faces[face].age++;
+        render(updates, casters, shader);
+
+        // hand out uniform slots to the lights whose tiles all hold something, most important first
+        usedSlots = 0;
+        for (auto& item : entries)
+            item.second.firstSlot = -1;
+        for (Entry* entry : wanted) {
+            bool ready = entry->size != 0;
+            for (int face = 0; face < entry->faceCount && ready; face++)
+                ready = entry->faces[face].rendered;
+            if (!ready || usedSlots + entry->faceCount > MAX_TILES)
+                continue;
+            entry->firstSlot = usedSlots;
+            for (int face = 0; face < entry->faceCount; face++)
+                slots[usedSlots++] = SlotData{entry->faces[face].tile, entry->faces[face].renderedMatrix};
+        }
+    }
+
+    // forces every tile and its cached static casters to redraw, e.g. after static geometry changed; stale tiles
+    // go first in the next update()
+    void invalidate() {
+        for (auto& item : entries)
+            for (Face& face : item.second.faces) {
+                face.rendered = false;
+                face.staticValid = false;
+            }
+    }
+
+    // first of the light's tiles in the uniform arrays, -1 while it has no shadow
+    int firstTile(int id) const {
+        auto it = entries.find(id);
+        return it == entries.end() ? -1 : it->second.firstSlot;
+    }
+
+    void bind() const {
+        glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // uniforms of CalcLocalShadow in lighting.glsl
+    void setUniforms(Shader& shader) const {
+        const glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+        shader.setInt("shadowAtlas", TEXTURE_UNIT);
+        for (int i = 0; i < usedSlots; i++) {
+            const Tile& tile = slots[i].tile;
+            // light clip space to the tile's corner of the atlas; applied before the divide, which leaves it intact
+            glm::vec3 offset((float)tile.x / SIZE, (float)tile.y / SIZE, 0.0f);
+            glm::vec3 scale((float)tile.size / SIZE, (float)tile.size / SIZE, 1.0f);
+            glm::mat4 toTile = glm::scale(glm::translate(glm::mat4(1.0f), offset), scale);
+            // 1.5 texels in from the edges, so the filter taps stay inside the tile
+            float inset = 1.5f / SIZE;
+            std::string index = "[" + std::to_string(i) + "]";
+            shader.setMat4("atlasMatrices" + index, toTile * bias * slots[i].matrix);
+            shader.setVec4("atlasRects" + index, glm::vec4(offset.x + inset, offset.y + inset,
+                                                           offset.x + scale.x - inset, offset.y + scale.y - inset));
+        }
+    }
+
+    int renderedTileCount() const { return renderedTiles; }
+    int usedTileCount() const { return usedSlots; }
+    // fraction of the atlas that is assigned to some light
+    float occupancy() const { return 1.0f - (float)allocator.freeArea() / ((float)SIZE * SIZE); }
+
+private:
+    struct Tile {
+        int x = 0, y = 0, size = 0;
+    };
+    struct Face {
+        Tile tile;
+        glm::mat4 matrix;
+        // what the main atlas tile holds, and whether moving casters were in it
+        glm::mat4 renderedMatrix;
+        bool rendered = false;
+        bool dynamicRendered = false;
+        // what the cached atlas tile holds
+        glm::mat4 staticMatrix;
+        bool staticValid = false;
+        bool dynamicNow = false;
+        int age = 0;
+    };
+    struct Entry {
+        int id = -1;
+        ShadowedLight light;
+        bool present = false;
+        int faceCount = 1;
+        float importance = 0.0f;
+        int wantedSize = 0;
+        // tile size in texels, 0 while the light has no tiles
+        int size = 0;
+        Face faces[6];
+        int firstSlot = -1;
+    };
+    struct Update {
+        Entry* entry;
+        int face;
+        // 0 never rendered, 1 light moved, 2 moving casters
+        int tier;
+        float priority;
+    };
+    struct SlotData {
+        Tile tile;
+        glm::mat4 matrix;
+    };
+
+    // Quadtree (buddy) allocator: tiles are power of two squares aligned to their size. A tile is split into four
+    // when no free tile of the requested size is left, and four free siblings merge back into their parent.
+    class TileAllocator {
+    public:
+        TileAllocator() {
+            for (int y = 0; y < SIZE; y += MAX_TILE)
+                for (int x = 0; x < SIZE; x += MAX_TILE)
+                    freeTiles[0].insert(std::make_pair(y, x));
+        }
+
+        bool allocate(int size, Tile& tile) {
+            int level = levelOf(size);
+            if (freeTiles[level].empty()) {
+                Tile parent;
+                if (level == 0 || !allocate(size * 2, parent))
+                    return false;
+                freeTiles[level].insert(std::make_pair(parent.y, parent.x + size));
+                freeTiles[level].insert(std::make_pair(parent.y + size, parent.x));
+                freeTiles[level].insert(std::make_pair(parent.y + size, parent.x + size));
+                tile = Tile{parent.x, parent.y, size};
+                return true;
+            }
+            // lowest free position first, which keeps allocations packed towards one corner
+            auto first = freeTiles[level].begin();
+            tile = Tile{first->second, first->first, size};
+            freeTiles[level].erase(first);
+            return true;
+        }
+
+        void release(const Tile& tile) {
+            int level = levelOf(tile.size);
+            if (level > 0) {
+                int parentX = tile.x & ~(tile.size * 2 - 1), parentY = tile.y & ~(tile.size * 2 - 1);
+                std::pair<int, int> siblings[4] = {
+                        std::make_pair(parentY, parentX), std::make_pair(parentY, parentX + tile.size),
+                        std::make_pair(parentY + tile.size, parentX), std::make_pair(parentY + tile.size, parentX + tile.size)};
+                int freeSiblings = 0;
+                for (const auto& sibling : siblings)
+                    if (sibling != std::make_pair(tile.y, tile.x) && freeTiles[level].count(sibling))
+                        freeSiblings++;
+                if (freeSiblings == 3) {
+                    for (const auto& sibling : siblings)
+                        freeTiles[level].erase(sibling);
+                    release(Tile{parentX, parentY, tile.size * 2});
+                    return;
+                }
+            }
+            freeTiles[level].insert(std::make_pair(tile.y, tile.x));
+        }
+
+        // free texels in total
+        int freeArea() const {
+            int area = 0;
+            for (int level = 0; level < LEVELS; level++)
+                area += (int)freeTiles[level].size() * (MAX_TILE >> level) * (MAX_TILE >> level);
+            return area;
+        }
+
+    private:
+        static const int LEVELS = 4;
+        static_assert(MAX_TILE >> (LEVELS - 1) == MIN_TILE, "one level per power of two from MAX_TILE to MIN_TILE");
+        // (y, x) of the free tiles of each size, MAX_TILE at level 0
+        std::set<std::pair<int, int>> freeTiles[LEVELS];
+
+        static int levelOf(int size) {
+            int level = 0;
+            while ((MAX_TILE >> level) > size)
+                level++;
+            return level;
+        }
+    };
+
+    GLuint textures[2];
+    // 0 is the atlas lookups read, 1 caches the static casters
+    GLuint fbos[2];
+    TileAllocator allocator;
+    std::map<int, Entry> entries;
+    SlotData slots[MAX_TILES];
+    int usedSlots = 0;
+    int renderedTiles = 0;
+
+    void release(Entry& entry) {
+        if (entry.size == 0)
+            return;
+        for (int face = 0; face < entry.faceCount; face++) {
+            allocator.release(entry.faces[face].tile);
+            entry.faces[face] = Face();
+        }
+        entry.size = 0;
+    }
+
+    // gets tiles for the entry at its wanted size, evicting less important lights or settling for smaller tiles
+    void assign(Entry& entry, std::vector<Entry*>& wanted) {
+        for (int size = entry.wantedSize; size >= MIN_TILE; size /= 2) {
+            while (true) {
+                if (allocateFaces(entry, size))
+                    return;
+                // the least important light that holds tiles, if it's less important than this one
+                Entry* victim = nullptr;
+                for (auto it = wanted.rbegin(); it != wanted.rend() && (*it)->importance < entry.importance; ++it)
+                    if ((*it)->size != 0) {
+                        victim = *it;
+                        break;
+                    }
+                if (!victim)
+                    break;
+                release(*victim);
+            }
+        }
+    }
+
+    bool allocateFaces(Entry& entry, int size) {
+        for (int face = 0; face < entry.faceCount; face++) {
+            if (!allocator.allocate(size, entry.faces[face].tile)) {
+                for (int previous = 0; previous < face; previous++)
+                    allocator.release(entry.faces[previous].tile);
+                return false;
+            }
+        }
+        for (int face = 0; face < entry.faceCount; face++) {
+            Tile tile = entry.faces[face].tile;
+            entry.faces[face] = Face();
+            entry.faces[face].tile = tile;
+        }
+        entry.size = size;
+        return true;
+    }
+
+    // diameter of the light's range sphere on screen in pixels, 0 if the sphere is outside the view
+    static float screenSize(const ShadowedLight& light, const glm::vec3& cameraPosition, const glm::mat4& viewProjection,
+                            float fovY, int viewportHeight) {
+        // planes of the view frustum from the rows of the matrix
+        for (int plane = 0; plane < 6; plane++) {
+            int axis = plane / 2;
+            float sign = (plane & 1) ? -1.0f : 1.0f;
+            glm::vec4 p(viewProjection[0][3] + sign * viewProjection[0][axis],
+                        viewProjection[1][3] + sign * viewProjection[1][axis],
+                        viewProjection[2][3] + sign * viewProjection[2][axis],
+                        viewProjection[3][3] + sign * viewProjection[3][axis]);
+            float length = glm::length(glm::vec3(p));
+            if (glm::dot(glm::vec3(p), light.position) + p.w < -light.range * length)
+                return 0.0f;
+        }
+        float distance = glm::length(light.position - cameraPosition);
+        if (distance <= light.range)
+            return (float)viewportHeight;
+        return std::min(1.0f, light.range / (distance * std::tan(fovY * 0.5f))) * (float)viewportHeight;
+    }
+
+    // largest power of two within the on-screen size, between MIN_TILE and MAX_TILE; 0 for an invisible light
+    static int tileSize(float screenSize) {
+        if (screenSize <= 0.0f)
+            return 0;
+        int size = MIN_TILE;
+        while (size < MAX_TILE && size * 2 <= screenSize)
+            size *= 2;
+        return size;
+    }
+
+    static glm::mat4 faceMatrix(const ShadowedLight& light, int face, int size) {
+        // a slightly wider field of view than the face needs, so filtering at its edges stays within the tile
+        float margin = 1.0f + 4.0f / size;
+        float nearPlane = 0.05f;
+        if (light.isPoint) {
+            static const glm::vec3 directions[6] = {
+                    glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+                    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+            static const glm::vec3 ups[6] = {
+                    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+                    glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)};
+            return glm::perspective(2.0f * std::atan(margin), 1.0f, nearPlane, light.range) *
+                   glm::lookAt(light.position, light.position + directions[face], ups[face]);
+        }
+        glm::vec3 direction = glm::normalize(light.direction);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        float halfAngle = std::min(std::acos(light.outerCutOff), glm::radians(85.0f));
+        return glm::perspective(2.0f * std::atan(std::tan(halfAngle) * margin), 1.0f, nearPlane, light.range) *
+               glm::lookAt(light.position, light.position + direction, up);
+    }
+
+    // false if the transformed box is entirely outside one of the clip planes
+    static bool boxInFrustum(const glm::mat4& matrix, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+        glm::vec4 corners[8];
+        for (int c = 0; c < 8; c++)
+            corners[c] = matrix * glm::vec4((c & 1) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y,
+                                            (c & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+        for (int axis = 0; axis < 3; axis++) {
+            bool allBelow = true, allAbove = true;
+            for (const glm::vec4& corner : corners) {
+                allBelow = allBelow && corner[axis] < -corner.w;
+                allAbove = allAbove && corner[axis] > corner.w;
+            }
+            if (allBelow || allAbove)
+                return false;
+        }
+        return true;
+    }
+
+    void drawCasters(const std::vector<ShadowCaster>& casters, Shader& shader, int light, const glm::mat4& matrix,
+                     bool drawStatic, bool drawDynamic) {
+        shader.setMat4("projection", matrix);
+        for (const ShadowCaster& caster : casters) {
+            if ((caster.isStatic ? !drawStatic : !drawDynamic) || caster.housedLight == light)
+                continue;
+            if (!boxInFrustum(matrix * caster.transform, caster.boundsMin, caster.boundsMax))
+                continue;
+            shader.setMat4("model", caster.transform);
+            caster.draw();
+        }
+    }
+
+    void render(const std::vector<Update>& updates, const std::vector<ShadowCaster>& casters, Shader& shader) {
+        renderedTiles = (int)updates.size();
+        if (updates.empty())
+            return;
+        GLint previousViewport[4], previousFramebuffer;
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        // clears and blits must stay inside the tile
+        glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.0f);
+        shader.use();
+        shader.setMat4("view", glm::mat4(1.0f));
+
+        for (const Update& update : updates) {
+            Face& face = update.entry->faces[update.face];
+            const Tile& tile = face.tile;
+            glViewport(tile.x, tile.y, tile.size, tile.size);
+            glScissor(tile.x, tile.y, tile.size, tile.size);
+            if (caching) {
+                if (!face.staticValid || face.staticMatrix != face.matrix) {
+                    glBindFramebuffer(GL_FRAMEBUFFER, fbos[1]);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    drawCasters(casters, shader, update.entry->id, face.matrix, true, false);
+                    face.staticMatrix = face.matrix;
+                    face.staticValid = true;
+                }
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[1]);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[0]);
+                glBlitFramebuffer(tile.x, tile.y, tile.x + tile.size, tile.y + tile.size,
+                                  tile.x, tile.y, tile.x + tile.size, tile.y + tile.size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                glBindFramebuffer(GL_FRAMEBUFFER, fbos[0]);
+                if (face.dynamicNow)
+                    drawCasters(casters, shader, update.entry->id, face.matrix, false, true);
+            } else {
+                glBindFramebuffer(GL_FRAMEBUFFER, fbos[0]);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                drawCasters(casters, shader, update.entry->id, face.matrix, true, true);
+                face.staticValid = false;
+            }
+            face.renderedMatrix = face.matrix;
+            face.rendered = true;
+            face.dynamicRendered = face.dynamicNow;
+            face.age = 0;
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    }
+};
+
+#endif //PROJECT_BASE_SHADOWATLAS_H
@@ -0,0 +1,140 @@
+#ifndef PROJECT_BASE_TEMPORALAA_H
+#define PROJECT_BASE_TEMPORALAA_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+// Temporal anti-aliasing. Every frame the projection is shifted by a different sub-pixel offset from a Halton (2, 3)
+// sequence, so over several frames each pixel sees several positions inside it. The resolve reprojects last frame's
+// result with the motion vectors the lit shaders write, clips it to the current neighbourhood and blends, which
+// accumulates those samples at the cost of one fullscreen pass however complex the scene is.
+class TemporalAA {
+public:
+    static const int SAMPLES = 8;
+
+    float feedback = 0.9f;
+
+    explicit TemporalAA(ShaderWatcher* watcher = nullptr)
+        : resolveShader("resources/shaders/fullscreen.vs", "resources/shaders/taa.fs") {
+        resolveShader.setOnLink([](Shader& s) {
+            s.setInt("current", 0);
+            s.setInt("history", 1);
+            s.setInt("velocity", 2);
+        });
+        if (watcher)
+            watcher->watch(resolveShader);
+        glGenVertexArrays(1, &emptyVAO);
+        glGenTextures(2, history);
+        glGenFramebuffers(2, historyFBOs);
+    }
+
+    ~TemporalAA() {
+        glDeleteFramebuffers(2, historyFBOs);
+        glDeleteTextures(2, history);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    TemporalAA(const TemporalAA&) = delete;
+    TemporalAA& operator=(const TemporalAA&) = delete;
+
+    // the projection shifted by this frame's sub-pixel offset; call once per frame
+    glm::mat4 jitter(glm::mat4 projection, int width, int height) {
+        frame = (frame + 1) % SAMPLES;
+        glm::vec2 offset(halton(frame + 1, 2) - 0.5f, halton(frame + 1, 3) - 0.5f);
+        // a shift of the clip space x/y by offset pixels, scaled by w so it survives the divide
+        projection[2][0] += offset.x * 2.0f / width;
+        projection[2][1] += offset.y * 2.0f / height;
+        return projection;
+    }
+
+    // forgets the history, e.g. after TAA was off for a while
+    void reset() {
+        historyValid = false;
+    }
+
+    // the texture the next resolve() writes, (re)allocating the history at width x height
+    GLuint output(int width, int height) {
+        if (width != this->width || height != this->height)
+            resize(width, height);
+        return history[1 - current];
+    }
+
+    // blends the current frame into the history and returns the texture with the result
+    GLuint resolve(GLuint currentColor, GLuint velocity, int width, int height) {
+        if (width != this->width || height != this->height)
+            resize(width, height);
+        GLint previousViewport[4], previousFramebuffer;
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glDisable(GL_DEPTH_TEST);
+
+        int previous = current;
+        current = 1 - current;
+        glBindFramebuffer(GL_FRAMEBUFFER, historyFBOs[current]);
+        glViewport(0, 0, width, height);
+        resolveShader.use();
+        resolveShader.setVec2("texelSize", glm::vec2(1.0f / width, 1.0f / height));
+        resolveShader.setFloat("feedback", feedback);
+        resolveShader.setFloat("historyValid", historyValid ? 1.0f : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, currentColor);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, history[previous]);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, velocity);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        historyValid = true;
+
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        return history[current];
+    }
+
+private:
+    Shader resolveShader;
+    GLuint emptyVAO;
+    // RGBA16F, the feedback loop would drift in R11F_G11F_B10F
+    GLuint history[2];
+    GLuint historyFBOs[2];
+    int current = 0;
+    int width = 0, height = 0;
+    int frame = 0;
+    bool historyValid = false;
+
+    static float halton(int index, int base) {
+        float result = 0.0f, fraction = 1.0f;
+        while (index > 0) {
+            fraction /= base;
+            result += fraction * (index % base);
+            index /= base;
+        }
+        return result;
+    }
+
+    void resize(int width, int height) {
+        this->width = width;
+        this->height = height;
+        for (int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_2D, history[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindFramebuffer(GL_FRAMEBUFFER, historyFBOs[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, history[i], 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        historyValid = false;
+    }
+};
+
+#endif //PROJECT_BASE_TEMPORALAA_H
@@ -0,0 +1,730 @@
+#ifndef PROJECT_BASE_TEXTURESTREAMER_H
+#define PROJECT_BASE_TEXTURESTREAMER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include <learnopengl/mesh.h>
+#include <rg/AlphaCoverage.h>
+#include <rg/GLObject.h>
+#include <rg/PixelUploadRing.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps the material textures in VRAM only at the resolution the scene needs. The textures live in
+// GL_TEXTURE_2D_ARRAY tiers, one per power of two from BASE_SIZE up to MAX_SIZE. Every texture always has a layer
+// in the base tier, so it starts small and never goes missing; the tiers above hold as many layers as the VRAM
+// budget pays for. Each frame the culling pass reports how many pixels every visible model covers, which says what
+// tier its textures want. Textures that want more than they have get a layer in that tier, taking it from the least
+// recently used texture that doesn't need it this frame, which falls back to the base tier. A worker thread reads
+// the finer mips from the texture's .mips file and copies them row by row into a PixelUploadRing; the render thread
+// uploads from it up to a byte budget per frame, so a 2048 texture comes in over a few frames instead of in one
+// hitch, and switches the meshes over once its last row is in.
+// The .mips file is baked next to the source image on the first run: the image resampled to a power of two square
+// and its full mip chain in RGBA8, so any tier is one contiguous read. A hash of the source keeps it current.
+class TextureStreamer {
+public:
+    static const int BASE_SIZE = 128;
+    static const int MAX_SIZE = 2048;
+    static const int TIERS = 5;
+    // the staging ring: the most the worker can be ahead of the uploads
+    static const int STAGING_SLOTS = 8;
+    static const size_t STAGING_SLOT_BYTES = 1024 * 1024;
+
+    // bytes of texels uploaded per frame at most; at least one staging slot goes every frame
+    size_t uploadBudget = 4 * 1024 * 1024;
+    // uploaded by the last update()
+    size_t uploadedBytes = 0;
+
+    struct StreamedTexture {
+        std::string path;
+        // level 0 of the mip file
+        int size = BASE_SIZE;
+        bool hasAlpha = false;
+        bool softAlpha = false;
+        int residentTier = 0;
+        // layer in the resident tier
+        int slot = 0;
+        // tier this frame's footprint asks for, and the one a load is under way for, -1 for none
+        int wantedTier = 0;
+        int loadingTier = -1;
+        int loadingSlot = -1;
+        // last frame the resident tier was needed
+        uint64_t lastUsed = 0;
+        std::vector<Mesh*> users;
+        // the mip chain, only when the .mips file couldn't be written
+        std::vector<unsigned char> levels;
+    };
+
+    TextureStreamer() : ring(STAGING_SLOTS, STAGING_SLOT_BYTES) {}
+
+    ~TextureStreamer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // registers an image file, baking its .mips file if it's missing or stale, and returns its index. The alpha
+    // flags are those TextureFromFile reports
+    int add(const std::string& path, bool* hasAlpha, bool* softAlpha) {
+        for (size_t i = 0; i < textures.size(); i++)
+            if (textures[i].path == path) {
+                *hasAlpha = textures[i].hasAlpha;
+                *softAlpha = textures[i].softAlpha;
+                return (int)i;
+            }
+        StreamedTexture texture;
+        texture.path = path;
+        std::ifstream source(path, std::ios::binary);
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+        uint64_t hash = hashOf(bytes);
+        if (!readHeader(texture, hash)) {
+            std::cout << "TextureStreamer: baking mips of " << path << std::endl;
+            bake(texture, bytes, hash);
+        }
+        *hasAlpha = texture.hasAlpha;
+        *softAlpha = texture.softAlpha;
+        textures.push_back(std::move(texture));
+        return (int)textures.size() - 1;
+    }
+
+    // a mesh to repoint whenever one of its streamed textures changes tier
+    void attach(Mesh& mesh) {
+        for (const Texture& texture : mesh.textures)
+            if (texture.stream >= 0) {
+                std::vector<Mesh*>& users = textures[texture.stream].users;
+                if (std::find(users.begin(), users.end(), &mesh) == users.end())
+                    users.push_back(&mesh);
+            }
+    }
+
+    // after all models are loaded: allocates the tiers, uploads the base tier and starts the worker
+    void build() {
+        allocateTiers();
+        if (!worker.joinable()) {
+            running = true;
+            worker = std::thread(&TextureStreamer::loadLoop, this);
+        }
+    }
+
+    // VRAM for the tiers above the base one; reallocates them, every texture streams in again from the base tier
+    void setBudget(int megabytes) {
+        budgetMegabytes = megabytes;
+        if (!tiers.empty())
+            allocateTiers();
+    }
+
+    int budget() const {
+        return budgetMegabytes;
+    }
+
+    void setLodBias(float bias) {
+        lodBias = bias;
+        for (const Tier& tier : tiers)
+            for (const GLTexture& array : tier.arrays) {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+                glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_LOD_BIAS, bias);
+            }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // starts gathering this frame's footprints
+    void beginFrame() {
+        frame++;
+        for (StreamedTexture& texture : textures)
+            texture.wantedTier = 0;
+    }
+
+    // the model these textures belong to covers this many pixels on screen
+    void require(const std::vector<Texture>& modelTextures, float pixels) {
+        // glTF atlases spread a model over about half of each texture, so it takes twice the pixels in texels
+        float texels = 2.0f * pixels;
+        int tier = 0;
+        while (tier < TIERS - 1 && (BASE_SIZE << tier) < texels)
+            tier++;
+        for (const Texture& texture : modelTextures)
+            if (texture.stream >= 0) {
+                StreamedTexture& streamed = textures[texture.stream];
+                streamed.wantedTier = std::max(streamed.wantedTier, std::min(tier, maxTier(streamed)));
+            }
+    }
+
+    // uploads finished loads and starts new ones for what this frame's footprints want
+    void update() {
+        uploadStaged();
+        for (StreamedTexture& texture : textures)
+            if (texture.residentTier > 0 && texture.wantedTier >= texture.residentTier)
+                texture.lastUsed = frame;
+        // the textures furthest below what they want go first
+        std::vector<int> order;
+        for (size_t i = 0; i < textures.size(); i++)
+            if (textures[i].wantedTier > textures[i].residentTier && textures[i].loadingTier < 0)
+                order.push_back((int)i);
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return textures[a].wantedTier - textures[a].residentTier > textures[b].wantedTier - textures[b].residentTier;
+        });
+        for (int index : order) {
+            StreamedTexture& texture = textures[index];
+            // the wanted tier if a layer can be had there, otherwise the best one on the way up
+            for (int tier = texture.wantedTier; tier > texture.residentTier; tier--) {
+                int slot = freeSlot(tier);
+                if (slot < 0)
+                    continue;
+                tiers[tier].occupants[slot] = index;
+                texture.loadingTier = tier;
+                texture.loadingSlot = slot;
+                request(index, tier, slot);
+                break;
+            }
+        }
+    }
+
+    // diameter in pixels of the box's bounding sphere on screen, 0 if the box is outside the view
+    static float footprint(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                           const glm::mat4& viewProjection, const glm::vec3& cameraPosition, float fovY,
+                           int viewportHeight) {
+        glm::mat4 clip = viewProjection * transform;
+        glm::vec4 corners[8];
+        for (int c = 0; c < 8; c++)
+            corners[c] = clip * glm::vec4((c & 1) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y,
+                                          (c & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+        for (int axis = 0; axis < 3; axis++) {
+            bool allBelow = true, allAbove = true;
+            for (const glm::vec4& corner : corners) {
+                allBelow = allBelow && corner[axis] < -corner.w;
+                allAbove = allAbove && corner[axis] > corner.w;
+            }
+            if (allBelow || allAbove)
+                return 0.0f;
+        }
+        glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+        float scale = std::max(glm::length(glm::vec3(transform[0])),
+                               std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+        float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+        float distance = glm::length(center - cameraPosition);
+        if (distance <= radius)
+            return (float)viewportHeight;
+        return radius / (distance * std::tan(fovY * 0.5f)) * (float)viewportHeight;
+    }
+
+    const std::vector<StreamedTexture>& streamedTextures() const {
+        return textures;
+    }
+
+    int tierSize(int tier) const {
+        return BASE_SIZE << tier;
+    }
+
+    int tierCapacity(int tier) const {
+        return tier < (int)tiers.size() ? (int)tiers[tier].occupants.size() : 0;
+    }
+
+    int tierUsed(int tier) const {
+        if (tier >= (int)tiers.size())
+            return 0;
+        return (int)std::count_if(tiers[tier].occupants.begin(), tiers[tier].occupants.end(),
+                                  [](int occupant) { return occupant >= 0; });
+    }
+
+    // VRAM of all tiers, and of the layers holding a texture
+    size_t allocatedBytes() const {
+        size_t bytes = 0;
+        for (int tier = 0; tier < (int)tiers.size(); tier++)
+            bytes += layerBytes(tier) * tiers[tier].occupants.size();
+        return bytes;
+    }
+
+    size_t residentBytes() const {
+        size_t bytes = 0;
+        for (int tier = 0; tier < (int)tiers.size(); tier++)
+            bytes += layerBytes(tier) * tierUsed(tier);
+        return bytes;
+    }
+
+    int pendingLoads() const {
+        return (int)std::count_if(textures.begin(), textures.end(),
+                                  [](const StreamedTexture& texture) { return texture.loadingTier >= 0; });
+    }
+
+private:
+    // a tier's slots run through its arrays in order, each array holding at most maxLayers of them
+    struct Tier {
+        std::vector<GLTexture> arrays;
+        // texture index in every slot, -1 for a free one
+        std::vector<int> occupants;
+    };
+
+    struct Load {
+        int texture;
+        int tier;
+        int layer;
+        int generation;
+        std::vector<unsigned char> texels;
+        // how far the staging got
+        int level = 0;
+        int row = 0;
+        size_t offset = 0;
+    };
+
+    // rows of one mip level in a staging slot
+    struct Chunk {
+        int texture;
+        int tier;
+        int layer;
+        int generation;
+        int level;
+        int firstRow;
+        int rows;
+        size_t offset;
+        // the load's last rows, the texture can be switched over once they're uploaded
+        bool completes;
+    };
+
+    struct Staging {
+        int slot;
+        unsigned char* memory;
+        size_t used;
+        std::vector<Chunk> chunks;
+    };
+
+    static const uint32_t MIPS_MAGIC = 0x3153504D;
+    static const size_t HEADER_BYTES = 4 + 8 + 4 + 4;
+
+    std::vector<StreamedTexture> textures;
+    std::vector<Tier> tiers;
+    // layers per array, from GL_MAX_ARRAY_TEXTURE_LAYERS
+    int maxLayers = 1;
+    int budgetMegabytes = 128;
+    float lodBias = 0.0f;
+    uint64_t frame = 0;
+    // bumped by every reallocation, loads for older tiers are dropped; written under the mutex
+    int generation = 0;
+
+    PixelUploadRing ring;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = false;
+    std::deque<Load> requests;
+    // mapped slots waiting for the worker, and filled ones waiting for the upload, in ring order
+    std::deque<Staging> mapped;
+    std::deque<Staging> filled;
+
+    static int maxTier(const StreamedTexture& texture) {
+        int tier = 0;
+        while ((BASE_SIZE << tier) < texture.size)
+            tier++;
+        return tier;
+    }
+
+    static int levelCount(int size) {
+        int levels = 1;
+        while (size > 1) {
+            size /= 2;
+            levels++;
+        }
+        return levels;
+    }
+
+    // the mip chain from size down to 1x1
+    static size_t chainBytes(int size) {
+        size_t bytes = 0;
+        for (; size >= 1; size /= 2)
+            bytes += (size_t)size * size * 4;
+        return bytes;
+    }
+
+    size_t layerBytes(int tier) const {
+        return chainBytes(tierSize(tier));
+    }
+
+    static std::string mipsPath(const std::string& path) {
+        return path + ".mips";
+    }
+
+    static uint64_t hashOf(const std::vector<unsigned char>& bytes) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char byte : bytes)
+            hash = (hash ^ byte) * 1099511628211ull;
+        return hash;
+    }
+
+    static bool readHeader(StreamedTexture& texture, uint64_t hash) {
+        std::ifstream file(mipsPath(texture.path), std::ios::binary);
+        uint32_t magic = 0, flags = 0;
+        uint64_t cachedHash = 0;
+        int32_t size = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&cachedHash, sizeof(cachedHash));
+        file.read((char*)&size, sizeof(size));
+        file.read((char*)&flags, sizeof(flags));
+        if (!file || magic != MIPS_MAGIC || cachedHash != hash || size < BASE_SIZE || size > MAX_SIZE)
+            return false;
+        texture.size = size;
+        texture.hasAlpha = (flags & 1) != 0;
+        texture.softAlpha = (flags & 2) != 0;
+        return true;
+    }
+
+    // decodes the image, squares it to a power of two and writes the mip chain
+    static void bake(StreamedTexture& texture, const std::vector<unsigned char>& bytes, uint64_t hash) {
+        int width = 0, height = 0, components = 0;
+        unsigned char* data = bytes.empty() ? nullptr
+                : stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &components, 4);
+        std::vector<unsigned char> image;
+        if (data) {
+            image.assign(data, data + (size_t)width * height * 4);
+            stbi_image_free(data);
+        } else {
+            // white like an unbound texture reads
+            std::cout << "Texture failed to load at path: " << texture.path << std::endl;
+            width = height = BASE_SIZE;
+            image.assign((size_t)width * height * 4, 255);
+        }
+        texture.hasAlpha = texture.softAlpha = false;
+        if (components == 4)
+            classifyAlpha(image.data(), image.size() / 4, &texture.hasAlpha, &texture.softAlpha);
+
+        int size = BASE_SIZE;
+        while (size < MAX_SIZE && size * 3 / 2 < std::max(width, height))
+            size *= 2;
+        texture.size = size;
+        std::vector<unsigned char> chain;
+        chain.reserve(chainBytes(size));
+        std::vector<unsigned char> level;
+        resample(image, width, height, level, size);
+        for (int levelSize = size; ; levelSize /= 2) {
+            chain.insert(chain.end(), level.begin(), level.end());
+            if (levelSize == 1)
+                break;
+            halve(level, levelSize);
+        }
+
+        std::ofstream file(mipsPath(texture.path), std::ios::binary);
+        uint32_t magic = MIPS_MAGIC, flags = (texture.hasAlpha ? 1u : 0u) | (texture.softAlpha ? 2u : 0u);
+        int32_t size32 = size;
+        file.write((const char*)&magic, sizeof(magic));
+        file.write((const char*)&hash, sizeof(hash));
+        file.write((const char*)&size32, sizeof(size32));
+        file.write((const char*)&flags, sizeof(flags));
+        file.write((const char*)chain.data(), chain.size());
+        if (!file) {
+            std::cout << "TextureStreamer: couldn't write " << mipsPath(texture.path) << ", keeping it in memory"
+                      << std::endl;
+            texture.levels = std::move(chain);
+        }
+    }
+
+    // 2x2 box filter in place
+    static void halve(std::vector<unsigned char>& level, int size) {
+        int half = size / 2;
+        for (int y = 0; y < half; y++)
+            for (int x = 0; x < half; x++)
+                for (int c = 0; c < 4; c++) {
+                    const unsigned char* p = &level[((size_t)(2 * y) * size + 2 * x) * 4 + c];
+                    level[((size_t)y * half + x) * 4 + c] =
+                            (unsigned char)((p[0] + p[4] + p[size * 4] + p[size * 4 + 4] + 2) / 4);
+                }
+        level.resize((size_t)half * half * 4);
+    }
+
+    // bilinear resample of an RGBA8 image to size x size, halving first while it's more than twice as large
+    static void resample(std::vector<unsigned char>& source, int width, int height, std::vector<unsigned char>& out,
+                         int size) {
+        while (width >= size * 4 && height >= size * 4 && width % 2 == 0 && height % 2 == 0) {
+            for (int y = 0; y < height / 2; y++)
+                for (int x = 0; x < width / 2; x++)
+                    for (int c = 0; c < 4; c++) {
+                        const unsigned char* p = &source[((size_t)(2 * y) * width + 2 * x) * 4 + c];
+                        source[((size_t)y * (width / 2) + x) * 4 + c] =
+                                (unsigned char)((p[0] + p[4] + p[width * 4] + p[width * 4 + 4] + 2) / 4);
+                    }
+            width /= 2;
+            height /= 2;
+        }
+        if (width == size && height == size) {
+            out.assign(source.begin(), source.begin() + (size_t)size * size * 4);
+            return;
+        }
+        out.resize((size_t)size * size * 4);
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++) {
+                float sx = std::max((x + 0.5f) * width / size - 0.5f, 0.0f);
+                float sy = std::max((y + 0.5f) * height / size - 0.5f, 0.0f);
+                int x0 = std::min((int)sx, width - 1), y0 = std::min((int)sy, height - 1);
+                int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+                float fx = sx - x0, fy = sy - y0;
+                for (int c = 0; c < 4; c++) {
+                    auto at = [&](int px, int py) { return (float)source[((size_t)py * width + px) * 4 + c]; };
+                    float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+                    float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+                    out[((size_t)y * size + x) * 4 + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+    }
+
+    // the mips of a tier, from the file or the in-memory chain
+    static std::vector<unsigned char> readTier(const StreamedTexture& texture, int tierSize) {
+        size_t offset = chainBytes(texture.size) - chainBytes(tierSize);
+        std::vector<unsigned char> texels(chainBytes(tierSize));
+        if (!texture.levels.empty()) {
+            std::copy(texture.levels.begin() + offset, texture.levels.begin() + offset + texels.size(), texels.begin());
+            return texels;
+        }
+        std::ifstream file(mipsPath(texture.path), std::ios::binary);
+        file.seekg(HEADER_BYTES + offset);
+        file.read((char*)texels.data(), texels.size());
+        if (!file)
+            std::cout << "TextureStreamer: couldn't read " << mipsPath(texture.path) << std::endl;
+        return texels;
+    }
+
+    // (re)creates the tiers: the base one with a layer per texture, the rest sized by the budget, the larger tiers
+    // first, each with an even share of what's left and at most a layer per texture that can use it
+    void allocateTiers() {
+        {
+            // staged rows of older generations are skipped at upload, the slots still go through the ring
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.clear();
+            generation++;
+        }
+        tiers.clear();
+        tiers.resize(TIERS);
+        // the base tier alone needs a layer per texture, more than GL_MAX_ARRAY_TEXTURE_LAYERS in a large scene
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        std::vector<int> capacities(TIERS, 0);
+        capacities[0] = (int)textures.size();
+        size_t remaining = (size_t)budgetMegabytes * 1024 * 1024;
+        for (int tier = TIERS - 1; tier > 0; tier--) {
+            int eligible = (int)std::count_if(textures.begin(), textures.end(),
+                                              [tier](const StreamedTexture& texture) { return maxTier(texture) >= tier; });
+            size_t share = remaining / tier;
+            capacities[tier] = (int)std::min((size_t)eligible, share / layerBytes(tier));
+            remaining -= capacities[tier] * layerBytes(tier);
+        }
+        for (int tier = 0; tier < TIERS; tier++) {
+            tiers[tier].occupants.assign(capacities[tier], -1);
+            if (capacities[tier] == 0)
+                continue;
+            int size = tierSize(tier);
+            for (int first = 0; first < capacities[tier]; first += maxLayers) {
+                int layers = std::min(maxLayers, capacities[tier] - first);
+                tiers[tier].arrays.push_back(GLTexture::create());
+                glBindTexture(GL_TEXTURE_2D_ARRAY, tiers[tier].arrays.back());
+                for (int level = 0; level < levelCount(size); level++)
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(1, size >> level),
+                                 std::max(1, size >> level), layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount(size) - 1);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            }
+        }
+        for (size_t i = 0; i < textures.size(); i++) {
+            StreamedTexture& texture = textures[i];
+            texture.loadingTier = texture.loadingSlot = -1;
+            tiers[0].occupants[i] = (int)i;
+            upload(0, (int)i, readTier(texture, BASE_SIZE));
+            makeResident((int)i, 0, (int)i);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        setLodBias(lodBias);
+    }
+
+    // a free layer of the tier, or the one of the least recently used texture that didn't need it this frame
+    int freeSlot(int tier) {
+        std::vector<int>& occupants = tiers[tier].occupants;
+        int victim = -1;
+        for (int slot = 0; slot < (int)occupants.size(); slot++) {
+            int occupant = occupants[slot];
+            if (occupant < 0)
+                return slot;
+            const StreamedTexture& texture = textures[occupant];
+            if (texture.residentTier != tier || texture.slot != slot || texture.lastUsed >= frame)
+                continue;
+            if (victim < 0 || texture.lastUsed < textures[occupants[victim]].lastUsed)
+                victim = slot;
+        }
+        if (victim >= 0) {
+            int evicted = occupants[victim];
+            occupants[victim] = -1;
+            makeResident(evicted, 0, evicted);
+        }
+        return victim;
+    }
+
+    void request(int index, int tier, int layer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(Load{index, tier, layer, generation, {}});
+        }
+        wake.notify_one();
+    }
+
+    // reads a load, then stages it into whatever slots the render thread maps for it
+    void loadLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        Load load;
+        bool loading = false;
+        while (true) {
+            wake.wait(lock, [&] { return !running || (loading ? !mapped.empty() : !requests.empty()); });
+            if (!running)
+                return;
+            if (!loading) {
+                load = std::move(requests.front());
+                requests.pop_front();
+                // textures is only resized before the worker starts, the fields read here never change
+                const StreamedTexture& texture = textures[load.texture];
+                lock.unlock();
+                load.texels = readTier(texture, tierSize(load.tier));
+                lock.lock();
+                loading = true;
+                continue;
+            }
+            if (load.generation != generation) {
+                loading = false;
+                continue;
+            }
+            Staging staging = std::move(mapped.front());
+            mapped.pop_front();
+            lock.unlock();
+            loading = !stage(load, staging);
+            lock.lock();
+            filled.push_back(std::move(staging));
+        }
+    }
+
+    // copies as many whole rows of the load as fit into the slot, returns whether the load is all staged
+    bool stage(Load& load, Staging& staging) {
+        int size = tierSize(load.tier);
+        int levels = levelCount(size);
+        while (load.level < levels) {
+            int levelSize = size >> load.level;
+            size_t rowBytes = (size_t)levelSize * 4;
+            int rows = (int)std::min((size_t)(levelSize - load.row), (ring.slotBytes - staging.used) / rowBytes);
+            if (rows == 0)
+                return false;
+            std::memcpy(staging.memory + staging.used, load.texels.data() + load.offset, rows * rowBytes);
+            load.row += rows;
+            bool levelDone = load.row == levelSize;
+            staging.chunks.push_back(Chunk{load.texture, load.tier, load.layer, load.generation, load.level,
+                                           load.row - rows, rows, staging.used,
+                                           levelDone && load.level == levels - 1});
+            staging.used += rows * rowBytes;
+            load.offset += rows * rowBytes;
+            if (levelDone) {
+                load.level++;
+                load.row = 0;
+            }
+        }
+        return true;
+    }
+
+    // uploads staged slots in order up to the byte budget, then maps the slots the GPU is done with for the worker
+    void uploadStaged() {
+        uploadedBytes = 0;
+        while (uploadedBytes < uploadBudget) {
+            Staging staging;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (filled.empty())
+                    break;
+                staging = std::move(filled.front());
+                filled.pop_front();
+            }
+            ring.begin(staging.slot);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (const Chunk& chunk : staging.chunks) {
+                if (chunk.generation != generation)
+                    continue;
+                int levelSize = tierSize(chunk.tier) >> chunk.level;
+                glBindTexture(GL_TEXTURE_2D_ARRAY, arrayOf(chunk.tier, chunk.layer));
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, chunk.level, 0, chunk.firstRow, layerOf(chunk.layer), levelSize,
+                                chunk.rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)chunk.offset);
+            }
+            ring.end(staging.slot);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            uploadedBytes += staging.used;
+            for (const Chunk& chunk : staging.chunks)
+                if (chunk.completes && chunk.generation == generation)
+                    finishLoad(chunk.texture, chunk.tier, chunk.layer);
+        }
+        bool mappedAny = false;
+        for (int slot = ring.map(); slot >= 0; slot = ring.map()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            mapped.push_back(Staging{slot, ring.pointer(slot), 0, {}});
+            mappedAny = true;
+        }
+        if (mappedAny)
+            wake.notify_one();
+    }
+
+    void finishLoad(int index, int tier, int layer) {
+        StreamedTexture& texture = textures[index];
+        // its old layer is free for others
+        if (texture.residentTier > 0)
+            tiers[texture.residentTier].occupants[texture.slot] = -1;
+        makeResident(index, tier, layer);
+        texture.loadingTier = texture.loadingSlot = -1;
+        texture.lastUsed = frame;
+    }
+
+    // straight from client memory, for the base tier at load
+    void upload(int tier, int slot, const std::vector<unsigned char>& texels) {
+        int size = tierSize(tier);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrayOf(tier, slot));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t offset = 0;
+        for (int level = 0; size >= 1; level++, size /= 2) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layerOf(slot), size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                            texels.data() + offset);
+            offset += (size_t)size * size * 4;
+        }
+    }
+
+    GLuint arrayOf(int tier, int slot) const {
+        return tiers[tier].arrays[slot / maxLayers];
+    }
+
+    int layerOf(int slot) const {
+        return slot % maxLayers;
+    }
+
+    // points the meshes using the texture at its layer in the tier
+    void makeResident(int index, int tier, int slot) {
+        StreamedTexture& texture = textures[index];
+        texture.residentTier = tier;
+        texture.slot = slot;
+        for (Mesh* mesh : texture.users) {
+            for (Texture& meshTexture : mesh->textures)
+                if (meshTexture.stream == index) {
+                    meshTexture.id = arrayOf(tier, slot);
+                    meshTexture.layer = layerOf(slot);
+                }
+            mesh->UpdateMaterial();
+        }
+    }
+};
+
+#endif //PROJECT_BASE_TEXTURESTREAMER_H
@@ -0,0 +1,128 @@
+#ifndef PROJECT_BASE_UPLOADTHREAD_H
+#define PROJECT_BASE_UPLOADTHREAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Creates GL resources off the render thread. The thread owns a second context, that of a hidden window sharing
+// objects with the main one, and runs the submitted jobs on it: loading files, creating and filling buffers and
+// textures. A fence goes in after each job, and poll() on the render thread hands a job's results over only once
+// the fence has passed, so the renderer never sees a half-uploaded object and never waits for one.
+// Vertex arrays and framebuffers are not shared between contexts; the ready callback creates those.
+class UploadThread {
+public:
+    // on the main thread, with the main window's hints still set, as GLFW wants windows created there
+    explicit UploadThread(GLFWwindow* shared) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "Uploads", nullptr, shared);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (context) {
+            running = true;
+            worker = std::thread(&UploadThread::run, this);
+        } else {
+            std::cout << "UploadThread: can't create a shared context, uploads run on the render thread" << std::endl;
+        }
+    }
+
+    ~UploadThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+        for (Job& job : finished)
+            glDeleteSync(job.fence);
+        if (context)
+            glfwDestroyWindow(context);
+    }
+
+    UploadThread(const UploadThread&) = delete;
+    UploadThread& operator=(const UploadThread&) = delete;
+
+    // runs work on the upload thread, then ready on the render thread from a poll() after the GPU has everything
+    // work created. Without a shared context both run right away
+    void submit(std::function<void()> work, std::function<void()> ready) {
+        if (!context) {
+            work();
+            ready();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{std::move(work), std::move(ready), nullptr});
+        }
+        wake.notify_one();
+    }
+
+    // call once per frame from the render thread: runs the ready callbacks of finished jobs, in submission order
+    void poll() {
+        while (true) {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (finished.empty() || glClientWaitSync(finished.front().fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                    return;
+                job = std::move(finished.front());
+                finished.pop_front();
+            }
+            glDeleteSync(job.fence);
+            job.ready();
+        }
+    }
+
+    // submitted jobs whose results the renderer doesn't have yet
+    int pendingJobs() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)(jobs.size() + finished.size()) + (busy ? 1 : 0);
+    }
+
+private:
+    struct Job {
+        std::function<void()> work;
+        std::function<void()> ready;
+        GLsync fence = nullptr;
+    };
+
+    GLFWwindow* context = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = false;
+    bool busy = false;
+    std::deque<Job> jobs;
+    std::deque<Job> finished;
+
+    void run() {
+        glfwMakeContextCurrent(context);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !running || !jobs.empty(); });
+            if (!running)
+                break;
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+            job.work();
+            job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // the fence only signals once the commands before it reach the GPU
+            glFlush();
+            lock.lock();
+            busy = false;
+            finished.push_back(std::move(job));
+        }
+        lock.unlock();
+        glfwMakeContextCurrent(nullptr);
+    }
+};
+
+#endif //PROJECT_BASE_UPLOADTHREAD_H
@@ -0,0 +1,72 @@
+#ifndef PROJECT_BASE_UPSCALER_H
+#define PROJECT_BASE_UPSCALER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+// Spatial upscaling of the tonemapped image to the window size, for when the scene renders at a lower resolution.
+// The first pass is edge-adaptive: it estimates the local edge direction from the luma of the 2x2 source texels
+// around each output pixel and filters 12 texels with a Lanczos-like kernel stretched along that edge, so edges
+// stay crisp instead of turning into bilinear steps, clamped to the nearest texels against ringing. The second pass
+// sharpens the result at full resolution, limited by the neighbourhood so it doesn't clip.
+// Both draw into the bound framebuffer; the frame graph provides the 8-bit targets in between.
+class Upscaler {
+public:
+    // 0 is no sharpening, 1 the most
+    float sharpness = 0.5f;
+
+    explicit Upscaler(ShaderWatcher* watcher = nullptr)
+        : upscaleShader("resources/shaders/fullscreen.vs", "resources/shaders/upscale.fs"),
+          sharpenShader("resources/shaders/fullscreen.vs", "resources/shaders/sharpen.fs") {
+        for (Shader* shader : {&upscaleShader, &sharpenShader})
+            shader->setOnLink([](Shader& s) { s.setInt("source", 0); });
+        if (watcher) {
+            watcher->watch(upscaleShader);
+            watcher->watch(sharpenShader);
+        }
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~Upscaler() {
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    Upscaler(const Upscaler&) = delete;
+    Upscaler& operator=(const Upscaler&) = delete;
+
+    // upscales the source, texels fetched directly, to the size of the bound viewport
+    void upscale(GLuint source) {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        upscaleShader.use();
+        upscaleShader.setVec2("outputSize", glm::vec2(viewport[2], viewport[3]));
+        draw(source);
+    }
+
+    // sharpens the upscaled image into the bound framebuffer, same size
+    void sharpen(GLuint source) {
+        sharpenShader.use();
+        sharpenShader.setFloat("sharpness", sharpness);
+        draw(source);
+    }
+
+private:
+    Shader upscaleShader;
+    Shader sharpenShader;
+    GLuint emptyVAO;
+
+    void draw(GLuint source) {
+        glDisable(GL_DEPTH_TEST);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+};
+
+#endif //PROJECT_BASE_UPSCALER_H
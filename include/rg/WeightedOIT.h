@@ -0,0 +1,140 @@
+#ifndef PROJECT_BASE_WEIGHTEDOIT_H
+#define PROJECT_BASE_WEIGHTEDOIT_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderWatcher.h>
+
+// Weighted blended order-independent transparency (McGuire and Bavoil). Translucent surfaces are drawn in any order
+// into an accumulation and a weight target, then one fullscreen pass blends their weighted average over the scene.
+// GL 3.3 has no per-target blend functions, so both targets share one: color adds up and alpha multiplies by
+// (1 - source alpha). That makes the accumulation alpha, cleared to 1, the revealage, and the weight target (red
+// only) a plain sum.
+// Overlapping translucency is fill-rate heavy, so the targets can be a half or quarter of the scene resolution,
+// tested against a depth buffer reduced to the same size; the composite then upsamples them depth-aware.
+class WeightedOIT {
+public:
+    // scene pixels per OIT target texel along each axis: 1, 2 or 4
+    int resolutionDivisor = 1;
+
+    explicit WeightedOIT(ShaderWatcher* watcher = nullptr)
+        : compositeShader("resources/shaders/fullscreen.vs", "resources/shaders/oit_composite.fs"),
+          upsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/oit_composite.fs", nullptr, {"UPSAMPLE"}),
+          depthDownsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/depth_downsample.fs") {
+        compositeShader.setOnLink([](Shader& s) {
+            s.setInt("accumulation", 0);
+            s.setInt("weight", 1);
+        });
+        upsampleShader.setOnLink([](Shader& s) {
+            s.setInt("accumulation", 0);
+            s.setInt("weight", 1);
+            s.setInt("sceneDepth", 2);
+            s.setInt("lowDepth", 3);
+        });
+        depthDownsampleShader.setOnLink([](Shader& s) { s.setInt("depth", 0); });
+        if (watcher)
+            for (Shader* shader : {&compositeShader, &upsampleShader, &depthDownsampleShader})
+                watcher->watch(*shader);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~WeightedOIT() {
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    WeightedOIT(const WeightedOIT&) = delete;
+    WeightedOIT& operator=(const WeightedOIT&) = delete;
+
+    // size of the OIT targets for a width x height scene
+    int targetSize(int size) const {
+        return (size + resolutionDivisor - 1) / resolutionDivisor;
+    }
+
+    // writes the farthest scene depth of every resolutionDivisor-sized block into the bound depth-only framebuffer
+    void downsampleDepth(GLuint sceneDepth) {
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_ALWAYS);
+        depthDownsampleShader.use();
+        depthDownsampleShader.setInt("factor", resolutionDivisor);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sceneDepth);
+        draw();
+        glDepthFunc(GL_LESS);
+    }
+
+    // clears the bound accumulation (attachment 0) and weight (attachment 1) targets and sets up blending; the
+    // scene depth is expected as the depth attachment, tested but not written
+    void begin() {
+        const GLfloat accumulationClear[] = {0.0f, 0.0f, 0.0f, 1.0f};
+        const GLfloat weightClear[] = {0.0f, 0.0f, 0.0f, 0.0f};
+        glClearBufferfv(GL_COLOR, 0, accumulationClear);
+        glClearBufferfv(GL_COLOR, 1, weightClear);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    void end() {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+    }
+
+    // blends the translucent layer over the bound scene color target
+    void composite(GLuint accumulation, GLuint weight) {
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        compositeShader.use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumulation);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, weight);
+        glActiveTexture(GL_TEXTURE0);
+        draw();
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // the same from reduced resolution targets, upsampled by comparing their depth to the scene depth; the planes
+    // are the ones of the projection both depths were rendered with
+    void compositeUpsampled(GLuint accumulation, GLuint weight, GLuint lowDepth, GLuint sceneDepth, float nearPlane,
+                            float farPlane) {
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        upsampleShader.use();
+        upsampleShader.setFloat("scale", 1.0f / resolutionDivisor);
+        upsampleShader.setFloat("nearPlane", nearPlane);
+        upsampleShader.setFloat("farPlane", farPlane);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumulation);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, weight);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, sceneDepth);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, lowDepth);
+        glActiveTexture(GL_TEXTURE0);
+        draw();
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    Shader compositeShader;
+    Shader upsampleShader;
+    Shader depthDownsampleShader;
+    GLuint emptyVAO;
+
+    void draw() {
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+    }
+};
+
+#endif //PROJECT_BASE_WEIGHTEDOIT_H
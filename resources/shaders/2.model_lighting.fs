@@ -1,151 +1,104 @@
 #version 330 core
-out vec4 FragColor;
-
-struct PointLight {
-    vec3 position;
-
-    vec3 specular;
-    vec3 diffuse;
-    vec3 ambient;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
+// compile-time variants, defined by ShaderPermutations:
+// BLINN          Blinn-Phong instead of Phong specular
+// HAS_SPECULAR   material has a specular map, otherwise the diffuse color doubles as specular mask
+// HAS_NORMALMAP  material has a tangent space normal map
+// ALPHA_TEST     diffuse texture has transparent texels that have to be discarded
+// PBR            glTF metallic-roughness material, an ORM texture holds occlusion, roughness and metallic
+// HAS_EMISSIVE   material has an emissive map, added on top of the lighting
+// TRANSLUCENT    blended surface, writes the weighted blended OIT targets instead of the scene color
+#ifdef TRANSLUCENT
+// premultiplied color times the weight in rgb; alpha is multiplied into the revealage by the blend state
+layout (location = 0) out vec4 Accumulation;
+layout (location = 1) out vec4 Weight;
+#else
+layout (location = 0) out vec4 FragColor;
+// screen-space motion since the last frame in texture coordinates, for TemporalAA
+layout (location = 1) out vec4 Velocity;
+#endif
+
+// the textures are layers of TextureStreamer's arrays, the layers come with the vertices, see Material
 struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_specular1;
+    sampler2DArray texture_diffuse1;
+#ifdef HAS_SPECULAR
+    sampler2DArray texture_specular1;
+#endif
+#ifdef HAS_NORMALMAP
+    sampler2DArray texture_normal1;
+#endif
+#ifdef PBR
+    sampler2DArray texture_orm1;
+#endif
+#ifdef HAS_EMISSIVE
+    sampler2DArray texture_emissive1;
+#endif
 
     float shininess;
 };
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
+#ifdef HAS_NORMALMAP
+in vec3 Tangent;
+#endif
+in vec4 CurrentClip;
+in vec4 PreviousClip;
+flat in ivec4 Layers;
+flat in int EmissiveLayer;
+flat in float Opacity;
 
-uniform DirLight dirLight;
-uniform PointLight pointLight;
 uniform Material material;
-uniform SpotLight spotLight;
-uniform bool blinn;
-
 uniform vec3 viewPosition;
-// calculates the color when using a point light.
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
+#include "lighting.glsl"
 
 void main()
 {
-
-    vec4 texColor = texture(material.texture_diffuse1, TexCoords);
+    // every material input is fetched exactly once, the lights only do math on it
+    vec4 texColor = texture(material.texture_diffuse1, vec3(TexCoords, Layers.x));
+#ifdef ALPHA_TEST
     if(texColor.a < 0.1){
         discard;
     }
-    vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
-    vec3 result = CalcPointLight(pointLight, normal, FragPos, viewDir);
-    result += CalcDirLight(dirLight, normal, viewDir);
-    result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
-    FragColor = vec4(result, texColor.a);
-}
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-
-    if(blinn){
-            vec3 halfwayDir = normalize(lightDir + viewDir);
-            spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-        }
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
-}
+#endif
+    Surface surface;
+    surface.albedo = texColor.rgb;
+#ifdef PBR
+    vec3 orm = texture(material.texture_orm1, vec3(TexCoords, Layers.w)).rgb;
+    surface.occlusion = orm.r;
+    // GGX falls apart at 0 roughness, keep a small highlight
+    surface.roughness = max(orm.g, 0.05);
+    surface.metallic = orm.b;
+    surface.specular = vec3(0.0);
+#elif defined(HAS_SPECULAR)
+    surface.specular = texture(material.texture_specular1, vec3(TexCoords, Layers.y)).rgb;
+#else
+    surface.specular = texColor.rgb;
+#endif
+    surface.shininess = material.shininess;
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
-{
-    vec3 lightDir = normalize(-light.direction);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    vec3 normal = normalize(Normal);
+#ifdef HAS_NORMALMAP
+    vec3 T = normalize(Tangent - dot(Tangent, normal) * normal);
+    mat3 TBN = mat3(T, cross(normal, T), normal);
+    normal = normalize(TBN * (texture(material.texture_normal1, vec3(TexCoords, Layers.z)).rgb * 2.0 - 1.0));
+#endif
+    surface.normal = normal;
 
-    if(blinn){
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    }
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 viewDir = normalize(viewPosition - FragPos);
+    vec3 color = CalcLighting(surface, FragPos, viewDir);
+#ifdef HAS_EMISSIVE
+    color += texture(material.texture_emissive1, vec3(TexCoords, EmissiveLayer)).rgb;
+#endif
+#ifdef TRANSLUCENT
+    float alpha = clamp(texColor.a * Opacity, 0.0, 1.0);
+    // nearer surfaces weigh more, the range is kept small enough for the 16-bit float targets
+    float distance = length(viewPosition - FragPos);
+    float weight = alpha * clamp(10.0 / (1e-5 + pow(distance / 5.0, 2.0) + pow(distance / 200.0, 6.0)), 1e-2, 3e2);
+    Accumulation = vec4(color * alpha * weight, alpha);
+    Weight = vec4(alpha * weight, 0.0, 0.0, 0.0);
+#else
+    FragColor = vec4(color, texColor.a);
+    Velocity = vec4((CurrentClip.xy / CurrentClip.w - PreviousClip.xy / PreviousClip.w) * 0.5, 0.0, 1.0);
+#endif
 }
-
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-
-    if(blinn){
-            vec3 halfwayDir = normalize(lightDir + viewDir);
-            spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-        }
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
-}
\ No newline at end of file
@@ -2,19 +2,49 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangent;
+// per instance, see DrawBatcher
+layout (location = 5) in mat4 model;
+layout (location = 9) in mat4 previousModel;
+// per draw, see Material: array layers of the diffuse, specular, normal and ORM textures, the emissive one, opacity
+layout (location = 13) in ivec4 materialLayers;
+layout (location = 14) in int emissiveLayer;
+layout (location = 15) in float materialOpacity;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+#ifdef HAS_NORMALMAP
+out vec3 Tangent;
+#endif
+// unjittered clip positions of this frame and the last, for the motion vectors
+out vec4 CurrentClip;
+out vec4 PreviousClip;
+flat out ivec4 Layers;
+flat out int EmissiveLayer;
+flat out float Opacity;
+
+// identical to depth.vs so the depth pre-pass matches bit for bit
+invariant gl_Position;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat4 currentViewProjection;
+uniform mat4 previousViewProjection;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    mat3 normalMatrix = mat3(transpose(inverse(model)));
+    Normal = normalMatrix * aNormal;
+#ifdef HAS_NORMALMAP
+    Tangent = normalMatrix * aTangent;
+#endif
     TexCoords = aTexCoords;    
+    Layers = materialLayers;
+    EmissiveLayer = emissiveLayer;
+    Opacity = materialOpacity;
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+    CurrentClip = currentViewProjection * vec4(FragPos, 1.0);
+    PreviousClip = previousViewProjection * previousModel * vec4(aPos, 1.0);
+}
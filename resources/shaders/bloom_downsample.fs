@@ -0,0 +1,39 @@
+#version 330 core
+// Dual filter downsample to half the source resolution: the center and the four diagonal neighbours one source
+// texel out, each a bilinear fetch of four texels.
+// PREFILTER  keep only the part of the color above the bloom threshold, for the first step from the HDR scene
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+// size of one source texel in texture coordinates
+uniform vec2 texelSize;
+#ifdef PREFILTER
+uniform float threshold;
+// width of the soft transition around the threshold
+uniform float knee;
+#endif
+
+vec3 Fetch(vec2 texCoords)
+{
+    vec3 color = texture(source, texCoords).rgb;
+#ifdef PREFILTER
+    float brightness = max(color.r, max(color.g, color.b));
+    // quadratic ramp from threshold - knee to threshold + knee, linear above it
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 1e-5);
+    color *= max(soft, brightness - threshold) / max(brightness, 1e-5);
+#endif
+    return color;
+}
+
+void main()
+{
+    vec3 sum = Fetch(TexCoords) * 4.0;
+    sum += Fetch(TexCoords + vec2(-1.0, -1.0) * texelSize);
+    sum += Fetch(TexCoords + vec2( 1.0, -1.0) * texelSize);
+    sum += Fetch(TexCoords + vec2(-1.0,  1.0) * texelSize);
+    sum += Fetch(TexCoords + vec2( 1.0,  1.0) * texelSize);
+    FragColor = vec4(sum / 8.0, 1.0);
+}
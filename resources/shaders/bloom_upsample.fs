@@ -0,0 +1,24 @@
+#version 330 core
+// Dual filter upsample to twice the source resolution: a tent of eight bilinear fetches around the pixel.
+// Blended additively onto the next larger level of the chain.
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+// size of one source texel in texture coordinates
+uniform vec2 texelSize;
+
+void main()
+{
+    vec2 h = texelSize * 0.5;
+    vec3 sum = texture(source, TexCoords + vec2(-2.0 * h.x, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(2.0 * h.x, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(0.0, -2.0 * h.y)).rgb;
+    sum += texture(source, TexCoords + vec2(0.0, 2.0 * h.y)).rgb;
+    sum += texture(source, TexCoords + vec2(-h.x, -h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2( h.x, -h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(-h.x,  h.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2( h.x,  h.y)).rgb * 2.0;
+    FragColor = vec4(sum / 12.0, 1.0);
+}
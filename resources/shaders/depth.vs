@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// must compute gl_Position exactly like the lighting shaders so the main pass can test with GL_EQUAL
+invariant gl_Position;
+
+// INSTANCED  the model matrix is a per-instance attribute like in the lighting shaders, see DrawBatcher
+#ifdef INSTANCED
+layout (location = 5) in mat4 model;
+#else
+uniform mat4 model;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+// Reduces the scene depth to a lower resolution target for the translucent pass, keeping the farthest depth of each
+// block so a translucent surface in front of any of the pixels it covers still gets drawn; the upsample sorts out
+// which of them it belongs to.
+uniform sampler2D depth;
+uniform int factor;
+
+void main()
+{
+    ivec2 maxTexel = textureSize(depth, 0) - 1;
+    ivec2 base = ivec2(gl_FragCoord.xy) * factor;
+    float farthest = 0.0;
+    for (int y = 0; y < factor; y++)
+        for (int x = 0; x < factor; x++)
+            farthest = max(farthest, texelFetch(depth, min(base + ivec2(x, y), maxTexel), 0).r);
+    gl_FragDepth = farthest;
+}
@@ -0,0 +1,53 @@
+#version 330 core
+// Exposure from the luminance histogram, adapted over time. Rendered into a 1x1 target that the tonemap pass
+// samples, so the value never travels to the CPU. Last frame's result comes in through previousExposure.
+#define BINS 64
+out vec4 FragColor;
+
+uniform sampler2D histogram;
+uniform sampler2D previousExposure;
+uniform float minLogLuminance;
+uniform float logRange;
+// fractions of the samples left out at the dark and at the bright end
+uniform float lowPercent;
+uniform float highPercent;
+// average luminance the exposure maps the scene to
+uniform float keyValue;
+uniform float minExposure;
+uniform float maxExposure;
+uniform float deltaTime;
+// adaptation rates per second towards a brighter and a darker exposure
+uniform float speedUp;
+uniform float speedDown;
+
+void main()
+{
+    float total = 0.0;
+    for (int i = 1; i < BINS; i++)
+        total += texelFetch(histogram, ivec2(i, 0), 0).r;
+
+    // average log luminance of the samples between the two percentiles, black excluded
+    float low = total * lowPercent, high = total * highPercent;
+    float seen = 0.0, weight = 0.0, logSum = 0.0;
+    for (int i = 1; i < BINS; i++)
+    {
+        float count = texelFetch(histogram, ivec2(i, 0), 0).r;
+        float used = max(min(seen + count, high) - max(seen, low), 0.0);
+        seen += count;
+        float logLuminance = minLogLuminance + (float(i - 1) + 0.5) / float(BINS - 2) * logRange;
+        logSum += used * logLuminance;
+        weight += used;
+    }
+
+    float previous = texelFetch(previousExposure, ivec2(0, 0), 0).r;
+    if (weight <= 0.0)
+    {
+        FragColor = vec4(previous);
+        return;
+    }
+    float target = clamp(keyValue / exp2(logSum / weight), minExposure, maxExposure);
+    // exponential approach in log space, so brightening and darkening feel alike
+    float speed = target > previous ? speedUp : speedDown;
+    float exposure = exp2(mix(log2(previous), log2(target), 1.0 - exp(-deltaTime * speed)));
+    FragColor = vec4(exposure);
+}
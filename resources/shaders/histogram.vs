@@ -0,0 +1,23 @@
+#version 330 core
+// Luminance histogram without compute shaders: one point per sample of the scene, drawn with
+// glDrawArrays(GL_POINTS, 0, sampleGrid.x * sampleGrid.y). Each point lands on the pixel of its bin in a
+// BINS x 1 target, where additive blending counts it.
+#define BINS 64
+
+uniform sampler2D scene;
+// samples across and down the screen
+uniform ivec2 sampleGrid;
+uniform float minLogLuminance;
+uniform float inverseLogRange;
+
+void main()
+{
+    ivec2 cell = ivec2(gl_VertexID % sampleGrid.x, gl_VertexID / sampleGrid.x);
+    vec3 color = textureLod(scene, (vec2(cell) + 0.5) / vec2(sampleGrid), 0.0).rgb;
+    float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+    // bin 0 holds black, the rest spread log2 luminance over [minLogLuminance, minLogLuminance + range]
+    float bin = 0.0;
+    if (luminance > 1e-4)
+        bin = 1.0 + clamp((log2(luminance) - minLogLuminance) * inverseLogRange, 0.0, 1.0) * float(BINS - 2);
+    gl_Position = vec4((floor(bin) + 0.5) / float(BINS) * 2.0 - 1.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,373 @@
+// Lighting shared by the forward shaders, pulled in with #include "lighting.glsl".
+// The caller fetches its material textures once into a Surface, CalcLighting then loops over the lights
+// without touching a material texture again. Point lights are clustered, see rg/ClusteredLights.h: only the
+// lights binned into the fragment's cluster are evaluated.
+// BLINN    Blinn-Phong instead of Phong specular
+// SHADOWS  cascaded shadow maps for the directional light, see rg/CascadedShadows.h, and shadow atlas tiles
+//          for the point and spot lights that have one, see rg/ShadowAtlas.h
+// AMBIENT_OCCLUSION  the ambient terms are scaled by the screen-space occlusion, see rg/AmbientOcclusion.h
+// IBL      the sun's flat ambient term is replaced by light from the skybox, see rg/EnvironmentLighting.h
+// PBR      metallic-roughness GGX instead of Phong, for the glTF materials with an ORM texture
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    // first atlas tile, -1 without a shadow
+    int shadowTile;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    int shadowTile;
+};
+
+struct Surface {
+    vec3 albedo;
+    vec3 specular;
+    vec3 normal;
+    float shininess;
+#ifdef PBR
+    float metallic;
+    float roughness;
+    float occlusion;
+#endif
+};
+
+#ifndef MAX_SPOT_LIGHTS
+#define MAX_SPOT_LIGHTS 2
+#endif
+
+#ifdef AMBIENT_OCCLUSION
+uniform sampler2D ambientOcclusion;
+#endif
+// what reaches the fragment of the ambient light, CalcLighting fetches it once for all lights
+float ambientVisibility = 1.0;
+
+#ifdef IBL
+// irradiance / pi of the environment as L2 spherical harmonics, the basis constants already folded in
+uniform vec3 environmentSH[9];
+// GGX-prefiltered skybox, roughness goes from 0 at level 0 to 1 at environmentMaxLod
+uniform samplerCube environmentMap;
+// split-sum scale and bias on F0 by n.v and roughness
+uniform sampler2D environmentBrdf;
+uniform float environmentMaxLod;
+uniform float environmentIntensity;
+#endif
+
+uniform DirLight dirLight;
+uniform SpotLight spotLights[MAX_SPOT_LIGHTS];
+uniform int spotLightCount;
+
+// five texels per light: position/range, ambient/constant, diffuse/linear, specular/quadratic, shadow tile
+uniform samplerBuffer clusterLights;
+// (offset, count) into clusterLightIndices for every cluster
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+// where this frame's lights, grid and index list start in the buffers, in texels
+uniform ivec3 clusterBase;
+uniform uvec3 clusterDims;
+// clusters per pixel in x and y
+uniform vec2 clusterTileScale;
+uniform float clusterNear;
+uniform float clusterFar;
+
+#ifdef SHADOWS
+#define SHADOW_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+// world to shadow map texture coordinates and depth, per cascade
+uniform mat4 shadowMatrices[SHADOW_CASCADES];
+// view depth where each cascade ends
+uniform float cascadeSplits[SHADOW_CASCADES];
+
+#define MAX_ATLAS_TILES 24
+uniform sampler2DShadow shadowAtlas;
+// world to atlas texture coordinates and depth of every tile, before the perspective divide
+uniform mat4 atlasMatrices[MAX_ATLAS_TILES];
+// texture space rectangle of every tile, shrunk so filter taps don't reach into a neighbour
+uniform vec4 atlasRects[MAX_ATLAS_TILES];
+#endif
+
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir, float shininess)
+{
+#ifdef BLINN
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    return pow(max(dot(normal, halfwayDir), 0.0), shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+#endif
+}
+
+#ifdef PBR
+// Cook-Torrance with a GGX distribution, Smith-Schlick visibility and Schlick Fresnel
+vec3 CalcBRDF(Surface surface, vec3 lightDir, vec3 viewDir)
+{
+    vec3 n = surface.normal;
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float NdotL = max(dot(n, lightDir), 0.0);
+    float NdotV = max(dot(n, viewDir), 1e-4);
+    float NdotH = max(dot(n, halfwayDir), 0.0);
+    float alpha = surface.roughness * surface.roughness;
+    float alpha2 = alpha * alpha;
+    float denominator = NdotH * NdotH * (alpha2 - 1.0) + 1.0;
+    float distribution = alpha2 / (3.14159265 * denominator * denominator);
+    float k = (surface.roughness + 1.0) * (surface.roughness + 1.0) / 8.0;
+    float visibility = 1.0 / (4.0 * (NdotL * (1.0 - k) + k) * (NdotV * (1.0 - k) + k));
+    vec3 F0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+    vec3 fresnel = F0 + (1.0 - F0) * pow(1.0 - max(dot(halfwayDir, viewDir), 0.0), 5.0);
+    // the lights are in Phong units, a white diffuse surface facing them reflects their diffuse color,
+    // so the BRDF is scaled by pi
+    vec3 diffuse = (1.0 - fresnel) * (1.0 - surface.metallic) * surface.albedo;
+    return (diffuse + 3.14159265 * fresnel * distribution * visibility) * NdotL;
+}
+#endif
+
+// the albedo the ambient terms light, metals have none
+vec3 DiffuseAlbedo(Surface surface)
+{
+#ifdef PBR
+    return surface.albedo * (1.0 - surface.metallic);
+#else
+    return surface.albedo;
+#endif
+}
+
+// diffuse and specular reflection of one light, without ambient, attenuation or shadow
+vec3 CalcDirect(Surface surface, vec3 lightDir, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+#ifdef PBR
+    // a single light color, the Phong split into diffuse and specular has no meaning here
+    return diffuseColor * CalcBRDF(surface, lightDir, viewDir);
+#else
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, surface.normal, viewDir, surface.shininess);
+    return diffuseColor * diff * surface.albedo + specularColor * spec * surface.specular;
+#endif
+}
+
+float CalcAttenuation(float constant, float linear, float quadratic, float distance)
+{
+    return 1.0 / (constant + linear * distance + quadratic * (distance * distance));
+}
+
+// distance of the fragment in front of the camera, from its window depth
+float ViewDepth()
+{
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    return 2.0 * clusterNear * clusterFar / (clusterFar + clusterNear - ndcDepth * (clusterFar - clusterNear));
+}
+
+// 1 where the directional light reaches the fragment, 0 in shadow
+float CalcShadow(vec3 fragPos)
+{
+#ifdef SHADOWS
+    float depth = ViewDepth();
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES && depth > cascadeSplits[cascade])
+        cascade++;
+    if (cascade == SHADOW_CASCADES)
+        return 1.0;
+    vec4 position = shadowMatrices[cascade] * vec4(fragPos, 1.0);
+    // past the fitted depth range, lit like everything outside the map
+    if (position.z > 1.0)
+        return 1.0;
+    // four bilinear compares, 4x4 texels of filtering
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    lit += texture(shadowMap, vec4(position.xy + vec2(-0.75, -0.75) * texel, float(cascade), position.z));
+    lit += texture(shadowMap, vec4(position.xy + vec2( 0.75, -0.75) * texel, float(cascade), position.z));
+    lit += texture(shadowMap, vec4(position.xy + vec2(-0.75,  0.75) * texel, float(cascade), position.z));
+    lit += texture(shadowMap, vec4(position.xy + vec2( 0.75,  0.75) * texel, float(cascade), position.z));
+    return lit * 0.25;
+#else
+    return 1.0;
+#endif
+}
+
+// 1 where a point or spot light reaches the fragment, 0 in shadow. A point light has six tiles starting at
+// tile, one per cube face in the order +x, -x, +y, -y, +z, -z
+float CalcLocalShadow(int tile, vec3 lightPos, vec3 fragPos, bool isPoint)
+{
+#ifdef SHADOWS
+    if (tile < 0)
+        return 1.0;
+    if (isPoint)
+    {
+        vec3 toFrag = fragPos - lightPos;
+        vec3 axis = abs(toFrag);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            tile += toFrag.x > 0.0 ? 0 : 1;
+        else if (axis.y >= axis.z)
+            tile += toFrag.y > 0.0 ? 2 : 3;
+        else
+            tile += toFrag.z > 0.0 ? 4 : 5;
+    }
+    vec4 position = atlasMatrices[tile] * vec4(fragPos, 1.0);
+    position.xyz /= position.w;
+    vec4 rect = atlasRects[tile];
+    vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    float lit = 0.0;
+    lit += texture(shadowAtlas, vec3(clamp(position.xy + vec2(-0.75, -0.75) * texel, rect.xy, rect.zw), position.z));
+    lit += texture(shadowAtlas, vec3(clamp(position.xy + vec2( 0.75, -0.75) * texel, rect.xy, rect.zw), position.z));
+    lit += texture(shadowAtlas, vec3(clamp(position.xy + vec2(-0.75,  0.75) * texel, rect.xy, rect.zw), position.z));
+    lit += texture(shadowAtlas, vec3(clamp(position.xy + vec2( 0.75,  0.75) * texel, rect.xy, rect.zw), position.z));
+    return lit * 0.25;
+#else
+    return 1.0;
+#endif
+}
+
+// calculates the color when using a directional light.
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+#ifdef IBL
+    // CalcEnvironment stands in for the sky's ambient light
+    vec3 ambient = vec3(0.0);
+#else
+    vec3 ambient = ambientVisibility * light.ambient;
+#endif
+    return ambient * DiffuseAlbedo(surface) + shadow * CalcDirect(surface, lightDir, viewDir, light.diffuse, light.specular);
+}
+
+#ifdef IBL
+// diffuse light from the spherical harmonics and a specular reflection of the skybox. The Phong exponent maps to
+// a roughness, the specular map masks a dielectric F0; PBR surfaces have both
+vec3 CalcEnvironment(Surface surface, vec3 viewDir)
+{
+    vec3 n = surface.normal;
+    vec3 irradiance = environmentSH[0]
+        + environmentSH[1] * n.y + environmentSH[2] * n.z + environmentSH[3] * n.x
+        + environmentSH[4] * (n.x * n.y) + environmentSH[5] * (n.y * n.z) + environmentSH[6] * (3.0 * n.z * n.z - 1.0)
+        + environmentSH[7] * (n.x * n.z) + environmentSH[8] * (n.x * n.x - n.y * n.y);
+#ifdef PBR
+    float roughness = surface.roughness;
+    vec3 F0 = mix(vec3(0.04), surface.albedo, surface.metallic);
+#else
+    float roughness = sqrt(2.0 / (surface.shininess + 2.0));
+    vec3 F0 = 0.04 * surface.specular;
+#endif
+    vec3 reflected = textureLod(environmentMap, reflect(-viewDir, n), roughness * environmentMaxLod).rgb;
+    vec2 brdf = texture(environmentBrdf, vec2(max(dot(n, viewDir), 0.0), roughness)).rg;
+#ifdef PBR
+    vec3 specular = F0 * brdf.x + brdf.y;
+#else
+    vec3 specular = surface.specular * (0.04 * brdf.x + brdf.y);
+#endif
+    vec3 color = max(irradiance, 0.0) * DiffuseAlbedo(surface) + reflected * specular;
+    return environmentIntensity * ambientVisibility * color;
+}
+#endif
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float attenuation = CalcAttenuation(light.constant, light.linear, light.quadratic, length(light.position - fragPos));
+    float shadow = CalcLocalShadow(light.shadowTile, light.position, fragPos, true);
+    vec3 color = ambientVisibility * light.ambient * DiffuseAlbedo(surface)
+        + shadow * CalcDirect(surface, lightDir, viewDir, light.diffuse, light.specular);
+    return color * attenuation;
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float attenuation = CalcAttenuation(light.constant, light.linear, light.quadratic, length(light.position - fragPos));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    float shadow = CalcLocalShadow(light.shadowTile, light.position, fragPos, false);
+    vec3 color = ambientVisibility * light.ambient * DiffuseAlbedo(surface)
+        + shadow * CalcDirect(surface, lightDir, viewDir, light.diffuse, light.specular);
+    return color * (attenuation * intensity);
+}
+
+// index of the cluster this fragment falls into, the same exponential depth slicing as ClusteredLights
+int ClusterIndex()
+{
+    float slice = log(ViewDepth() / clusterNear) / log(clusterFar / clusterNear) * float(clusterDims.z);
+    uvec3 cluster = min(uvec3(uvec2(gl_FragCoord.xy * clusterTileScale), uint(max(slice, 0.0))), clusterDims - 1u);
+    return int(cluster.x + clusterDims.x * (cluster.y + clusterDims.y * cluster.z));
+}
+
+vec3 CalcClusteredPointLights(Surface surface, vec3 fragPos, vec3 viewDir)
+{
+    vec3 result = vec3(0.0);
+    uvec2 cluster = texelFetch(clusterGrid, clusterBase.y + ClusterIndex()).xy;
+    for (uint i = 0u; i < cluster.y; ++i)
+    {
+        int index = clusterBase.x + int(texelFetch(clusterLightIndices, clusterBase.z + int(cluster.x + i)).r) * 5;
+        vec4 positionRange = texelFetch(clusterLights, index);
+        // the binning treats the light as a sphere of this radius, cut it off there everywhere so
+        // cluster borders don't show
+        if (distance(positionRange.xyz, fragPos) > positionRange.w)
+            continue;
+        vec4 ambientConstant = texelFetch(clusterLights, index + 1);
+        vec4 diffuseLinear = texelFetch(clusterLights, index + 2);
+        vec4 specularQuadratic = texelFetch(clusterLights, index + 3);
+        PointLight light;
+        light.position = positionRange.xyz;
+        light.ambient = ambientConstant.rgb;
+        light.constant = ambientConstant.a;
+        light.diffuse = diffuseLinear.rgb;
+        light.linear = diffuseLinear.a;
+        light.specular = specularQuadratic.rgb;
+        light.quadratic = specularQuadratic.a;
+#ifdef SHADOWS
+        light.shadowTile = int(texelFetch(clusterLights, index + 4).r);
+#else
+        light.shadowTile = -1;
+#endif
+        result += CalcPointLight(light, surface, fragPos, viewDir);
+    }
+    return result;
+}
+
+vec3 CalcLighting(Surface surface, vec3 fragPos, vec3 viewDir)
+{
+#ifdef AMBIENT_OCCLUSION
+    ambientVisibility = texelFetch(ambientOcclusion, ivec2(gl_FragCoord.xy), 0).r;
+#endif
+#ifdef PBR
+    ambientVisibility *= surface.occlusion;
+#endif
+    vec3 result = CalcDirLight(dirLight, surface, viewDir, CalcShadow(fragPos));
+#ifdef IBL
+    result += CalcEnvironment(surface, viewDir);
+#endif
+    result += CalcClusteredPointLights(surface, fragPos, viewDir);
+    for (int i = 0; i < spotLightCount; ++i)
+        result += CalcSpotLight(spotLights[i], surface, fragPos, viewDir);
+    return result;
+}
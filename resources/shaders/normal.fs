@@ -1,90 +1,95 @@
 #version 330 core
+// compile-time variants, defined by ShaderPermutations:
+// BLINN           Blinn-Phong instead of Phong specular
+// PARALLAX_STEPS  maximum number of parallax occlusion layers, a quarter of it is used at normal incidence
+// CONE_STEP       cone-step mapping on the packed relief map from tools/bake_cone_map instead of the layer march
+// FETCH_HEATMAP   output the number of height fetches instead of the lit color, see main.cpp
+// DEPTH_ONLY      stop after the parallax discard, for the depth pre-pass
+#ifndef PARALLAX_STEPS
+#define PARALLAX_STEPS 32
+#endif
+#ifndef CONE_STEPS
+#define CONE_STEPS 12
+#endif
 layout (location = 0) out vec4 FragColor;
-layout (location = 1) out vec4 BrightColor;
+// screen-space motion since the last frame in texture coordinates, for TemporalAA
+layout (location = 1) out vec4 Velocity;
 
 in vec3 FragPos;
 in vec2 TexCoords;
 in vec3 TangentViewPos;
 in vec3 TangentFragPos;
-
-struct PointLight {
-    vec3 position;
-
-    vec3 specular;
-    vec3 diffuse;
-    vec3 ambient;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
+in mat3 WorldTBN;
+in vec4 CurrentClip;
+in vec4 PreviousClip;
 
 uniform sampler2D diffuseMap;
+#ifdef CONE_STEP
+// rg: tangent-space normal xy, b: sqrt of the cone ratio, a: depth
+uniform sampler2D reliefMap;
+#else
 uniform sampler2D normalMap;
 uniform sampler2D depthMap;
+#endif
 
-
-uniform vec3 lightPos;
 uniform vec3 viewPos;
 
-uniform DirLight dirLight;
-uniform PointLight pointLight;
-uniform SpotLight spotLight;
-uniform bool blinn;
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-
 uniform float heightScale;
+// parallax fades out towards this distance from the camera, past it the ground is plain normal mapped
+uniform float parallaxFadeDistance;
+
+#include "lighting.glsl"
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+#ifdef CONE_STEP
+// Steps along the view ray by the largest distance that stays inside the empty cone above the current texel,
+// so it never skips past the surface and takes big steps over open space.
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float scale, vec2 dx, vec2 dy, inout int fetches)
+{
+    // the ray in (uv, depth) space; uv moves by P over the full depth range, like the layer march below
+    vec2 P = viewDir.xy * scale;
+    float lengthP = length(P);
+    float rayDepth = 0.0;
+    vec2 currentTexCoords = texCoords;
+    for (int i = 0; i < CONE_STEPS; i++)
+    {
+        vec4 relief = textureGrad(reliefMap, currentTexCoords, dx, dy);
+        fetches++;
+        float height = relief.a - rayDepth;
+        if (height < 0.002)
+            break;
+        float coneRatio = relief.b * relief.b;
+        rayDepth += coneRatio * height / (lengthP + coneRatio + 1e-5);
+        currentTexCoords = texCoords - P * rayDepth;
+    }
+    return currentTexCoords;
+}
+#else
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float scale, vec2 dx, vec2 dy, inout int fetches)
 {
     // number of depth layers
-    const float minLayers = 8;
-    const float maxLayers = 32;
+    const float minLayers = float(max(PARALLAX_STEPS / 4, 1));
+    const float maxLayers = float(PARALLAX_STEPS);
     float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
     // calculate the size of each layer
     float layerDepth = 1.0 / numLayers;
     // depth of current layer
     float currentLayerDepth = 0.0;
     // the amount to shift the texture coordinates per layer (from vector P)
-    vec2 P = viewDir.xy * heightScale;
+    vec2 P = viewDir.xy * scale;
     vec2 deltaTexCoords = P / numLayers;
 
     // get initial values
     vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(depthMap, currentTexCoords).r;
+    float currentDepthMapValue = textureGrad(depthMap, currentTexCoords, dx, dy).r;
+    fetches++;
 
     while(currentLayerDepth < currentDepthMapValue)
     {
         // shift texture coordinates along direction of P
         currentTexCoords -= deltaTexCoords;
         // get depthmap value at current texture coordinates
-        currentDepthMapValue = texture(depthMap, currentTexCoords).r;
+        currentDepthMapValue = textureGrad(depthMap, currentTexCoords, dx, dy).r;
+        fetches++;
         // get depth of next layer
         currentLayerDepth += layerDepth;
     }
@@ -94,7 +99,8 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
     // get depth after and before collision for linear interpolation
     float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(depthMap, prevTexCoords).r - currentLayerDepth + layerDepth;
+    float beforeDepth = textureGrad(depthMap, prevTexCoords, dx, dy).r - currentLayerDepth + layerDepth;
+    fetches++;
 
     // interpolation of texture coordinates
     float weight = afterDepth / (afterDepth - beforeDepth);
@@ -102,110 +108,52 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
     return finalTexCoords;
 }
+#endif
 
 void main()
 {
-    vec3 viewDir = normalize(TangentViewPos - TangentFragPos);
+    // the parallax march runs in tangent space, the lighting in world space
+    vec3 tangentViewDir = normalize(TangentViewPos - TangentFragPos);
     vec2 texCoords = TexCoords;
 
-    texCoords = ParallaxMapping(TexCoords,  viewDir);
+    // fade the parallax out with distance, far away it costs the same and nobody can see it
+    float scale = heightScale * (1.0 - smoothstep(0.75 * parallaxFadeDistance, parallaxFadeDistance, length(viewPos - FragPos)));
+    int fetches = 0;
+    // the march branches per fragment, so its fetches use gradients taken out here in uniform control flow
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    Velocity = vec4((CurrentClip.xy / CurrentClip.w - PreviousClip.xy / PreviousClip.w) * 0.5, 0.0, 1.0);
+    if (scale > 0.0)
+    {
+        texCoords = ParallaxMapping(TexCoords, tangentViewDir, scale, dx, dy, fetches);
         if(texCoords.x > 1.0 || texCoords.y > 1.0 || texCoords.x < -1.0 || texCoords.y < -1.0)
             discard;
-
+    }
+#ifdef DEPTH_ONLY
+    // the lit pass tests GL_EQUAL against this depth, so the pre-pass has to discard the same fragments
+    return;
+#endif
+
+#ifdef FETCH_HEATMAP
+    // r: readable ramp, g: count / 64 for the readback in main.cpp, exact in the 11-bit float channel up to 127, b: marks ground pixels
+    FragColor = vec4(min(float(fetches) / 32.0, 1.0), float(fetches) / 64.0, 1.0, 1.0);
+#else
+    Surface surface;
+    surface.albedo = texture(diffuseMap, texCoords).rgb;
+    surface.specular = vec3(1.0);
+    surface.shininess = 32.0;
+#ifdef CONE_STEP
+    // the normal is packed as xy only
+    vec2 normalXY = texture(reliefMap, texCoords).rg * 2.0 - 1.0;
+    vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
+#else
     // obtain normal from normal map in range [0,1]
     vec3 normal = texture(normalMap, texCoords).rgb;
     // transform normal vector to range [-1,1]
-    normal = normalize(normal * 2.0 - 1.0);  // this normal is in tangent space
+    normal = normal * 2.0 - 1.0;  // this normal is in tangent space
+#endif
+    surface.normal = normalize(WorldTBN * normal);
 
-//     vec3 specular = vec3(0.2) * spec;
-    vec3 results = CalcDirLight(dirLight, normal, viewDir);
-    results += CalcSpotLight(spotLight, normal, FragPos, viewDir);
-    results += CalcPointLight(pointLight, normal, FragPos, viewDir);
-
-
-   FragColor = vec4(results, 1.0);
-}
-
-
-// calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
-{
-    vec3 lightDir = normalize(-light.direction);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0f);
-
-    if(blinn){
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0f);
-    }
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(diffuseMap, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, TexCoords));
-    vec3 specular = light.specular * spec;
-    return (ambient + diffuse + specular);
-}
-
-// calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0f);
-
-    if(blinn){
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0f);
-    }
-
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // combine results
-
-
-    vec3 ambient = light.ambient * vec3(texture(diffuseMap, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, TexCoords));
-    vec3 specular = light.specular * spec;
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
+    FragColor = vec4(CalcLighting(surface, FragPos, normalize(viewPos - FragPos)), 1.0);
+#endif
 }
-
-// calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0f);
-
-    if(blinn){
-           vec3 halfwayDir = normalize(lightDir + viewDir);
-           spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0f);
-    }
-
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(diffuseMap, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, TexCoords));
-    vec3 specular = light.specular * spec;
-    ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
-}
\ No newline at end of file
@@ -9,11 +9,22 @@ out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 TangentViewPos;
 out vec3 TangentFragPos;
+// tangent to world, the lighting runs in world space like the models'
+out mat3 WorldTBN;
+// unjittered clip positions of this frame and the last, for the motion vectors
+out vec4 CurrentClip;
+out vec4 PreviousClip;
+
+// identical to depth.vs so the depth pre-pass matches bit for bit
+invariant gl_Position;
 
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
 uniform vec3 viewPos;
+uniform mat4 previousModel;
+uniform mat4 currentViewProjection;
+uniform mat4 previousViewProjection;
 
 void main()
 {
@@ -26,10 +37,13 @@ void main()
     T = normalize(T - dot(T, N) * N);
     vec3 B = cross(N, T);
 
-    mat3 TBN = transpose(mat3(T, B, N));
+    WorldTBN = mat3(T, B, N);
+    mat3 TBN = transpose(WorldTBN);
 
     TangentViewPos  = TBN * viewPos;
     TangentFragPos  = TBN * FragPos;
 
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+    CurrentClip = currentViewProjection * vec4(FragPos, 1.0);
+    PreviousClip = previousViewProjection * previousModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
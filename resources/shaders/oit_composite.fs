@@ -0,0 +1,70 @@
+#version 330 core
+// Resolves weighted blended order-independent transparency over the opaque scene: the weighted average color of
+// all translucent fragments, covering as much of the scene as the product of their (1 - alpha) leaves uncovered.
+// UPSAMPLE  the OIT targets are at a lower resolution than the scene. Where the four nearest low resolution texels
+//           lie at about the depth of the pixel they are filtered bilinearly, across a depth edge the one nearest in
+//           depth is taken alone so translucency doesn't bleed over foreground geometry.
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform sampler2D weight;
+#ifdef UPSAMPLE
+uniform sampler2D sceneDepth;
+uniform sampler2D lowDepth;
+// low resolution texels per scene pixel
+uniform float scale;
+uniform float nearPlane;
+uniform float farPlane;
+
+// relative depth difference up to which low resolution texels count as the same surface
+const float DEPTH_TOLERANCE = 0.1;
+
+float LinearDepth(float depth)
+{
+    float z = depth * 2.0 - 1.0;
+    return 2.0 * nearPlane * farPlane / (farPlane + nearPlane - z * (farPlane - nearPlane));
+}
+#endif
+
+void main()
+{
+#ifdef UPSAMPLE
+    float depth = LinearDepth(texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r);
+    vec2 position = gl_FragCoord.xy * scale - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+    ivec2 maxTexel = textureSize(accumulation, 0) - 1;
+    vec4 accum = vec4(0.0);
+    float totalWeight = 0.0;
+    ivec2 nearest = clamp(base, ivec2(0), maxTexel);
+    float nearestError = 1e30;
+    bool continuous = true;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), maxTexel);
+        float error = abs(LinearDepth(texelFetch(lowDepth, texel, 0).r) - depth);
+        if (error < nearestError) {
+            nearestError = error;
+            nearest = texel;
+        }
+        continuous = continuous && error < DEPTH_TOLERANCE * depth;
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float w = bilinear.x * bilinear.y;
+        accum += w * texelFetch(accumulation, texel, 0);
+        totalWeight += w * texelFetch(weight, texel, 0).r;
+    }
+    if (!continuous) {
+        accum = texelFetch(accumulation, nearest, 0);
+        totalWeight = texelFetch(weight, nearest, 0).r;
+    }
+#else
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accumulation, texel, 0);
+    float totalWeight = texelFetch(weight, texel, 0).r;
+#endif
+    // accum.a holds the revealage, the fraction of the background still visible
+    float revealage = accum.a;
+    if (revealage >= 1.0)
+        discard;
+    FragColor = vec4(accum.rgb / max(totalWeight, 1e-5), 1.0 - revealage);
+}
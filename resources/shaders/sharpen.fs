@@ -0,0 +1,29 @@
+#version 330 core
+// Contrast-adaptive sharpening of the upscaled image: subtracts a weighted cross of neighbours, with the weight
+// limited per pixel so the result can't leave the range of the neighbourhood.
+out vec4 FragColor;
+
+uniform sampler2D source;
+// 0 to 1
+uniform float sharpness;
+
+void main()
+{
+    ivec2 size = textureSize(source, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec3 center = texelFetch(source, texel, 0).rgb;
+    vec3 up = texelFetch(source, clamp(texel + ivec2(0, 1), ivec2(0), size - 1), 0).rgb;
+    vec3 down = texelFetch(source, clamp(texel - ivec2(0, 1), ivec2(0), size - 1), 0).rgb;
+    vec3 left = texelFetch(source, clamp(texel - ivec2(1, 0), ivec2(0), size - 1), 0).rgb;
+    vec3 right = texelFetch(source, clamp(texel + ivec2(1, 0), ivec2(0), size - 1), 0).rgb;
+
+    vec3 minColor = min(min(up, down), min(left, right));
+    vec3 maxColor = max(max(up, down), max(left, right));
+    // the most negative lobe that keeps the result within [0, 1] given the neighbourhood
+    vec3 hitMin = minColor / max(4.0 * maxColor, vec3(1e-5));
+    vec3 hitMax = (1.0 - maxColor) / min(4.0 * minColor - 4.0, vec3(-1e-5));
+    vec3 lobes = max(-hitMin, hitMax);
+    float lobe = max(-0.1875, min(max(lobes.r, max(lobes.g, lobes.b)), 0.0)) * sharpness;
+
+    FragColor = vec4((lobe * (up + down + left + right) + center) / (4.0 * lobe + 1.0), 1.0);
+}
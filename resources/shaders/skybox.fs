@@ -1,11 +1,16 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// screen-space motion since the last frame in texture coordinates, for TemporalAA
+layout (location = 1) out vec4 Velocity;
 
 in vec3 TexCoords;
+in vec4 CurrentClip;
+in vec4 PreviousClip;
 
 uniform samplerCube skybox;
 
 void main()
 {
     FragColor = texture(skybox, TexCoords);
-}
\ No newline at end of file
+    Velocity = vec4((CurrentClip.xy / CurrentClip.w - PreviousClip.xy / PreviousClip.w) * 0.5, 0.0, 1.0);
+}
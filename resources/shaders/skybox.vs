@@ -2,13 +2,21 @@
 layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
+// unjittered clip positions of this frame and the last, for the motion vectors
+out vec4 CurrentClip;
+out vec4 PreviousClip;
 
 uniform mat4 projection;
 uniform mat4 view;
+// both without the camera translation, like view
+uniform mat4 currentViewProjection;
+uniform mat4 previousViewProjection;
 
 void main()
 {
     TexCoords = aPos;
     vec4 pos = projection * view * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
-}
\ No newline at end of file
+    CurrentClip = currentViewProjection * vec4(aPos, 1.0);
+    PreviousClip = previousViewProjection * vec4(aPos, 1.0);
+}
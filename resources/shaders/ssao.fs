@@ -0,0 +1,66 @@
+#version 330 core
+// Screen-space ambient occlusion at half resolution. The view-space position and normal come from the depth buffer
+// of the pre-pass, the normal from the neighbouring texels on the side with the smaller depth step so it doesn't
+// bend around silhouettes. The hemisphere kernel is turned by one of 16 angles picked by the pixel's place in a
+// 4x4 block, interleaved sampling that the 4x4-wide blur afterwards averages out.
+// Writes the occlusion to r (1 unoccluded) and the linear view depth to g for the bilateral blur and upsample.
+out vec2 Result;
+
+uniform sampler2D depth;
+uniform mat4 projection;
+uniform mat4 inverseProjection;
+uniform vec3 kernel[16];
+uniform int sampleCount;
+uniform float radius;
+uniform float bias;
+uniform float intensity;
+
+vec3 ViewPosition(ivec2 texel)
+{
+    vec2 size = vec2(textureSize(depth, 0));
+    vec4 ndc = vec4((vec2(texel) + 0.5) / size * 2.0 - 1.0, texelFetch(depth, texel, 0).r * 2.0 - 1.0, 1.0);
+    vec4 position = inverseProjection * ndc;
+    return position.xyz / position.w;
+}
+
+void main()
+{
+    ivec2 maxTexel = textureSize(depth, 0) - 1;
+    ivec2 texel = min(ivec2(gl_FragCoord.xy) * 2, maxTexel);
+    if (texelFetch(depth, texel, 0).r >= 1.0) {
+        Result = vec2(1.0, 1e4);
+        return;
+    }
+    vec3 position = ViewPosition(texel);
+    vec3 right = ViewPosition(min(texel + ivec2(1, 0), maxTexel)) - position;
+    vec3 left = position - ViewPosition(max(texel - ivec2(1, 0), ivec2(0)));
+    vec3 up = ViewPosition(min(texel + ivec2(0, 1), maxTexel)) - position;
+    vec3 down = position - ViewPosition(max(texel - ivec2(0, 1), ivec2(0)));
+    vec3 dx = abs(right.z) < abs(left.z) ? right : left;
+    vec3 dy = abs(up.z) < abs(down.z) ? up : down;
+    vec3 normal = normalize(cross(dx, dy));
+
+    // 4x4 Bayer order, so neighbouring pixels get angles far apart
+    const float BAYER[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float angle = BAYER[cell.y * 4 + cell.x] * (6.2831853 / 16.0);
+    vec3 randomVec = vec3(cos(angle), sin(angle), 0.0);
+    vec3 tangent = randomVec - normal * dot(randomVec, normal);
+    // a normal facing straight along the random vector can't use it
+    tangent = dot(tangent, tangent) > 1e-4 ? normalize(tangent) : normalize(cross(normal, vec3(0.0, 0.0, 1.0)));
+    mat3 TBN = mat3(tangent, cross(normal, tangent), normal);
+
+    float occlusion = 0.0;
+    for (int i = 0; i < sampleCount; i++) {
+        vec3 samplePosition = position + TBN * kernel[i] * radius;
+        vec4 clip = projection * vec4(samplePosition, 1.0);
+        vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+        if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+            continue;
+        float sceneZ = ViewPosition(min(ivec2(uv * vec2(maxTexel + 1)), maxTexel)).z;
+        // occluders farther away than the radius don't count, faded in so the cut doesn't show
+        float range = smoothstep(0.0, 1.0, radius / abs(position.z - sceneZ));
+        occlusion += (sceneZ >= samplePosition.z + bias ? 1.0 : 0.0) * range;
+    }
+    Result = vec2(pow(1.0 - occlusion / float(sampleCount), intensity), -position.z);
+}
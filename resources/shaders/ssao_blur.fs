@@ -0,0 +1,28 @@
+#version 330 core
+// One direction of the separable bilateral blur of the half resolution occlusion: nine taps, weighted by a gaussian
+// and by how close their depth is to the center's, so the occlusion doesn't smear across depth edges.
+// Nine taps cover the 4x4 interleaved sampling pattern in each direction.
+out vec2 Result;
+
+uniform sampler2D source;
+uniform ivec2 direction;
+// relative depth difference at which a tap's weight has fallen to 1/e
+uniform float depthTolerance;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 maxTexel = textureSize(source, 0) - 1;
+    vec2 center = texelFetch(source, texel, 0).rg;
+    float sum = center.r;
+    float totalWeight = 1.0;
+    for (int i = -4; i <= 4; i++) {
+        if (i == 0)
+            continue;
+        vec2 tap = texelFetch(source, clamp(texel + direction * i, ivec2(0), maxTexel), 0).rg;
+        float w = exp(-float(i * i) / 18.0) * exp(-abs(tap.g - center.g) / (depthTolerance * center.g));
+        sum += tap.r * w;
+        totalWeight += w;
+    }
+    Result = vec2(sum / totalWeight, center.g);
+}
@@ -0,0 +1,50 @@
+#version 330 core
+// Brings the blurred half resolution occlusion to the scene resolution: the four nearest texels are filtered
+// bilinearly, each also weighted by how close its depth is to the pixel's, so occlusion stays on its own side of
+// depth edges. Where none of them is close, the one nearest in depth is taken.
+out float Occlusion;
+
+uniform sampler2D source;
+uniform sampler2D depth;
+uniform float nearPlane;
+uniform float farPlane;
+uniform float depthTolerance;
+
+float LinearDepth(float depth)
+{
+    float z = depth * 2.0 - 1.0;
+    return 2.0 * nearPlane * farPlane / (farPlane + nearPlane - z * (farPlane - nearPlane));
+}
+
+void main()
+{
+    float sceneDepth = texelFetch(depth, ivec2(gl_FragCoord.xy), 0).r;
+    if (sceneDepth >= 1.0) {
+        Occlusion = 1.0;
+        return;
+    }
+    float pixelDepth = LinearDepth(sceneDepth);
+    // half resolution texel i was computed at the scene texel 2i
+    vec2 position = (gl_FragCoord.xy - 0.5) * 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = fract(position);
+    ivec2 maxTexel = textureSize(source, 0) - 1;
+    float sum = 0.0;
+    float totalWeight = 0.0;
+    float nearest = 1.0;
+    float nearestError = 1e30;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec2 tap = texelFetch(source, clamp(base + offset, ivec2(0), maxTexel), 0).rg;
+        float error = abs(tap.g - pixelDepth);
+        if (error < nearestError) {
+            nearestError = error;
+            nearest = tap.r;
+        }
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float w = bilinear.x * bilinear.y * exp(-error / (depthTolerance * pixelDepth));
+        sum += tap.r * w;
+        totalWeight += w;
+    }
+    Occlusion = totalWeight > 1e-3 ? sum / totalWeight : nearest;
+}
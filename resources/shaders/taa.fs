@@ -0,0 +1,83 @@
+#version 330 core
+// Temporal anti-aliasing resolve. The history is reprojected with the motion vectors, clipped to the color range
+// of the current 3x3 neighbourhood so disoccluded and changed pixels don't ghost, and blended with the current
+// frame. Both are weighted by 1 / (1 + luma) first, so single very bright samples don't flicker.
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D current;
+uniform sampler2D history;
+uniform sampler2D velocity;
+uniform vec2 texelSize;
+// share of the history in the result
+uniform float feedback;
+// 0 on the first frame and after a reset, the history holds nothing yet
+uniform float historyValid;
+
+vec3 RGBToYCoCg(vec3 c)
+{
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 YCoCgToRGB(vec3 c)
+{
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+vec3 Fetch(sampler2D image, vec2 texCoords)
+{
+    vec3 color = texture(image, texCoords).rgb;
+    return RGBToYCoCg(color / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722))));
+}
+
+// moves the history towards the box center until it's inside the box
+vec3 ClipToBox(vec3 color, vec3 boxMin, vec3 boxMax)
+{
+    vec3 center = 0.5 * (boxMax + boxMin);
+    vec3 extent = 0.5 * (boxMax - boxMin) + 1e-5;
+    vec3 offset = color - center;
+    vec3 units = abs(offset / extent);
+    float largest = max(units.x, max(units.y, units.z));
+    return largest > 1.0 ? center + offset / largest : color;
+}
+
+void main()
+{
+    vec3 center = Fetch(current, TexCoords);
+    vec3 sum = vec3(0.0), sumSquares = vec3(0.0);
+    vec2 motion = vec2(0.0);
+    float fastest = -1.0;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            vec2 offset = vec2(x, y) * texelSize;
+            vec3 color = (x == 0 && y == 0) ? center : Fetch(current, TexCoords + offset);
+            sum += color;
+            sumSquares += color * color;
+            // the neighbour that moves most, so the edges of moving objects travel with them
+            vec2 v = texture(velocity, TexCoords + offset).xy;
+            float speed = dot(v, v);
+            if (speed > fastest)
+            {
+                fastest = speed;
+                motion = v;
+            }
+        }
+    }
+
+    vec2 previousTexCoords = TexCoords - motion;
+    vec3 result = center;
+    if (historyValid > 0.5 && all(greaterThanEqual(previousTexCoords, vec2(0.0))) && all(lessThanEqual(previousTexCoords, vec2(1.0))))
+    {
+        // a box of one standard deviation around the mean is tighter than min/max and rejects more ghosts
+        vec3 mean = sum / 9.0;
+        vec3 deviation = sqrt(max(sumSquares / 9.0 - mean * mean, 0.0));
+        vec3 previous = ClipToBox(Fetch(history, previousTexCoords), mean - deviation, mean + deviation);
+        result = mix(center, previous, feedback);
+    }
+
+    vec3 color = YCoCgToRGB(result);
+    FragColor = vec4(color / max(1.0 - dot(color, vec3(0.2126, 0.7152, 0.0722)), 1e-4), 1.0);
+}
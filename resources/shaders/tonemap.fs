@@ -0,0 +1,27 @@
+#version 330 core
+// Adds the bloom to the HDR scene and maps it to the display range. The renderer works on the texture colors as
+// they are stored, so the result is written without a gamma curve, like before HDR.
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform float bloomStrength;
+uniform float exposure;
+// 1x1 exposure from AutoExposure, used when useAutoExposure is 1; exposure then works as compensation
+uniform sampler2D autoExposure;
+uniform float useAutoExposure;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 ACESFilm(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec3 color = texture(scene, TexCoords).rgb + texture(bloom, TexCoords).rgb * bloomStrength;
+    float adapted = mix(1.0, texelFetch(autoExposure, ivec2(0, 0), 0).r, useAutoExposure);
+    FragColor = vec4(ACESFilm(color * exposure * adapted), 1.0);
+}
@@ -0,0 +1,83 @@
+#version 330 core
+// Edge-adaptive upscale of the tonemapped image. Around each output pixel the luma gradients of the four nearest
+// source texels give an edge direction and how clearly it is an edge; twelve texels are then weighted with an
+// approximate Lanczos-2 kernel that is stretched along the edge and keeps its negative lobe across it, and the
+// result is clamped to the four nearest texels so the lobe can't ring.
+out vec4 FragColor;
+
+uniform sampler2D source;
+uniform vec2 outputSize;
+
+// the 4x4 texels around the output pixel without the corners, relative to the nearest one below and left of it
+const ivec2 TAPS[12] = ivec2[](
+    ivec2(0, -1), ivec2(1, -1),
+    ivec2(-1, 0), ivec2(0, 0), ivec2(1, 0), ivec2(2, 0),
+    ivec2(-1, 1), ivec2(0, 1), ivec2(1, 1), ivec2(2, 1),
+    ivec2(0, 2), ivec2(1, 2));
+
+float Luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// gradient at a texel from its four neighbours, and per axis how much it looks like an edge rather than a line
+void Gradient(float left, float right, float down, float up, float center, float weight,
+              inout vec2 direction, inout float edge)
+{
+    vec2 delta = vec2(right - left, up - down);
+    direction += delta * weight;
+    vec2 steepest = max(vec2(abs(left - center), abs(down - center)), vec2(abs(right - center), abs(up - center)));
+    vec2 axisEdge = clamp(abs(delta) / max(steepest, vec2(1e-5)), 0.0, 1.0);
+    axisEdge *= axisEdge;
+    edge += (axisEdge.x + axisEdge.y) * 0.5 * weight;
+}
+
+void main()
+{
+    ivec2 size = textureSize(source, 0);
+    vec2 position = gl_FragCoord.xy / outputSize * vec2(size) - 0.5;
+    vec2 base = floor(position);
+    vec2 t = position - base;
+
+    vec3 colors[12];
+    float luma[12];
+    for (int i = 0; i < 12; i++) {
+        ivec2 texel = clamp(ivec2(base) + TAPS[i], ivec2(0), size - 1);
+        colors[i] = texelFetch(source, texel, 0).rgb;
+        luma[i] = Luma(colors[i]);
+    }
+
+    // bilinear blend of the gradients at the 2x2 nearest texels: indices 3, 4, 7, 8
+    vec2 direction = vec2(0.0);
+    float edge = 0.0;
+    Gradient(luma[2], luma[4], luma[0], luma[7], luma[3], (1.0 - t.x) * (1.0 - t.y), direction, edge);
+    Gradient(luma[3], luma[5], luma[1], luma[8], luma[4], t.x * (1.0 - t.y), direction, edge);
+    Gradient(luma[6], luma[8], luma[3], luma[10], luma[7], (1.0 - t.x) * t.y, direction, edge);
+    Gradient(luma[7], luma[9], luma[4], luma[11], luma[8], t.x * t.y, direction, edge);
+    float lengthSquared = dot(direction, direction);
+    direction = lengthSquared < 1.0 / 32768.0 ? vec2(1.0, 0.0) : direction * inversesqrt(lengthSquared);
+    edge *= edge;
+
+    // diagonal edges reach further in texel space; across the edge stays sharp, along it widens
+    float stretch = 1.0 / max(abs(direction.x), abs(direction.y));
+    vec2 scale = vec2(1.0 + (stretch - 1.0) * edge, 1.0 - 0.5 * edge);
+    // a stronger negative lobe on clear edges
+    float lobe = 0.5 + (0.21 - 0.5) * edge;
+    float clip = 1.0 / lobe;
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int i = 0; i < 12; i++) {
+        vec2 offset = vec2(TAPS[i]) - t;
+        vec2 rotated = vec2(dot(offset, direction), dot(offset, vec2(-direction.y, direction.x))) * scale;
+        float d2 = min(dot(rotated, rotated), clip);
+        float base2 = 0.4 * d2 - 1.0;
+        float window = lobe * d2 - 1.0;
+        float weight = (25.0 / 16.0 * base2 * base2 - (25.0 / 16.0 - 1.0)) * window * window;
+        sum += colors[i] * weight;
+        weightSum += weight;
+    }
+    vec3 minColor = min(min(colors[3], colors[4]), min(colors[7], colors[8]));
+    vec3 maxColor = max(max(colors[3], colors[4]), max(colors[7], colors[8]));
+    FragColor = vec4(clamp(sum / weightSum, minColor, maxColor), 1.0);
+}
@@ -13,8 +13,32 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <rg/ShaderWatcher.h>
+#include <rg/ShaderPermutations.h>
+#include <rg/GpuTimer.h>
+#include <rg/ClusteredLights.h>
+#include <rg/CascadedShadows.h>
+#include <rg/ShadowAtlas.h>
+#include <rg/HdrPipeline.h>
+#include <rg/AutoExposure.h>
+#include <rg/TemporalAA.h>
+#include <rg/QualityGovernor.h>
+#include <rg/Upscaler.h>
+#include <rg/FrameGraph.h>
+#include <rg/WeightedOIT.h>
+#include <rg/AmbientOcclusion.h>
+#include <rg/EnvironmentLighting.h>
+#include <rg/TextureStreamer.h>
+#include <rg/DrawBatcher.h>
+#include <rg/UploadThread.h>
+
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <random>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
@@ -26,11 +50,12 @@ void processInput(GLFWwindow *window);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
-unsigned int loadTexture(char const * path);
+GLTexture loadTexture(char const * path);
 
-unsigned int loadCubemap(vector<std::string> faces);
+GLTexture loadCubemap(vector<std::string> faces);
 
-void renderGround();
+// the ground quad with its tangent frame, drawn by runScene's renderGround
+void createGround(GLVertexArray &vao, GLBuffer &vbo);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -48,17 +73,27 @@ float lastFrame = 0.0f;
 
 float heightScale = 0.1;
 bool blinn = false;
+int parallaxSteps = 32;
+bool depthPrepass = true;
+// cone-step relief mapping on the ground, only offered when the baked relief map exists
+bool coneStepAvailable = false;
+bool coneStepMapping = false;
+float parallaxFadeDistance = 40.0f;
+// draw the ground as a heatmap of height fetches and read back their average
+bool fetchHeatmap = false;
+float averageFetches = 0.0f;
+// draw calls of the opaque and alpha-tested models last frame
+int modelDrawCalls = 0;
+
+// replaces the scene's point lights with this many random ones, 0 for the scene itself
+int benchmarkLights = 0;
+bool shadows = true;
+// direction the sunlight travels in
+glm::vec3 sunDirection = glm::vec3(-5.0f, -5.0f, 5.0f);
+// ShadowAtlas ids of the lights with shadows
+const int LAMP_SHADOW = 0;
+const int SPOTLIGHT_SHADOW = 1;
 
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
 struct SpotLight {
     glm::vec3 position;
     glm::vec3 direction;
@@ -72,6 +107,8 @@ struct SpotLight {
     glm::vec3 ambient;
     glm::vec3 diffuse;
     glm::vec3 specular;
+
+    int shadowTile = -1;
 };
 struct DirLight {
     glm::vec3 direction;
@@ -81,6 +118,25 @@ struct DirLight {
     glm::vec3 specular;
 };
 
+// one instance of a model in the scene
+struct SceneObject {
+    Model* model;
+    glm::mat4 transform;
+    // never moves, may be drawn into the cached shadow cascades
+    bool isStatic;
+    // last frame's transform, for the motion vectors
+    glm::mat4 previousTransform = glm::mat4(1.0f);
+};
+
+// uploads the lights declared in lighting.glsl, point lights come from clusteredLights
+void setLightUniforms(Shader& shader, const SpotLight& spotLight, const DirLight& dirLight);
+
+// small colored lights scattered over the scene for benchmarking the clustered lighting
+std::vector<PointLight> makeBenchmarkLights(int count);
+
+// resident memory of the process in bytes, 0 where the platform doesn't say
+size_t residentMemory();
+
 struct ProgramState {
     glm::vec3 clearColor = glm::vec3(0);
     bool ImGuiEnabled = false;
@@ -128,9 +184,33 @@ void ProgramState::LoadFromFile(std::string filename) {
 }
 
 ProgramState *programState;
+ShaderWatcher *shaderWatcher;
+GpuTimer *gpuTimer;
+ClusteredLights *clusteredLights;
+CascadedShadows *cascadedShadows;
+ShadowAtlas *shadowAtlas;
+HdrPipeline *hdrPipeline;
+AutoExposure *autoExposure;
+bool autoExposureEnabled = true;
+TemporalAA *temporalAA;
+bool taaEnabled = true;
+QualityGovernor qualityGovernor;
+Upscaler *upscaler;
+FrameGraph *frameGraph;
+WeightedOIT *weightedOIT;
+AmbientOcclusion *ambientOcclusion;
+EnvironmentLighting *environmentLighting;
+TextureStreamer *textureStreamer;
+DrawBatcher *drawBatcher;
+UploadThread *uploadThread;
+// set from ImGui, the coral house then loads on the upload thread
+bool coralRequested = false;
+bool iblEnabled = true;
 
 void DrawImGui(ProgramState *programState);
 
+void runScene(GLFWwindow *window);
+
 int main() {
     // glfw: initialize and configure
     // ------------------------------
@@ -191,15 +271,73 @@ int main() {
     //face culling
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
-    //blending
-    glEnable(GL_BLEND);
+    //blending: off for the frame, the passes that blend turn it on and back off
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // build and compile shaders
     // -------------------------
-    Shader modelShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs");
+    // recompile shaders in place whenever a file in resources/shaders is saved
+    shaderWatcher = new ShaderWatcher("resources/shaders");
+    gpuTimer = new GpuTimer();
+    clusteredLights = new ClusteredLights();
+    cascadedShadows = new CascadedShadows();
+    shadowAtlas = new ShadowAtlas();
+    hdrPipeline = new HdrPipeline(shaderWatcher);
+    autoExposure = new AutoExposure(shaderWatcher);
+    temporalAA = new TemporalAA(shaderWatcher);
+    upscaler = new Upscaler(shaderWatcher);
+    frameGraph = new FrameGraph();
+    weightedOIT = new WeightedOIT(shaderWatcher);
+    ambientOcclusion = new AmbientOcclusion(shaderWatcher);
+    environmentLighting = new EnvironmentLighting();
+    textureStreamer = new TextureStreamer();
+    drawBatcher = new DrawBatcher();
+
+    runScene(window);
+
+    programState->SaveToFile("resources/program_state.txt");
+    delete programState;
+    delete shaderWatcher;
+    delete gpuTimer;
+    delete clusteredLights;
+    delete cascadedShadows;
+    delete shadowAtlas;
+    delete hdrPipeline;
+    delete autoExposure;
+    delete temporalAA;
+    delete upscaler;
+    delete frameGraph;
+    delete weightedOIT;
+    delete ambientOcclusion;
+    delete environmentLighting;
+    delete textureStreamer;
+    delete drawBatcher;
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+    // glfw: terminate, clearing all previously allocated GLFW resources.
+    // ------------------------------------------------------------------
+    glfwTerminate();
+    return 0;
+}
+
+// the shaders and models live on this stack, so their GL objects are deleted when it returns, before main() shuts
+// GLFW and with it the context down
+void runScene(GLFWwindow *window) {
+    uploadThread = new UploadThread(window);
+    shaderWatcher->setUploadThread(uploadThread);
+
+    // lighting shaders come in variants (Blinn, specular/normal maps, alpha test, parallax steps)
+    // that are compiled on first use, see ShaderPermutations
+    ShaderPermutations modelShaders("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs", shaderWatcher);
+    ShaderPermutations groundShaders("resources/shaders/normal.vs", "resources/shaders/normal.fs", shaderWatcher);
     Shader skyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
-    Shader normalShader("resources/shaders/normal.vs", "resources/shaders/normal.fs");
+    shaderWatcher->watch(skyboxShader);
+    Shader depthShader("resources/shaders/depth.vs", "resources/shaders/depth.fs");
+    shaderWatcher->watch(depthShader);
+    // the pre-pass draws the models instanced, see DrawBatcher
+    Shader instancedDepthShader("resources/shaders/depth.vs", "resources/shaders/depth.fs", nullptr, {"INSTANCED"});
+    shaderWatcher->watch(instancedDepthShader);
 
     float skyboxVertices[] = {
             // positions
@@ -246,9 +384,8 @@ int main() {
             1.0f, -1.0f,  1.0f
     };
 
-    unsigned int skyboxVAO, skyboxVBO;
-    glGenVertexArrays(1, &skyboxVAO);
-    glGenBuffers(1, &skyboxVBO);
+    GLVertexArray skyboxVAO = GLVertexArray::create();
+    GLBuffer skyboxVBO = GLBuffer::create();
     glBindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
@@ -266,47 +403,102 @@ int main() {
             };
 
 
-    unsigned int cubemapTexture = loadCubemap(faces);
+    GLVertexArray groundVAO;
+    GLBuffer groundVBO;
+    createGround(groundVAO, groundVBO);
+    auto renderGround = [&]() {
+        glBindVertexArray(groundVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+    };
 
-    skyboxShader.use();
-    skyboxShader.setInt("skybox", 0);
+    GLTexture cubemapTexture = loadCubemap(faces);
+    // spherical harmonics, prefiltered mips and the BRDF table, computed on the first run
+    environmentLighting->build(cubemapTexture, FileSystem::getPath("resources/textures/skybox/environment.cache"));
+    environmentLighting->bind();
+
+    skyboxShader.setOnLink([](Shader& shader) {
+        shader.setInt("skybox", 0);
+    });
+    // the material textures sit at fixed units, see Material
+    modelShaders.setOnLink([](Shader& shader) {
+        Material::setSamplerUnits(shader, "material.");
+    });
 
 // load models
     // -----------
-    Model modelSundjerBob("resources/objects/spongebob/scene.gltf");
-    modelSundjerBob.SetShaderTextureNamePrefix("material.");
+    size_t residentBeforeModels = residentMemory();
+    Model modelSundjerBob("resources/objects/spongebob/scene.gltf", false, false, textureStreamer);
 
-    Model modelMreza("resources/objects/net/scene.gltf");
-    modelMreza.SetShaderTextureNamePrefix("material.");
+    Model modelMreza("resources/objects/net/scene.gltf", false, false, textureStreamer);
 
-    Model modelMeduza("resources/objects/jellyfish/scene.gltf");
-    modelMeduza.SetShaderTextureNamePrefix("material.");
+    Model modelMeduza("resources/objects/jellyfish/scene.gltf", false, false, textureStreamer);
+    // the file marks the jellyfish opaque, they are meant to be see-through
+    modelMeduza.SetOpacity(0.6f);
 
-    Model modelPatrik("resources/objects/patrick/scene.gltf");
-    modelPatrik.SetShaderTextureNamePrefix("material.");
+    Model modelPatrik("resources/objects/patrick/scene.gltf", false, false, textureStreamer);
 
 
-    Model modelKola("resources/objects/krusty_krab_patty_wagon/scene.gltf");
-    modelKola.SetShaderTextureNamePrefix("material.");
+    Model modelKola("resources/objects/krusty_krab_patty_wagon/scene.gltf", false, false, textureStreamer);
 
-    Model modelLampa("resources/objects/bus_stop-spongebob_battle_for_bkinibottom/scene.gltf");
-    modelLampa.SetShaderTextureNamePrefix("material.");
+    Model modelLampa("resources/objects/bus_stop-spongebob_battle_for_bkinibottom/scene.gltf", false, false, textureStreamer);
 
-    Model modelLKuca("resources/objects/spongebob__squidwards_house/scene.gltf");
-    modelLKuca.SetShaderTextureNamePrefix("material.");
-//
-//    Model modelAnanas("resources/objects/coral_1/scene.gltf");
-//    modelAnanas.SetShaderTextureNamePrefix("material.");
+    Model modelLKuca("resources/objects/spongebob__squidwards_house/scene.gltf", false, false, textureStreamer);
+    // the coral house isn't loaded up front, see coralRequested
 
+    // every model texture starts out at the streamer's base size, finer mips come in as the camera gets close
+    textureStreamer->build();
+    // the vertices and indices only stay in memory for models loaded with keepCpuGeometry
+    size_t uploadedGeometry = 0, cpuGeometry = 0;
+    for (Model* sceneModel : {&modelSundjerBob, &modelMreza, &modelMeduza, &modelPatrik, &modelKola, &modelLampa, &modelLKuca}) {
+        uploadedGeometry += sceneModel->UploadedGeometryBytes();
+        cpuGeometry += sceneModel->CpuGeometryBytes();
+    }
+    std::cout << "Scene geometry: " << uploadedGeometry / (1024 * 1024) << " MB uploaded, "
+              << cpuGeometry / (1024 * 1024) << " MB kept on the CPU";
+    if (residentBeforeModels > 0)
+        std::cout << "; resident memory " << residentBeforeModels / (1024 * 1024) << " MB before the models, "
+                  << residentMemory() / (1024 * 1024) << " MB after";
+    std::cout << std::endl;
+
+    // compile every variant the scene can use now instead of hitching on the first frame
+    std::vector<unsigned int> lightingVariants = {0u, SHADER_BLINN, SHADER_SHADOWS, SHADER_BLINN | SHADER_SHADOWS};
+    if (iblEnabled && environmentLighting->ready())
+        for (unsigned int& features : lightingVariants)
+            features |= SHADER_IBL;
+    // and each of them with the ambient occlusion of the opaque passes
+    for (size_t i = 0, count = lightingVariants.size(); i < count; i++)
+        lightingVariants.push_back(lightingVariants[i] | SHADER_AMBIENT_OCCLUSION);
+    for (Model* sceneModel : {&modelSundjerBob, &modelMreza, &modelMeduza, &modelPatrik, &modelKola, &modelLampa, &modelLKuca})
+        sceneModel->PrepareShaders(modelShaders, lightingVariants);
+    // the layer counts the quality governor can pick, too, and the pre-pass's depth-only march for each
+    for (int level = 0; level < QualityGovernor::LEVELS; level++) {
+        int steps = std::max(4, (int)(parallaxSteps * QualityGovernor::level(level).parallaxScale));
+        for (unsigned int features : lightingVariants)
+            groundShaders.get(features, steps);
+        groundShaders.get(SHADER_DEPTH_ONLY, steps);
+    }
 
-    unsigned int diffuseMap = loadTexture(FileSystem::getPath("resources/textures/Sand_basecolor.png").c_str());
-    unsigned int normalMap = loadTexture(FileSystem::getPath("resources/textures/Sand_normal.png").c_str());
-    unsigned int depthMap = loadTexture(FileSystem::getPath("resources/textures/Sand_height.png").c_str());
+    GLTexture diffuseMap = loadTexture(FileSystem::getPath("resources/textures/Sand_basecolor.png").c_str());
+    GLTexture normalMap = loadTexture(FileSystem::getPath("resources/textures/Sand_normal.png").c_str());
+    GLTexture depthMap = loadTexture(FileSystem::getPath("resources/textures/Sand_height.png").c_str());
+    // normal, cone ratio and depth in one texture, baked offline by tools/bake_cone_map
+    GLTexture reliefMap;
+    std::string reliefPath = FileSystem::getPath("resources/textures/Sand_relief.tga");
+    if (std::ifstream(reliefPath).good()) {
+        reliefMap = loadTexture(reliefPath.c_str());
+        coneStepAvailable = true;
+        for (unsigned int features : lightingVariants)
+            groundShaders.get(SHADER_CONE_STEP | features);
+        groundShaders.get(SHADER_CONE_STEP | SHADER_DEPTH_ONLY);
+    }
 
-    normalShader.use();
-    normalShader.setInt("diffuseMap", 0);
-    normalShader.setInt("normalMap", 1);
-    normalShader.setInt("depthMap", 2);
+    groundShaders.setOnLink([](Shader& shader) {
+        shader.setInt("diffuseMap", 0);
+        shader.setInt("normalMap", 1);
+        shader.setInt("depthMap", 2);
+        shader.setInt("reliefMap", 3);
+    });
 
     //pointlight
     PointLight& pointLight = programState->pointLight;
@@ -339,6 +531,17 @@ int main() {
     directional.diffuse = glm::vec3(0.3f);
     directional.specular = glm::vec3(0.2f);
 
+    std::vector<PointLight> benchmark;
+    // last frame's unjittered camera and object transforms, the motion vectors are the difference
+    glm::mat4 previousViewProjection(1.0f), previousSkyViewProjection(1.0f);
+    std::vector<glm::mat4> previousTransforms;
+    bool firstFrame = true;
+    // what the quality level last set the material textures to
+    float appliedLodBias = 0.0f;
+    // loaded during the session: the upload thread builds the model, the render thread takes it once it's ready
+    Model *coral = nullptr, *loadingCoral = nullptr;
+    bool coralSubmitted = false;
+
     // draw in wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
@@ -354,121 +557,107 @@ int main() {
         // input
         // -----
         processInput(window);
+        shaderWatcher->update(currentFrame);
+        if (coralRequested && !coralSubmitted) {
+            coralSubmitted = true;
+            // the model first, then the lighting variants its materials need that aren't compiled yet, so the
+            // first frame that draws it doesn't wait for the driver either
+            uploadThread->submit([&loadingCoral]() {
+                loadingCoral = new Model("resources/objects/coral_1/scene.gltf", false, false, nullptr, false);
+            }, [&]() {
+                std::vector<unsigned int> missing;
+                for (unsigned int features : loadingCoral->ShaderFeatures(lightingVariants))
+                    if (!modelShaders.has(features))
+                        missing.push_back(features);
+                auto compiled = std::make_shared<std::vector<std::unique_ptr<Shader>>>();
+                uploadThread->submit([&modelShaders, missing, compiled]() {
+                    for (unsigned int features : missing)
+                        compiled->push_back(modelShaders.compile(features));
+                }, [&, missing, compiled]() {
+                    for (size_t i = 0; i < missing.size(); i++)
+                        modelShaders.adopt(missing[i], 0, std::move((*compiled)[i]));
+                    loadingCoral->CreateVertexArrays();
+                    loadingCoral->SetLodBias(appliedLodBias);
+                    coral = loadingCoral;
+                    // a new static caster, the cached shadows don't have it yet
+                    cascadedShadows->invalidate();
+                    shadowAtlas->invalidate();
+                });
+            });
+        }
+        uploadThread->poll();
 
 
         // render
         // ------
-        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (gpuTimer->beginFrame())
+            qualityGovernor.addSample(gpuTimer->latestGpuMs("Frame"));
+        gpuTimer->begin("Frame");
+        const QualityLevel& quality = qualityGovernor.settings();
+        cascadedShadows->setResolution((int)(CascadedShadows::SIZE * quality.shadowScale));
+        shadowAtlas->resolutionScale = quality.shadowScale;
+        // below native resolution the textures would otherwise blur by the same factor
+        float lodBias = quality.lodBias + std::log2(quality.renderScale);
+        if (lodBias != appliedLodBias) {
+            textureStreamer->setLodBias(lodBias);
+            if (coral)
+                coral->SetLodBias(lodBias);
+            for (const GLTexture* texture : {&diffuseMap, &normalMap, &depthMap, &reliefMap}) {
+                if (*texture == 0)
+                    continue;
+                glBindTexture(GL_TEXTURE_2D, *texture);
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, lodBias);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            appliedLodBias = lodBias;
+        }
 
-        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+        // the scene renders at the governed resolution, the upscaler brings it to the window size when it's smaller
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        int renderWidth = std::max(1, (int)(framebufferWidth * quality.renderScale));
+        int renderHeight = std::max(1, (int)(framebufferHeight * quality.renderScale));
+        // follows the window when it's resized; a minimized window reports a zero size
+        float aspect = framebufferWidth > 0 && framebufferHeight > 0
+                       ? (float) framebufferWidth / (float) framebufferHeight : 1.0f;
+
+        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom), aspect, 0.1f, 100.0f);
         glm::mat4 view = programState->camera.GetViewMatrix();
+        // motion vectors come from the unjittered matrices, only what's drawn is jittered
+        glm::mat4 currentViewProjection = projection * view;
+        glm::mat4 currentSkyViewProjection = projection * glm::mat4(glm::mat3(view));
+        if (firstFrame) {
+            previousViewProjection = currentViewProjection;
+            previousSkyViewProjection = currentSkyViewProjection;
+        }
+        if (taaEnabled)
+            projection = temporalAA->jitter(projection, renderWidth, renderHeight);
+        else
+            temporalAA->reset();
         glm::mat4 model = glm::mat4(1.0f);
-
-        glDisable(GL_CULL_FACE);
-        normalShader.use();
-        normalShader.setMat4("projection", projection);     renderGround();
-
-        normalShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, -5.0f, 0.0f));
-        model = glm::rotate(model, 1.57f, glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(100.0f));
-       normalShader.setMat4("model", model);
-        normalShader.setVec3("viewPos", programState->camera.Position);
-
-
-        normalShader.setVec3("pointLight.position", pointLight.position);
-        normalShader.setVec3("pointLight.ambient", pointLight.ambient);
-        normalShader.setVec3("pointLight.diffuse", pointLight.diffuse);
-        normalShader.setVec3("pointLight.specular", pointLight.specular);
-        normalShader.setFloat("pointLight.constant", pointLight.constant);
-        normalShader.setFloat("pointLight.linear", pointLight.linear);
-        normalShader.setFloat("pointLight.quadratic", pointLight.quadratic);
-
-        normalShader.setVec3("dirLight.direction", directional.direction);
-        normalShader.setVec3("dirLight.ambient", directional.ambient);
-        normalShader.setVec3("dirLight.diffuse", directional.diffuse);
-        normalShader.setVec3("dirLight.specular", directional.specular);
-
-        normalShader.setVec3("spotLight.position", programState->camera.Position);
-        normalShader.setVec3("spotLight.direction", programState->camera.Front);
-        normalShader.setVec3("spotLight.ambient", spotlight.ambient);
-        normalShader.setVec3("spotLight.diffuse", spotlight.diffuse);
-        normalShader.setVec3("spotLight.specular", spotlight.specular);
-        normalShader.setFloat("spotLight.cutOff", spotlight.cutOff);
-        normalShader.setFloat("spotLight.outerCutOff", spotlight.outerCutOff);
-        normalShader.setFloat("spotLight.constant", spotlight.constant);
-        normalShader.setFloat("spotLight.linear", spotlight.linear);
-        normalShader.setFloat("spotLight.quadratic", spotlight.quadratic);
-
-        normalShader.setBool("blinn", blinn);
-        normalShader.setFloat("heightScale", heightScale);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, normalMap);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-
-        renderGround();
-
-        // don't forget to enable shader before setting uniforms
-        modelShader.use();
-        model = glm::mat4(1.0f);
-
-        modelShader.setMat4("model", model);
-        modelShader.setMat4("view", view);
-        modelShader.setMat4("projection", projection);
-
-        modelShader.use();
-
-        pointLight.position = glm::vec3(-22.0f, -5.0f, 0.0f);
-        modelShader.setVec3("pointLight.position", pointLight.position);
-        modelShader.setVec3("pointLight.ambient", pointLight.ambient);
-        modelShader.setVec3("pointLight.diffuse", pointLight.diffuse);
-        modelShader.setVec3("pointLight.specular", pointLight.specular);
-        modelShader.setFloat("pointLight.constant", pointLight.constant);
-        modelShader.setFloat("pointLight.linear", pointLight.linear);
-        modelShader.setFloat("pointLight.quadratic", pointLight.quadratic);
-        modelShader.setVec3("viewPosition", programState->camera.Position);
-        modelShader.setFloat("material.shininess", 32.0f);
-
-        modelShader.setVec3("spotLight.position", programState->camera.Position);
-        modelShader.setVec3("spotLight.direction", programState->camera.Front);
-        modelShader.setVec3("spotLight.ambient", spotlight.ambient);
-        modelShader.setVec3("spotLight.diffuse", spotlight.diffuse);
-        modelShader.setVec3("spotLight.specular", spotlight.specular);
-        modelShader.setFloat("spotLight.constant", 1.0f);
-        modelShader.setFloat("spotLight.linear", 0.09);
-        modelShader.setFloat("spotLight.quadratic", 0.032);
-        modelShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-        modelShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
-        modelShader.setVec3("dirLight.direction", directional.direction);
-        modelShader.setVec3("dirLight.ambient", directional.ambient);
-        modelShader.setVec3("dirLight.diffuse", directional.diffuse);
-        modelShader.setVec3("dirLight.specular", directional.specular);
-
-
-        modelShader.setBool("blinn", blinn);
-        // view/projection transformations
-
-
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-
-
-
-        // render the loaded model
+        unsigned int lightingFeatures = blinn ? SHADER_BLINN : 0u;
+        if (shadows)
+            lightingFeatures |= SHADER_SHADOWS;
+        if (iblEnabled && environmentLighting->ready())
+            lightingFeatures |= SHADER_IBL;
+        // the occlusion is computed from the pre-pass depth, and only the opaque passes use it
+        bool ssaoActive = depthPrepass && ambientOcclusion->enabled();
+        unsigned int opaqueFeatures = lightingFeatures | (ssaoActive ? SHADER_AMBIENT_OCCLUSION : 0u);
+        directional.direction = sunDirection;
+
+        // where everything goes this frame; the depth pre-pass and the lit pass must use the very same matrices
+        glm::mat4 groundModel = glm::mat4(1.0f);
+        groundModel = glm::translate(groundModel, glm::vec3(0.0f, -5.0f, 0.0f));
+        // facing up, so its tangent space agrees with the world-space lighting
+        groundModel = glm::rotate(groundModel, 1.57f, glm::vec3(-1.0f, 0.0f, 0.0f));
+        groundModel = glm::scale(groundModel, glm::vec3(100.0f));
+
+        std::vector<SceneObject> scene;
         //sundjerbob model
         model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(2.0f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelSundjerBob.Draw(modelShader);
+        scene.push_back(SceneObject{&modelSundjerBob, model, true});
 
         //mreza za meduze
         model = glm::mat4(1.0f);
@@ -478,8 +667,7 @@ int main() {
         model = glm::rotate(model, 0.07f, glm::vec3(0.0f, 1.0f, 0.0f));
         model = glm::rotate(model, 0.47f, glm::vec3(-1.0f, 0.0f, 0.0f));
         model = glm::scale(model, glm::vec3(0.3f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelMreza.Draw(modelShader);
+        scene.push_back(SceneObject{&modelMreza, model, true});
 
 
 //
@@ -494,33 +682,29 @@ int main() {
             float x_coord = rand()%50;
             float y_coord = rand()%20;
             float z_coord = rand()%50;
-            model = glm::translate(model, glm::vec3(x_coord, abs(2*sin(glfwGetTime())) + y_coord, z_coord)); // translate it down so it's at the center of the scene
+            model = glm::translate(model, glm::vec3(x_coord, abs(2*sin(currentFrame)) + y_coord, z_coord)); // translate it down so it's at the center of the scene
             model = glm::scale(model, glm::vec3(2.0f));    // it's a bit too big for our scene, so scale it down
-            modelShader.setMat4("model", model);
-            modelMeduza.Draw(modelShader);
+            scene.push_back(SceneObject{&modelMeduza, model, false});
         }
 
         //patrik
         model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(-10.0f, -4.0f, 0.0f)); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(2.5f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelPatrik.Draw(modelShader);
+        scene.push_back(SceneObject{&modelPatrik, model, true});
 
         //kola
         model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(22.0f, 0.0f, -2.0f)); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(6.0f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelKola.Draw(modelShader);
+        scene.push_back(SceneObject{&modelKola, model, true});
 
         //lampa
         model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(-22.0f, -5.0f, 0.0f)); // translate it down so it's at the center of the scene
         model = glm::rotate(model, 1.57f, glm::vec3(-1.0f, 0.0f, 0.0f));
         model = glm::scale(model, glm::vec3(6.0f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelLampa.Draw(modelShader);
+        scene.push_back(SceneObject{&modelLampa, model, true});
 
 
         //kuca lingnjoslavljeva
@@ -529,70 +713,557 @@ int main() {
         model = glm::rotate(model, 1.57f, glm::vec3(-1.0f, 0.0f, 0.0f));
         model = glm::rotate(model, 2.97f, glm::vec3(0.0f, 0.0f, 1.0f));
         model = glm::scale(model, glm::vec3(4.0f));    // it's a bit too big for our scene, so scale it down
-        modelShader.setMat4("model", model);
-        modelLKuca.Draw(modelShader);
+        scene.push_back(SceneObject{&modelLKuca, model, true});
+        //kuca ananas, once it's loaded
+        if (coral) {
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(10.0f, -5.0f, 20.0f)); // translate it down so it's at the center of the scene
+            model = glm::rotate(model, 1.57f, glm::vec3(1.0f, 0.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(2.0f));    // it's a bit too big for our scene, so scale it down
+            scene.push_back(SceneObject{coral, model, true});
+        }
+        for (size_t i = 0; i < scene.size(); i++)
+            scene[i].previousTransform = i < previousTransforms.size() ? previousTransforms[i] : scene[i].transform;
+        // front to back for the draws that depth test against an incomplete depth buffer: the pre-pass, the
+        // alpha-tested meshes, and the opaque ones when the pre-pass is off. With it on, the opaque lit draws only
+        // pass the visible fragment and are sorted by state instead, see DrawBatcher.
+        // The scene itself keeps its order, the previous transforms are matched by index
+        std::vector<const SceneObject*> frontToBack;
+        for (const SceneObject& object : scene)
+            frontToBack.push_back(&object);
+        auto cameraDistance = [&](const SceneObject* object) {
+            return glm::length(glm::vec3(object->transform[3]) - programState->camera.Position);
+        };
+        std::sort(frontToBack.begin(), frontToBack.end(), [&](const SceneObject* a, const SceneObject* b) {
+            return cameraDistance(a) < cameraDistance(b);
+        });
+        bool translucentScene = false;
+        for (const SceneObject& object : scene)
+            translucentScene = translucentScene || object.model->HasMeshes(TRANSLUCENT_MESHES);
+        // one instanced draw per mesh for all objects of a model, each model's instances front to back
+        drawBatcher->clear();
+        for (const SceneObject* object : frontToBack)
+            drawBatcher->add(object->model, object->transform, object->previousTransform);
+        drawBatcher->upload();
+        // the texture resolution each model needs from how large it is on screen, outside the view it needs none
+        textureStreamer->beginFrame();
+        for (const SceneObject& object : scene) {
+            float pixels = TextureStreamer::footprint(object.transform, object.model->boundsMin, object.model->boundsMax,
+                                                      currentViewProjection, programState->camera.Position,
+                                                      glm::radians(programState->camera.Zoom), renderHeight);
+            if (pixels > 0.0f)
+                textureStreamer->require(object.model->textures_loaded, pixels);
+        }
+        textureStreamer->update();
+
+        // the street lamp, and the flashlight in the camera
+        pointLight.position = glm::vec3(-22.0f, -5.0f, 0.0f);
+        spotlight.position = programState->camera.Position;
+        spotlight.direction = programState->camera.Front;
         glDisable(GL_CULL_FACE);
-        //kuca ananas
-//        model = glm::mat4(1.0f);
-//        model = glm::translate(model, glm::vec3(10.0f, -5.0f, 20.0f)); // translate it down so it's at the center of the scene
-//        model = glm::rotate(model, 1.57f, glm::vec3(1.0f, 0.0f, 0.0f));
-////        model = glm::rotate(model, 1.77f, glm::vec3(0.0f, 0.0f, 1.0f));
-//        model = glm::scale(model, glm::vec3(2.0f));    // it's a bit too big for our scene, so scale it down
-//        modelShader.setMat4("model", model);
-//        modelAnanas.Draw(modelShader);
-//
-//        //lights
-        normalShader.setVec3("pointLight.position", pointLight.position);
-        normalShader.setVec3("pointLight.ambient", pointLight.ambient);
-        normalShader.setVec3("pointLight.diffuse", pointLight.diffuse);
-        normalShader.setVec3("pointLight.specular", pointLight.specular);
-        normalShader.setFloat("pointLight.constant", pointLight.constant);
-        normalShader.setFloat("pointLight.linear", pointLight.linear);
-        normalShader.setFloat("pointLight.quadratic", pointLight.quadratic);
-
-        normalShader.setVec3("dirLight.direction", directional.direction);
-        normalShader.setVec3("dirLight.ambient", directional.ambient);
-        normalShader.setVec3("dirLight.diffuse", directional.diffuse);
-        normalShader.setVec3("dirLight.specular", directional.specular);
-
-        normalShader.setVec3("spotLight.position", programState->camera.Position);
-        normalShader.setVec3("spotLight.direction", programState->camera.Front);
-        normalShader.setVec3("spotLight.ambient", spotlight.ambient);
-        normalShader.setVec3("spotLight.diffuse", spotlight.diffuse);
-        normalShader.setVec3("spotLight.specular", spotlight.specular);
-        normalShader.setFloat("spotLight.cutOff", spotlight.cutOff);
-        normalShader.setFloat("spotLight.outerCutOff", spotlight.outerCutOff);
-        normalShader.setFloat("spotLight.constant", spotlight.constant);
-        normalShader.setFloat("spotLight.linear", spotlight.linear);
-        normalShader.setFloat("spotLight.quadratic", spotlight.quadratic);
-
-        normalShader.setBool("blinn", blinn);
-
-        normalShader.setFloat("heightScale", heightScale);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, normalMap);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-
-
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
-        skyboxShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
 
+        // the frame as passes over what they read and write, FrameGraph orders them and provides the targets
+        frameGraph->beginFrame(framebufferWidth, framebufferHeight);
+        TextureDesc sceneDesc;
+        sceneDesc.width = renderWidth;
+        sceneDesc.height = renderHeight;
+        sceneDesc.internalFormat = GL_R11F_G11F_B10F;
+        TextureDesc velocityDesc = sceneDesc;
+        velocityDesc.internalFormat = GL_RG16F;
+        velocityDesc.filter = GL_NEAREST;
+        TextureDesc depthDesc = sceneDesc;
+        depthDesc.internalFormat = GL_DEPTH_COMPONENT24;
+        depthDesc.filter = GL_NEAREST;
+        FrameGraph::Resource sceneColor, sceneVelocity, sceneDepth;
+        FrameGraph::Resource oitAccumulation, oitWeight, oitDepth;
+        FrameGraph::Resource rawOcclusion, blurredX, blurredXY, occlusion;
+        // the shadow maps and light lists belong to their classes, imported to order the passes around them
+        FrameGraph::Resource shadowMaps = frameGraph->import("Shadow maps", 0);
+        FrameGraph::Resource lightClusters = frameGraph->import("Light clusters", 0);
+
+        if (shadows) {
+            frameGraph->addPass("Shadows", [&](FrameGraph::Builder& builder) {
+                builder.write(shadowMaps);
+            }, [&](const FrameGraph::Resources&) {
+                std::vector<ShadowCaster> casters;
+                casters.push_back(ShadowCaster{groundModel, glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f),
+                                               true, renderGround});
+                for (const SceneObject& object : scene) {
+                    Model* sceneModel = object.model;
+                    // the lamp light sits inside the lamp model
+                    int housedLight = sceneModel == &modelLampa ? LAMP_SHADOW : -1;
+                    casters.push_back(ShadowCaster{object.transform, sceneModel->boundsMin, sceneModel->boundsMax,
+                                                   object.isStatic, [sceneModel]() { sceneModel->DrawDepth(true); },
+                                                   housedLight});
+                }
+                cascadedShadows->render(casters, depthShader, view, glm::radians(programState->camera.Zoom), aspect,
+                                        0.1f, directional.direction);
+                cascadedShadows->bind();
+
+                shadowAtlas->clear();
+                if (benchmarkLights == 0) {
+                    ShadowedLight lamp;
+                    lamp.position = pointLight.position;
+                    lamp.range = ClusteredLights::range(pointLight);
+                    lamp.isPoint = true;
+                    shadowAtlas->add(LAMP_SHADOW, lamp);
+                }
+                ShadowedLight flashlight;
+                flashlight.position = spotlight.position;
+                flashlight.direction = spotlight.direction;
+                flashlight.outerCutOff = spotlight.outerCutOff;
+                glm::vec3 spotPeak = glm::max(spotlight.ambient + spotlight.diffuse, spotlight.specular);
+                flashlight.range = ClusteredLights::range(std::max(spotPeak.x, std::max(spotPeak.y, spotPeak.z)),
+                                                          spotlight.constant, spotlight.linear, spotlight.quadratic);
+                flashlight.isPoint = false;
+                shadowAtlas->add(SPOTLIGHT_SHADOW, flashlight);
+                shadowAtlas->update(casters, depthShader, programState->camera.Position, currentViewProjection,
+                                    glm::radians(programState->camera.Zoom), renderHeight);
+                shadowAtlas->bind();
+            });
+        }
+
+        frameGraph->addPass("Light binning", [&](FrameGraph::Builder& builder) {
+            // the shadowed lights need their atlas tiles
+            if (shadows)
+                builder.read(shadowMaps);
+            builder.write(lightClusters);
+        }, [&](const FrameGraph::Resources&) {
+            // point lights: the street lamp and a glow inside every jellyfish, or the benchmark set
+            spotlight.shadowTile = shadows ? shadowAtlas->firstTile(SPOTLIGHT_SHADOW) : -1;
+            clusteredLights->clear();
+            if (benchmarkLights > 0) {
+                if ((int)benchmark.size() != benchmarkLights)
+                    benchmark = makeBenchmarkLights(benchmarkLights);
+                for (const PointLight& light : benchmark)
+                    clusteredLights->add(light);
+            } else {
+                pointLight.shadowTile = shadows ? shadowAtlas->firstTile(LAMP_SHADOW) : -1;
+                clusteredLights->add(pointLight);
+                for (const SceneObject& object : scene) {
+                    if (object.model != &modelMeduza)
+                        continue;
+                    PointLight glow;
+                    glow.position = glm::vec3(object.transform * glm::vec4(0.0f, 0.5f, 0.0f, 1.0f));
+                    glow.ambient = glm::vec3(0.0f);
+                    glow.diffuse = glm::vec3(0.8f, 0.35f, 0.7f);
+                    glow.specular = glow.diffuse;
+                    glow.constant = 1.0f;
+                    glow.linear = 0.35f;
+                    glow.quadratic = 0.44f;
+                    clusteredLights->add(glow);
+                }
+            }
+            clusteredLights->update(view, glm::radians(programState->camera.Zoom), aspect, 0.1f, 100.0f,
+                                    renderWidth, renderHeight);
+            clusteredLights->bind();
+        });
+
+        frameGraph->addPass("Clear", [&](FrameGraph::Builder& builder) {
+            sceneColor = builder.create("Scene color", sceneDesc);
+            sceneVelocity = builder.create("Velocity", velocityDesc);
+            sceneDepth = builder.create("Depth", depthDesc);
+        }, [&](const FrameGraph::Resources& resources) {
+            resources.bindFramebuffer({sceneColor, sceneVelocity, sceneDepth});
+            glm::vec3 color = fetchHeatmap ? glm::vec3(0.0f) : programState->clearColor;
+            const float colorClear[] = {color.r, color.g, color.b, 1.0f};
+            const float noMotion[] = {0.0f, 0.0f, 0.0f, 0.0f};
+            const float farDepth = 1.0f;
+            glClearBufferfv(GL_COLOR, 0, colorClear);
+            glClearBufferfv(GL_COLOR, 1, noMotion);
+            glClearBufferfv(GL_DEPTH, 0, &farDepth);
+        });
+
+        unsigned int groundFeatures = opaqueFeatures;
+        if (coneStepMapping && coneStepAvailable)
+            groundFeatures |= SHADER_CONE_STEP;
+        if (fetchHeatmap)
+            groundFeatures |= SHADER_FETCH_HEATMAP;
+        // the layer count only matters to the layer march
+        int groundSteps = (groundFeatures & SHADER_CONE_STEP) ? 0 : std::max(4, (int)(parallaxSteps * quality.parallaxScale));
+        auto bindGroundTextures = [&]() {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, diffuseMap);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, normalMap);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, depthMap);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, reliefMap);
+        };
+
+        // depth pre-pass: lay down the depth of all opaque geometry first, so the parallax loop of the ground
+        // and the model lighting only run for the fragment that ends up visible
+        if (depthPrepass) {
+            frameGraph->addPass("Depth prepass", [&](FrameGraph::Builder& builder) {
+                builder.write(sceneDepth);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({sceneColor, sceneVelocity, sceneDepth});
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                // the ground's parallax can discard at grazing angles, so its depth comes from the same march
+                Shader& groundDepthShader = groundShaders.get(SHADER_DEPTH_ONLY | (groundFeatures & SHADER_CONE_STEP),
+                                                              groundSteps);
+                groundDepthShader.use();
+                groundDepthShader.setMat4("view", view);
+                groundDepthShader.setMat4("projection", projection);
+                groundDepthShader.setMat4("model", groundModel);
+                groundDepthShader.setVec3("viewPos", programState->camera.Position);
+                groundDepthShader.setFloat("heightScale", heightScale);
+                groundDepthShader.setFloat("parallaxFadeDistance", parallaxFadeDistance);
+                bindGroundTextures();
+                renderGround();
+                instancedDepthShader.use();
+                instancedDepthShader.setMat4("view", view);
+                instancedDepthShader.setMat4("projection", projection);
+                drawBatcher->drawDepth();
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            });
+        }
+
+        // ambient occlusion at half resolution from the pre-pass depth, blurred in two directions and upsampled
+        // to the scene resolution for the lit passes
+        if (ssaoActive) {
+            TextureDesc halfDesc = sceneDesc;
+            halfDesc.width = AmbientOcclusion::halfSize(renderWidth);
+            halfDesc.height = AmbientOcclusion::halfSize(renderHeight);
+            halfDesc.internalFormat = GL_RG16F;
+            halfDesc.filter = GL_NEAREST;
+            TextureDesc occlusionDesc = sceneDesc;
+            occlusionDesc.internalFormat = GL_R8;
+            occlusionDesc.filter = GL_NEAREST;
+            frameGraph->addPass("SSAO", [&](FrameGraph::Builder& builder) {
+                builder.read(sceneDepth);
+                rawOcclusion = builder.create("SSAO raw", halfDesc);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({rawOcclusion});
+                ambientOcclusion->compute(resources.texture(sceneDepth), projection);
+            });
+            frameGraph->addPass("SSAO blur X", [&](FrameGraph::Builder& builder) {
+                builder.read(rawOcclusion);
+                blurredX = builder.create("SSAO blur X", halfDesc);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({blurredX});
+                ambientOcclusion->blur(resources.texture(rawOcclusion), false);
+            });
+            frameGraph->addPass("SSAO blur Y", [&](FrameGraph::Builder& builder) {
+                builder.read(blurredX);
+                blurredXY = builder.create("SSAO blur Y", halfDesc);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({blurredXY});
+                ambientOcclusion->blur(resources.texture(blurredX), true);
+            });
+            frameGraph->addPass("SSAO upsample", [&](FrameGraph::Builder& builder) {
+                builder.read(blurredXY);
+                builder.read(sceneDepth);
+                occlusion = builder.create("Ambient occlusion", occlusionDesc);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({occlusion});
+                ambientOcclusion->upsample(resources.texture(blurredXY), resources.texture(sceneDepth), 0.1f, 100.0f);
+            });
+        }
+
+        // what every lit pass reads and writes
+        auto litPass = [&](FrameGraph::Builder& builder) {
+            if (shadows)
+                builder.read(shadowMaps);
+            if (ssaoActive)
+                builder.read(occlusion);
+            builder.read(lightClusters);
+            builder.write(sceneColor);
+            builder.write(sceneVelocity);
+            builder.write(sceneDepth);
+        };
+        // the lit passes only shade what the pre-pass found to be nearest
+        auto litDepthState = []() {
+            glDepthFunc(depthPrepass ? GL_EQUAL : GL_LESS);
+            glDepthMask(depthPrepass ? GL_FALSE : GL_TRUE);
+        };
+
+        frameGraph->addPass("Ground", litPass, [&](const FrameGraph::Resources& resources) {
+            resources.bindFramebuffer({sceneColor, sceneVelocity, sceneDepth});
+            litDepthState();
+            if (ssaoActive)
+                ambientOcclusion->bind(resources.texture(occlusion));
+            Shader& normalShader = groundShaders.get(groundFeatures, groundSteps);
+            normalShader.use();
+            normalShader.setMat4("projection", projection);
+            normalShader.setMat4("view", view);
+            normalShader.setMat4("model", groundModel);
+            normalShader.setMat4("previousModel", groundModel);
+            normalShader.setMat4("currentViewProjection", currentViewProjection);
+            normalShader.setMat4("previousViewProjection", previousViewProjection);
+            normalShader.setVec3("viewPos", programState->camera.Position);
+
+            setLightUniforms(normalShader, spotlight, directional);
+
+            normalShader.setFloat("heightScale", heightScale);
+            normalShader.setFloat("parallaxFadeDistance", parallaxFadeDistance);
+
+            bindGroundTextures();
+            renderGround();
+        });
+
+        if (fetchHeatmap) {
+            // debug only: the readback waits for the GPU. Ground pixels have blue set, green holds the fetch count / 64,
+            // which the HDR target stores exactly
+            frameGraph->addPass("Heatmap readback", [&](FrameGraph::Builder& builder) {
+                builder.read(sceneColor);
+                builder.sideEffect();
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({sceneColor});
+                std::vector<float> pixels(renderWidth * renderHeight * 3);
+                glReadPixels(0, 0, renderWidth, renderHeight, GL_RGB, GL_FLOAT, pixels.data());
+                long long fetches = 0, groundPixels = 0;
+                for (size_t i = 0; i < pixels.size(); i += 3) {
+                    if (pixels[i + 2] == 1.0f) {
+                        fetches += (long long)std::lround(pixels[i + 1] * 64.0f);
+                        groundPixels++;
+                    }
+                }
+                averageFetches = groundPixels > 0 ? (float)fetches / groundPixels : 0.0f;
+            });
+        }
+
+        // render the loaded models
+        frameGraph->addPass("Models", litPass, [&](const FrameGraph::Resources& resources) {
+            resources.bindFramebuffer({sceneColor, sceneVelocity, sceneDepth});
+            litDepthState();
+            // every variant is its own program, so the per-frame uniforms go to each of them
+            modelShaders.forEach([&](Shader& modelShader) {
+                modelShader.use();
+                modelShader.setMat4("view", view);
+                modelShader.setMat4("projection", projection);
+                modelShader.setMat4("currentViewProjection", currentViewProjection);
+                modelShader.setMat4("previousViewProjection", previousViewProjection);
+
+                modelShader.setVec3("viewPosition", programState->camera.Position);
+                modelShader.setFloat("material.shininess", 32.0f);
+                setLightUniforms(modelShader, spotlight, directional);
+            });
+
+            // the buckets in turn: opaque, then alpha-tested, the translucent meshes get passes of their own
+            if (ssaoActive)
+                ambientOcclusion->bind(resources.texture(occlusion));
+            drawBatcher->draw(modelShaders, opaqueFeatures, OPAQUE_MESHES,
+                              depthPrepass ? DRAW_BY_STATE : DRAW_FRONT_TO_BACK);
+            int drawCalls = drawBatcher->drawCalls;
+            // alpha-tested meshes were left out of the pre-pass, they depth test and write normally
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            drawBatcher->draw(modelShaders, opaqueFeatures, ALPHA_TESTED_MESHES, DRAW_FRONT_TO_BACK);
+            modelDrawCalls = drawCalls + drawBatcher->drawCalls;
+        });
+
+        frameGraph->addPass("Skybox", [&](FrameGraph::Builder& builder) {
+            builder.write(sceneColor);
+            builder.write(sceneVelocity);
+            builder.read(sceneDepth);
+        }, [&](const FrameGraph::Resources& resources) {
+            resources.bindFramebuffer({sceneColor, sceneVelocity, sceneDepth});
+            glDepthFunc(GL_LEQUAL);
+            skyboxShader.use();
+            skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
+            skyboxShader.setMat4("projection", projection);
+            skyboxShader.setMat4("currentViewProjection", currentSkyViewProjection);
+            skyboxShader.setMat4("previousViewProjection", previousSkyViewProjection);
+            glBindVertexArray(skyboxVAO);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glBindVertexArray(0);
+            glDepthFunc(GL_LESS);
+        });
+
+        // translucent meshes in any order into the weighted blended OIT targets, tested against the opaque depth,
+        // then blended over the scene in one fullscreen pass. At reduced resolution they test against a reduced
+        // copy of the depth, and the composite upsamples
+        if (translucentScene) {
+            bool reduced = weightedOIT->resolutionDivisor > 1;
+            TextureDesc accumulationDesc = sceneDesc;
+            accumulationDesc.width = weightedOIT->targetSize(renderWidth);
+            accumulationDesc.height = weightedOIT->targetSize(renderHeight);
+            accumulationDesc.internalFormat = GL_RGBA16F;
+            accumulationDesc.filter = GL_NEAREST;
+            TextureDesc weightDesc = accumulationDesc;
+            weightDesc.internalFormat = GL_R16F;
+            TextureDesc lowDepthDesc = accumulationDesc;
+            lowDepthDesc.internalFormat = GL_DEPTH_COMPONENT24;
+            oitDepth = sceneDepth;
+            if (reduced) {
+                frameGraph->addPass("Depth downsample", [&](FrameGraph::Builder& builder) {
+                    builder.read(sceneDepth);
+                    oitDepth = builder.create("Reduced depth", lowDepthDesc);
+                }, [&](const FrameGraph::Resources& resources) {
+                    resources.bindFramebuffer({oitDepth});
+                    weightedOIT->downsampleDepth(resources.texture(sceneDepth));
+                });
+            }
+            frameGraph->addPass("Translucent", [&](FrameGraph::Builder& builder) {
+                if (shadows)
+                    builder.read(shadowMaps);
+                builder.read(lightClusters);
+                builder.read(oitDepth);
+                oitAccumulation = builder.create("OIT accumulation", accumulationDesc);
+                oitWeight = builder.create("OIT weight", weightDesc);
+            }, [&, reduced, accumulationDesc](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({oitAccumulation, oitWeight, oitDepth});
+                // the cluster lookup goes by pixel position; the Models pass sets it back every frame
+                if (reduced)
+                    modelShaders.forEach([&](Shader& modelShader) {
+                        modelShader.use();
+                        clusteredLights->setViewportSize(modelShader, accumulationDesc.width, accumulationDesc.height);
+                    });
+                weightedOIT->begin();
+                // weighted blending doesn't depend on the order
+                drawBatcher->draw(modelShaders, lightingFeatures, TRANSLUCENT_MESHES, DRAW_BY_STATE);
+                weightedOIT->end();
+            });
+            frameGraph->addPass("OIT composite", [&](FrameGraph::Builder& builder) {
+                builder.read(oitAccumulation);
+                builder.read(oitWeight);
+                if (reduced) {
+                    builder.read(oitDepth);
+                    builder.read(sceneDepth);
+                }
+                builder.write(sceneColor);
+            }, [&, reduced](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({sceneColor});
+                if (reduced)
+                    weightedOIT->compositeUpsampled(resources.texture(oitAccumulation), resources.texture(oitWeight),
+                                                    resources.texture(oitDepth), resources.texture(sceneDepth),
+                                                    0.1f, 100.0f);
+                else
+                    weightedOIT->composite(resources.texture(oitAccumulation), resources.texture(oitWeight));
+            });
+        }
+
+        // the HDR image the post-processing works on
+        FrameGraph::Resource resolved = sceneColor;
+        if (taaEnabled) {
+            TextureDesc historyDesc = sceneDesc;
+            historyDesc.internalFormat = GL_RGBA16F;
+            FrameGraph::Resource history = frameGraph->import("TAA history",
+                                                              temporalAA->output(renderWidth, renderHeight), historyDesc);
+            frameGraph->addPass("TAA resolve", [&](FrameGraph::Builder& builder) {
+                builder.read(sceneColor);
+                builder.read(sceneVelocity);
+                builder.write(history);
+            }, [&, history](const FrameGraph::Resources& resources) {
+                temporalAA->resolve(resources.texture(sceneColor), resources.texture(sceneVelocity), renderWidth,
+                                    renderHeight);
+            });
+            resolved = history;
+        }
+
+        std::vector<glm::ivec2> bloomSizes = hdrPipeline->levelSizes(renderWidth, renderHeight);
+        std::vector<FrameGraph::Resource> bloomLevels;
+        auto bloomTargets = [&](const FrameGraph::Resources& resources) {
+            std::vector<BloomLevel> targets;
+            for (FrameGraph::Resource level : bloomLevels)
+                targets.push_back(BloomLevel{resources.texture(level), resources.framebuffer({level}),
+                                             resources.desc(level).width, resources.desc(level).height});
+            return targets;
+        };
+        if (!bloomSizes.empty()) {
+            frameGraph->addPass("Bloom down", [&](FrameGraph::Builder& builder) {
+                builder.read(resolved);
+                for (size_t i = 0; i < bloomSizes.size(); i++) {
+                    TextureDesc levelDesc = sceneDesc;
+                    levelDesc.width = bloomSizes[i].x;
+                    levelDesc.height = bloomSizes[i].y;
+                    bloomLevels.push_back(builder.create("Bloom " + std::to_string(i), levelDesc));
+                }
+            }, [&](const FrameGraph::Resources& resources) {
+                hdrPipeline->downsample(resources.texture(resolved), renderWidth, renderHeight, bloomTargets(resources));
+            });
+        }
+        if (bloomSizes.size() > 1) {
+            frameGraph->addPass("Bloom up", [&](FrameGraph::Builder& builder) {
+                for (size_t i = 0; i < bloomLevels.size(); i++) {
+                    builder.read(bloomLevels[i]);
+                    if (i + 1 < bloomLevels.size())
+                        builder.write(bloomLevels[i]);
+                }
+            }, [&](const FrameGraph::Resources& resources) {
+                hdrPipeline->upsample(bloomTargets(resources));
+            });
+        }
+
+        // always declared; culled when the tonemap doesn't read it
+        FrameGraph::Resource exposure = frameGraph->import("Exposure", autoExposure->nextExposureTexture());
+        frameGraph->addPass("Auto exposure", [&](FrameGraph::Builder& builder) {
+            builder.read(resolved);
+            builder.write(exposure);
+        }, [&](const FrameGraph::Resources& resources) {
+            autoExposure->update(resources.texture(resolved), renderWidth, renderHeight, deltaTime);
+        });
+
+        // below native resolution the tonemap goes to an 8-bit target, upscaled and sharpened into the window
+        bool upscale = renderWidth != framebufferWidth || renderHeight != framebufferHeight;
+        FrameGraph::Resource tonemapped = FrameGraph::BACKBUFFER;
+        frameGraph->addPass("Tonemap", [&](FrameGraph::Builder& builder) {
+            builder.read(resolved);
+            if (!bloomLevels.empty())
+                builder.read(bloomLevels[0]);
+            if (autoExposureEnabled)
+                builder.read(exposure);
+            if (upscale) {
+                TextureDesc ldrDesc = sceneDesc;
+                ldrDesc.internalFormat = GL_RGBA8;
+                ldrDesc.filter = GL_NEAREST;
+                tonemapped = builder.create("Tonemapped", ldrDesc);
+            } else {
+                builder.write(FrameGraph::BACKBUFFER);
+            }
+        }, [&](const FrameGraph::Resources& resources) {
+            resources.bindFramebuffer({tonemapped});
+            hdrPipeline->composite(resources.texture(resolved),
+                                   bloomLevels.empty() ? 0 : resources.texture(bloomLevels[0]), (int)bloomLevels.size(),
+                                   autoExposureEnabled ? resources.texture(exposure) : 0);
+        });
+        FrameGraph::Resource upscaled = FrameGraph::BACKBUFFER;
+        if (upscale) {
+            frameGraph->addPass("Upscale", [&](FrameGraph::Builder& builder) {
+                builder.read(tonemapped);
+                TextureDesc upscaledDesc;
+                upscaledDesc.width = framebufferWidth;
+                upscaledDesc.height = framebufferHeight;
+                upscaledDesc.internalFormat = GL_RGBA8;
+                upscaledDesc.filter = GL_NEAREST;
+                upscaled = builder.create("Upscaled", upscaledDesc);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({upscaled});
+                upscaler->upscale(resources.texture(tonemapped));
+            });
+            frameGraph->addPass("Sharpen", [&](FrameGraph::Builder& builder) {
+                builder.read(upscaled);
+                builder.write(FrameGraph::BACKBUFFER);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({FrameGraph::BACKBUFFER});
+                upscaler->sharpen(resources.texture(upscaled));
+            });
+        }
+
+        if (programState->ImGuiEnabled) {
+            frameGraph->addPass("ImGui", [&](FrameGraph::Builder& builder) {
+                builder.write(FrameGraph::BACKBUFFER);
+            }, [&](const FrameGraph::Resources& resources) {
+                resources.bindFramebuffer({FrameGraph::BACKBUFFER});
+                DrawImGui(programState);
+            });
+        }
+
+        frameGraph->compile();
+        frameGraph->execute(*gpuTimer);
+        gpuTimer->end();
 
-        if (programState->ImGuiEnabled)
-            DrawImGui(programState);
+        previousViewProjection = currentViewProjection;
+        previousSkyViewProjection = currentSkyViewProjection;
+        previousTransforms.clear();
+        for (const SceneObject& object : scene)
+            previousTransforms.push_back(object.transform);
+        firstFrame = false;
 
 
 
@@ -602,17 +1273,69 @@ int main() {
         glfwPollEvents();
     }
 
-    programState->SaveToFile("resources/program_state.txt");
-    delete programState;
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
-    // glfw: terminate, clearing all previously allocated GLFW resources.
-    // ------------------------------------------------------------------
-    glfwTerminate();
+    // a job still running compiles with modelShaders, so the thread stops before the locals go; the model it was
+    // loading may never have reached the scene
+    shaderWatcher->setUploadThread(nullptr);
+    delete uploadThread;
+    uploadThread = nullptr;
+    delete loadingCoral;
+}
+
+void setLightUniforms(Shader& shader, const SpotLight& spotLight, const DirLight& dirLight) {
+    clusteredLights->setUniforms(shader);
+    cascadedShadows->setUniforms(shader);
+    shadowAtlas->setUniforms(shader);
+    AmbientOcclusion::setUniforms(shader);
+    environmentLighting->setUniforms(shader);
+
+    shader.setInt("spotLightCount", 1);
+    shader.setVec3("spotLights[0].position", spotLight.position);
+    shader.setVec3("spotLights[0].direction", spotLight.direction);
+    shader.setVec3("spotLights[0].ambient", spotLight.ambient);
+    shader.setVec3("spotLights[0].diffuse", spotLight.diffuse);
+    shader.setVec3("spotLights[0].specular", spotLight.specular);
+    shader.setFloat("spotLights[0].cutOff", spotLight.cutOff);
+    shader.setFloat("spotLights[0].outerCutOff", spotLight.outerCutOff);
+    shader.setFloat("spotLights[0].constant", spotLight.constant);
+    shader.setFloat("spotLights[0].linear", spotLight.linear);
+    shader.setFloat("spotLights[0].quadratic", spotLight.quadratic);
+    shader.setInt("spotLights[0].shadowTile", spotLight.shadowTile);
+
+    shader.setVec3("dirLight.direction", dirLight.direction);
+    shader.setVec3("dirLight.ambient", dirLight.ambient);
+    shader.setVec3("dirLight.diffuse", dirLight.diffuse);
+    shader.setVec3("dirLight.specular", dirLight.specular);
+}
+
+size_t residentMemory() {
+#ifdef __linux__
+    // the second field is the resident set in pages
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    if (statm >> totalPages >> residentPages)
+        return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+#endif
     return 0;
 }
 
+std::vector<PointLight> makeBenchmarkLights(int count) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(-60.0f, 60.0f), y(-5.0f, 15.0f), z(-40.0f, 60.0f), hue(0.0f, 1.0f);
+    std::vector<PointLight> lights(count);
+    for (PointLight& light : lights) {
+        light.position = glm::vec3(x(random), y(random), z(random));
+        float h = hue(random) * 6.0f;
+        light.diffuse = glm::clamp(glm::vec3(std::abs(h - 3.0f) - 1.0f, 2.0f - std::abs(h - 2.0f), 2.0f - std::abs(h - 4.0f)),
+                                   0.0f, 1.0f);
+        light.ambient = glm::vec3(0.0f);
+        light.specular = light.diffuse;
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+    }
+    return lights;
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow *window) {
@@ -681,6 +1404,112 @@ void DrawImGui(ProgramState *programState) {
         ImGui::DragFloat("pointLight.constant", &programState->pointLight.constant, 0.05, 0.0, 1.0);
         ImGui::DragFloat("pointLight.linear", &programState->pointLight.linear, 0.05, 0.0, 1.0);
         ImGui::DragFloat("pointLight.quadratic", &programState->pointLight.quadratic, 0.05, 0.0, 1.0);
+        ImGui::Checkbox("Blinn-Phong", &blinn);
+        ImGui::SliderInt("Parallax steps", &parallaxSteps, 4, 64);
+        ImGui::Checkbox("Depth pre-pass", &depthPrepass);
+        if (!coralRequested && ImGui::Button("Load the coral house"))
+            coralRequested = true;
+        if (uploadThread->pendingJobs() > 0)
+            ImGui::Text("Upload thread: %d jobs pending", uploadThread->pendingJobs());
+        if (coneStepAvailable)
+            ImGui::Checkbox("Cone-step mapping", &coneStepMapping);
+        else
+            ImGui::TextDisabled("Cone-step mapping: bake resources/textures/Sand_relief.tga first");
+        const int benchmarkCounts[] = {0, 1, 64, 512, 4096};
+        const char* benchmarkNames[] = {"Scene", "1", "64", "512", "4096"};
+        int benchmarkIndex = (int)(std::find(benchmarkCounts, benchmarkCounts + 5, benchmarkLights) - benchmarkCounts);
+        if (ImGui::Combo("Point lights", &benchmarkIndex, benchmarkNames, 5))
+            benchmarkLights = benchmarkCounts[benchmarkIndex];
+        ImGui::Text("%d lights, %d visible, %d indices, at most %d per cluster",
+                    (int)clusteredLights->size(), clusteredLights->visibleLightCount(),
+                    (int)clusteredLights->indexCount(), clusteredLights->maxLightsInCluster());
+        if (clusteredLights->overflowedClusters() > 0)
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%d clusters dropped lights", clusteredLights->overflowedClusters());
+        ImGui::Text("Models: %d draw calls, instances %s", modelDrawCalls,
+                    drawBatcher->persistentMapping() ? "persistently mapped" : "through glBufferSubData");
+        if (ImGui::CollapsingHeader("Texture streaming")) {
+            static int budget = textureStreamer->budget();
+            ImGui::SliderInt("VRAM budget (MB)", &budget, 0, 512);
+            // reallocating drops every texture to the base tier, so only once the slider is let go
+            if (ImGui::IsItemDeactivatedAfterEdit())
+                textureStreamer->setBudget(budget);
+            ImGui::Text("%d MB resident of %d MB allocated, %d loads pending",
+                        (int)(textureStreamer->residentBytes() / (1024 * 1024)),
+                        (int)(textureStreamer->allocatedBytes() / (1024 * 1024)), textureStreamer->pendingLoads());
+            int uploadBudget = (int)(textureStreamer->uploadBudget / (1024 * 1024));
+            if (ImGui::SliderInt("Upload budget (MB/frame)", &uploadBudget, 1, 16))
+                textureStreamer->uploadBudget = (size_t)uploadBudget * 1024 * 1024;
+            ImGui::Text("Uploaded %.1f MB this frame", textureStreamer->uploadedBytes / (1024.0f * 1024.0f));
+            for (int tier = 0; tier < TextureStreamer::TIERS; tier++)
+                ImGui::Text("  %4d: %d of %d layers", textureStreamer->tierSize(tier), textureStreamer->tierUsed(tier),
+                            textureStreamer->tierCapacity(tier));
+            for (const TextureStreamer::StreamedTexture& texture : textureStreamer->streamedTextures())
+                ImGui::Text("  %4d / %4d  %s", textureStreamer->tierSize(texture.residentTier),
+                            textureStreamer->tierSize(texture.wantedTier),
+                            texture.path.substr(texture.path.find_last_of('/') + 1).c_str());
+        }
+        ImGui::Checkbox("Shadows", &shadows);
+        if (shadows) {
+            // the shadow matrices and the lighting normalize it, a zero vector keeps the previous direction
+            glm::vec3 sun = sunDirection;
+            if (ImGui::DragFloat3("Sun direction", (float*)&sun, 0.05f) && glm::length(sun) > 1e-3f)
+                sunDirection = sun;
+            ImGui::Checkbox("Cache far cascades", &cascadedShadows->caching);
+            ImGui::Text("Cascades rendered this frame: %d", cascadedShadows->renderedCascadeCount());
+            for (int i = 0; i < CascadedShadows::CASCADES; i++)
+                ImGui::Text("  cascade %d: up to %.1f, %d casters drawn", i, cascadedShadows->splitFar(i),
+                            cascadedShadows->drawnCasters(i));
+            ImGui::SliderInt("Atlas tile updates per frame", &shadowAtlas->updateBudget, 1, 24);
+            ImGui::Checkbox("Cache static casters in atlas", &shadowAtlas->caching);
+            ImGui::Text("Atlas: %d tiles in use, %d rendered this frame, %.0f%% assigned", shadowAtlas->usedTileCount(),
+                        shadowAtlas->renderedTileCount(), shadowAtlas->occupancy() * 100.0f);
+        }
+        const char* bloomNames[] = {"Off", "Low (3 levels)", "Medium (5 levels)", "High (7 levels)"};
+        int bloomQuality = hdrPipeline->quality;
+        if (ImGui::Combo("Bloom", &bloomQuality, bloomNames, 4))
+            hdrPipeline->quality = (BloomQuality)bloomQuality;
+        ImGui::DragFloat("Bloom threshold", &hdrPipeline->threshold, 0.05f, 0.0f, 10.0f);
+        ImGui::DragFloat("Bloom strength", &hdrPipeline->bloomStrength, 0.01f, 0.0f, 4.0f);
+        ImGui::Checkbox("Quality governor", &qualityGovernor.enabled);
+        if (qualityGovernor.enabled) {
+            ImGui::DragFloat("Target frame ms", &qualityGovernor.targetMs, 0.1f, 4.0f, 50.0f);
+            const QualityLevel& quality = qualityGovernor.settings();
+            ImGui::Text("Level %d: %.0f%% resolution, GPU %.2f ms", qualityGovernor.levelIndex(),
+                        quality.renderScale * 100.0f, qualityGovernor.averageMs());
+            ImGui::Text("parallax x%.2f, shadows x%.2f, LOD bias %+.1f", quality.parallaxScale, quality.shadowScale,
+                        quality.lodBias);
+            ImGui::SliderFloat("Upscale sharpness", &upscaler->sharpness, 0.0f, 1.0f);
+        }
+        if (environmentLighting->ready()) {
+            ImGui::Checkbox("Environment lighting", &iblEnabled);
+            if (iblEnabled)
+                ImGui::DragFloat("Environment intensity", &environmentLighting->intensity, 0.01f, 0.0f, 4.0f);
+        }
+        const char* aoNames[] = {"Off", "Low (6 samples)", "Medium (10 samples)", "High (16 samples)"};
+        int aoQuality = ambientOcclusion->quality;
+        if (ImGui::Combo(depthPrepass ? "SSAO" : "SSAO (needs the depth pre-pass)", &aoQuality, aoNames, 4))
+            ambientOcclusion->quality = (AmbientOcclusionQuality)aoQuality;
+        if (ambientOcclusion->enabled()) {
+            ImGui::DragFloat("SSAO radius", &ambientOcclusion->radius, 0.01f, 0.05f, 5.0f);
+            ImGui::DragFloat("SSAO intensity", &ambientOcclusion->intensity, 0.01f, 0.1f, 8.0f);
+        }
+        const char* translucencyNames[] = {"Full", "Half", "Quarter"};
+        int translucencyIndex = weightedOIT->resolutionDivisor == 4 ? 2 : weightedOIT->resolutionDivisor - 1;
+        if (ImGui::Combo("Translucency resolution", &translucencyIndex, translucencyNames, 3))
+            weightedOIT->resolutionDivisor = 1 << translucencyIndex;
+        ImGui::Checkbox("Temporal AA", &taaEnabled);
+        if (taaEnabled)
+            ImGui::SliderFloat("TAA history weight", &temporalAA->feedback, 0.5f, 0.98f);
+        ImGui::Checkbox("Auto exposure", &autoExposureEnabled);
+        ImGui::DragFloat(autoExposureEnabled ? "Exposure compensation" : "Exposure", &hdrPipeline->exposure, 0.01f, 0.05f, 8.0f);
+        if (autoExposureEnabled) {
+            ImGui::DragFloat("Exposure key", &autoExposure->keyValue, 0.01f, 0.05f, 2.0f);
+            ImGui::DragFloatRange2("Exposure limits", &autoExposure->minExposure, &autoExposure->maxExposure, 0.01f, 0.01f, 32.0f);
+        }
+        ImGui::DragFloat("Parallax fade distance", &parallaxFadeDistance, 1.0f, 1.0f, 200.0f);
+        ImGui::Checkbox("Fetch heatmap", &fetchHeatmap);
+        if (fetchHeatmap)
+            ImGui::Text("Height fetches per ground fragment: %.2f", averageFetches);
         ImGui::End();
     }
 
@@ -694,6 +1523,10 @@ void DrawImGui(ProgramState *programState) {
         ImGui::End();
     }
 
+    shaderWatcher->DrawImGui(glfwGetTime());
+    gpuTimer->DrawImGui();
+    frameGraph->DrawImGui();
+
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
@@ -730,10 +1563,9 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     
 }
 
-unsigned int loadCubemap(vector<std::string> faces)
+GLTexture loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    GLTexture textureID = GLTexture::create();
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrChannels;
@@ -761,10 +1593,9 @@ unsigned int loadCubemap(vector<std::string> faces)
 }
 
 
-unsigned int loadTexture(char const * path)
+GLTexture loadTexture(char const * path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    GLTexture textureID = GLTexture::create();
 
     int width, height, nrComponents;
     unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
@@ -799,98 +1630,90 @@ unsigned int loadTexture(char const * path)
 }
 
 
-unsigned int groundVAO = 0;
-unsigned int groundVBO;
-void renderGround()
+void createGround(GLVertexArray &vao, GLBuffer &vbo)
 {
-
-    if (groundVAO== 0)
-    {
-        // positions
-        glm::vec3 pos1(-1.0f,  1.0f, 0.0f);
-        glm::vec3 pos2(-1.0f, -1.0f, 0.0f);
-        glm::vec3 pos3( 1.0f, -1.0f, 0.0f);
-        glm::vec3 pos4( 1.0f,  1.0f, 0.0f);
-        // texture coordinates
-        glm::vec2 uv1(0.0f, 1.0f);
-        glm::vec2 uv2(0.0f, 0.0f);
-        glm::vec2 uv3(1.0f, 0.0f);
-        glm::vec2 uv4(1.0f, 1.0f);
-        // normal vector
-        glm::vec3 nm(0.0f, 0.0f, 1.0f);
-
-        // calculate tangent/bitangent vectors of both triangles
-        glm::vec3 tangent1, bitangent1;
-        glm::vec3 tangent2, bitangent2;
-        // triangle 1
-        // ----------
-        glm::vec3 edge1 = pos2 - pos1;
-        glm::vec3 edge2 = pos3 - pos1;
-        glm::vec2 deltaUV1 = uv2 - uv1;
-        glm::vec2 deltaUV2 = uv3 - uv1;
-
-        float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-
-        tangent1.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
-        tangent1.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
-        tangent1.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
-        tangent1 = glm::normalize(tangent1);
-
-        bitangent1.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
-        bitangent1.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
-        bitangent1.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
-        bitangent1 = glm::normalize(bitangent1);
-
-        // triangle 2
-        // ----------
-        edge1 = pos3 - pos1;
-        edge2 = pos4 - pos1;
-        deltaUV1 = uv3 - uv1;
-        deltaUV2 = uv4 - uv1;
-
-        f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-
-        tangent2.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
-        tangent2.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
-        tangent2.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
-        tangent2 = glm::normalize(tangent2);
-
-
-        bitangent2.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
-        bitangent2.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
-        bitangent2.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
-        bitangent2 = glm::normalize(bitangent2);
-
-
-        float quadVertices[] = {
-                // positions            // normal         // texcoords  // tangent                          // bitangent
-                pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-                pos2.x, pos2.y, pos2.z, nm.x, nm.y, nm.z, uv2.x, uv2.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-                pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
-
-                pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
-                pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
-                pos4.x, pos4.y, pos4.z, nm.x, nm.y, nm.z, uv4.x, uv4.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z
-        };
-        // configure plane VAO
-        glGenVertexArrays(1, &groundVAO);
-        glGenBuffers(1, &groundVBO);
-        glBindVertexArray(groundVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, groundVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(8 * sizeof(float)));
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
-    }
-    glBindVertexArray(groundVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    // positions
+    glm::vec3 pos1(-1.0f,  1.0f, 0.0f);
+    glm::vec3 pos2(-1.0f, -1.0f, 0.0f);
+    glm::vec3 pos3( 1.0f, -1.0f, 0.0f);
+    glm::vec3 pos4( 1.0f,  1.0f, 0.0f);
+    // texture coordinates
+    glm::vec2 uv1(0.0f, 1.0f);
+    glm::vec2 uv2(0.0f, 0.0f);
+    glm::vec2 uv3(1.0f, 0.0f);
+    glm::vec2 uv4(1.0f, 1.0f);
+    // normal vector
+    glm::vec3 nm(0.0f, 0.0f, 1.0f);
+
+    // calculate tangent/bitangent vectors of both triangles
+    glm::vec3 tangent1, bitangent1;
+    glm::vec3 tangent2, bitangent2;
+    // triangle 1
+    // ----------
+    glm::vec3 edge1 = pos2 - pos1;
+    glm::vec3 edge2 = pos3 - pos1;
+    glm::vec2 deltaUV1 = uv2 - uv1;
+    glm::vec2 deltaUV2 = uv3 - uv1;
+
+    float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+
+    tangent1.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
+    tangent1.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
+    tangent1.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
+    tangent1 = glm::normalize(tangent1);
+
+    bitangent1.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
+    bitangent1.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
+    bitangent1.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
+    bitangent1 = glm::normalize(bitangent1);
+
+    // triangle 2
+    // ----------
+    edge1 = pos3 - pos1;
+    edge2 = pos4 - pos1;
+    deltaUV1 = uv3 - uv1;
+    deltaUV2 = uv4 - uv1;
+
+    f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+
+    tangent2.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
+    tangent2.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
+    tangent2.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
+    tangent2 = glm::normalize(tangent2);
+
+
+    bitangent2.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
+    bitangent2.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
+    bitangent2.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
+    bitangent2 = glm::normalize(bitangent2);
+
+
+    float quadVertices[] = {
+            // positions            // normal         // texcoords  // tangent                          // bitangent
+            pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
+            pos2.x, pos2.y, pos2.z, nm.x, nm.y, nm.z, uv2.x, uv2.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
+            pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent1.x, tangent1.y, tangent1.z, bitangent1.x, bitangent1.y, bitangent1.z,
+
+            pos1.x, pos1.y, pos1.z, nm.x, nm.y, nm.z, uv1.x, uv1.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
+            pos3.x, pos3.y, pos3.z, nm.x, nm.y, nm.z, uv3.x, uv3.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z,
+            pos4.x, pos4.y, pos4.z, nm.x, nm.y, nm.z, uv4.x, uv4.y, tangent2.x, tangent2.y, tangent2.z, bitangent2.x, bitangent2.y, bitangent2.z
+    };
+    // configure plane VAO
+    vao = GLVertexArray::create();
+    vbo = GLBuffer::create();
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(8 * sizeof(float)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
     glBindVertexArray(0);
 }
 
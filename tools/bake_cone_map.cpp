@@ -0,0 +1,132 @@
+// Offline baker for the cone-step relief maps used by normal.fs (CONE_STEP variant).
+//
+// usage: bake_cone_map <normal map> <depth map> <output.tga> [--height] [--radius N]
+//
+// The output packs everything the shader needs into one RGBA8 texture, so a march step is a single fetch:
+//   rg  tangent-space normal xy (z is rebuilt in the shader)
+//   b   sqrt of the cone ratio, the widest cone above the texel that contains no part of the surface
+//   a   depth, 0 at the top of the relief and 1 at the bottom
+// --height reads the second image as a height map (white is high) instead of a depth map (white is deep).
+
+#include <stb_image.h>
+
+#include "tga.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Cone ratio of every texel, in texture-space distance per unit of depth, clamped to 1.
+// The map tiles, so the search wraps around the edges. Searching stops at radius texels; anything further away
+// can't give a narrower cone than radius / (depth - minDepth), which keeps the result conservative.
+static std::vector<float> bakeCones(const std::vector<float>& depth, int width, int height, int radius) {
+    std::vector<float> cones(depth.size(), 1.0f);
+    float minDepth = *std::min_element(depth.begin(), depth.end());
+    float texel = 1.0f / (float)std::max(width, height);
+
+    auto bakeRows = [&](int firstRow, int rowStep) {
+        for (int y = firstRow; y < height; y += rowStep) {
+            for (int x = 0; x < width; x++) {
+                float d = depth[y * width + x];
+                float best = 1.0f;
+                // rings of growing size; a ring r texels out can't beat r * texel / (d - minDepth)
+                for (int r = 1; r <= radius; r++) {
+                    if (d - minDepth <= 0.0f || r * texel / (d - minDepth) >= best)
+                        break;
+                    for (int dy = -r; dy <= r; dy++) {
+                        // the top and bottom rows of the ring are full, the sides only have their two ends
+                        int dxStep = (dy == -r || dy == r) ? 1 : 2 * r;
+                        for (int dx = -r; dx <= r; dx += dxStep) {
+                            int sx = ((x + dx) % width + width) % width;
+                            int sy = ((y + dy) % height + height) % height;
+                            float rise = d - depth[sy * width + sx];
+                            if (rise <= 0.0f)
+                                continue;
+                            float ratio = std::sqrt((float)(dx * dx + dy * dy)) * texel / rise;
+                            best = std::min(best, ratio);
+                        }
+                    }
+                }
+                if (d - minDepth > 0.0f)
+                    best = std::min(best, radius * texel / (d - minDepth));
+                cones[y * width + x] = best;
+            }
+        }
+    };
+
+    unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < threadCount; i++)
+        threads.emplace_back(bakeRows, (int)i, (int)threadCount);
+    for (std::thread& thread : threads)
+        thread.join();
+    return cones;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cout << "usage: bake_cone_map <normal map> <depth map> <output.tga> [--height] [--radius N]" << std::endl;
+        return 1;
+    }
+    bool isHeight = false;
+    int radius = 64;
+    for (int i = 4; i < argc; i++) {
+        if (std::strcmp(argv[i], "--height") == 0)
+            isHeight = true;
+        else if (std::strcmp(argv[i], "--radius") == 0 && i + 1 < argc)
+            radius = std::max(1, std::atoi(argv[++i]));
+    }
+
+    int width, height, components;
+    unsigned char* normals = stbi_load(argv[1], &width, &height, &components, 3);
+    if (!normals) {
+        std::cout << "Can't load normal map " << argv[1] << std::endl;
+        return 1;
+    }
+    int depthWidth, depthHeight;
+    unsigned char* depthData = stbi_load(argv[2], &depthWidth, &depthHeight, &components, 1);
+    if (!depthData) {
+        std::cout << "Can't load depth map " << argv[2] << std::endl;
+        stbi_image_free(normals);
+        return 1;
+    }
+    if (depthWidth != width || depthHeight != height) {
+        std::cout << "Normal map is " << width << "x" << height << " but depth map is "
+                  << depthWidth << "x" << depthHeight << std::endl;
+        stbi_image_free(normals);
+        stbi_image_free(depthData);
+        return 1;
+    }
+
+    std::vector<float> depth(width * height);
+    for (int i = 0; i < width * height; i++)
+        depth[i] = isHeight ? 1.0f - depthData[i] / 255.0f : depthData[i] / 255.0f;
+
+    std::vector<float> cones = bakeCones(depth, width, height, radius);
+
+    std::vector<unsigned char> relief(width * height * 4);
+    double coneSum = 0.0;
+    for (int i = 0; i < width * height; i++) {
+        relief[i * 4 + 0] = normals[i * 3 + 0];
+        relief[i * 4 + 1] = normals[i * 3 + 1];
+        // rounded down so quantization never widens a cone
+        relief[i * 4 + 2] = (unsigned char)std::floor(std::sqrt(cones[i]) * 255.0f);
+        relief[i * 4 + 3] = depthData[i] ^ (isHeight ? 0xFF : 0x00);
+        coneSum += cones[i];
+    }
+    stbi_image_free(normals);
+    stbi_image_free(depthData);
+
+    if (!writeTGA(argv[3], width, height, relief)) {
+        std::cout << "Can't write " << argv[3] << std::endl;
+        return 1;
+    }
+    std::cout << "Baked " << argv[3] << " (" << width << "x" << height << ", average cone ratio "
+              << coneSum / (width * height) << ")" << std::endl;
+    return 0;
+}
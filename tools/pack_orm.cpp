@@ -0,0 +1,163 @@
+// Offline packer for the ORM textures of the PBR variant of 2.model_lighting.fs.
+//
+// usage: pack_orm <output.tga> [--occlusion <image>] [--metallic-roughness <image>] [--specular-glossiness <image>]
+//                 [--diffuse <image>] [--metallic-factor F] [--roughness-factor F] [--specular-factor F]
+//                 [--glossiness-factor F]
+//
+// The output holds everything but the base color and the normal map in one RGBA8 texture, so the shader reads
+// the material with a single fetch:
+//   r  ambient occlusion
+//   g  roughness
+//   b  metallic
+// The channel layout is glTF's own, so a metallicRoughness map a material also names as its occlusion map is
+// already packed. Model picks up <material name>_orm.tga from the folder of the base color texture, e.g.
+//   pack_orm textures/SquidBeton_orm.tga --occlusion textures/SquidBeton_occlusion.png
+//            --specular-glossiness textures/SquidBeton_specularGlossiness.png --diffuse textures/SquidBeton_diffuse.png
+//            --glossiness-factor 0.4
+// The factors are multiplied in, missing inputs count as white. KHR_materials_pbrSpecularGlossiness maps are
+// converted the way the Khronos sample converter does it: roughness is 1 - glossiness, metallic is solved from
+// the diffuse and specular brightness (without --diffuse, as if the diffuse color were black).
+
+#include <stb_image.h>
+
+#include "tga.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Image {
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgba;
+
+    bool load(const char* path) {
+        int components;
+        unsigned char* data = stbi_load(path, &width, &height, &components, 4);
+        if (!data) {
+            std::cout << "Can't load " << path << std::endl;
+            return false;
+        }
+        rgba.assign(data, data + (size_t)width * height * 4);
+        stbi_image_free(data);
+        return true;
+    }
+
+    // channel c of the texel at the same relative position in an image of another size, 1 without an image
+    float at(int x, int y, int outWidth, int outHeight, int c) const {
+        if (rgba.empty())
+            return 1.0f;
+        int sx = std::min(x * width / outWidth, width - 1);
+        int sy = std::min(y * height / outHeight, height - 1);
+        return rgba[((size_t)sy * width + sx) * 4 + c] / 255.0f;
+    }
+};
+
+// perceived brightness of a color, the measure the Khronos conversion compares diffuse and specular by
+static float brightness(float r, float g, float b) {
+    return std::sqrt(0.299f * r * r + 0.587f * g * g + 0.114f * b * b);
+}
+
+// the metallic value that turns a dielectric's 4% and the diffuse color into the given specular brightness
+static float solveMetallic(float diffuse, float specular, float oneMinusSpecularStrength) {
+    const float dielectric = 0.04f;
+    if (specular < dielectric)
+        return 0.0f;
+    float a = dielectric;
+    float b = diffuse * oneMinusSpecularStrength / (1.0f - dielectric) + specular - 2.0f * dielectric;
+    float c = dielectric - specular;
+    float d = std::max(b * b - 4.0f * a * c, 0.0f);
+    return std::min(std::max((-b + std::sqrt(d)) / (2.0f * a), 0.0f), 1.0f);
+}
+
+static unsigned char toByte(float value) {
+    return (unsigned char)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cout << "usage: pack_orm <output.tga> [--occlusion <image>] [--metallic-roughness <image>] "
+                     "[--specular-glossiness <image>] [--diffuse <image>] [--metallic-factor F] [--roughness-factor F] "
+                     "[--specular-factor F] [--glossiness-factor F]" << std::endl;
+        return 1;
+    }
+    Image occlusion, metallicRoughness, specularGlossiness, diffuse;
+    float metallicFactor = 1.0f, roughnessFactor = 1.0f, specularFactor = 1.0f, glossinessFactor = 1.0f;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        bool ok = true;
+        if (std::strcmp(argv[i], "--occlusion") == 0)
+            ok = occlusion.load(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--metallic-roughness") == 0)
+            ok = metallicRoughness.load(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--specular-glossiness") == 0)
+            ok = specularGlossiness.load(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--diffuse") == 0)
+            ok = diffuse.load(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--metallic-factor") == 0)
+            metallicFactor = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--roughness-factor") == 0)
+            roughnessFactor = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--specular-factor") == 0)
+            specularFactor = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--glossiness-factor") == 0)
+            glossinessFactor = (float)std::atof(argv[i + 1]);
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+        if (!ok)
+            return 1;
+    }
+    if (!metallicRoughness.rgba.empty() && !specularGlossiness.rgba.empty()) {
+        std::cout << "Give either a metallic-roughness or a specular-glossiness map, not both" << std::endl;
+        return 1;
+    }
+
+    // the largest input sets the size
+    int width = 1, height = 1;
+    for (const Image* image : {&occlusion, &metallicRoughness, &specularGlossiness})
+        if (image->width * image->height > width * height) {
+            width = image->width;
+            height = image->height;
+        }
+
+    std::vector<unsigned char> orm((size_t)width * height * 4);
+    double roughnessSum = 0.0, metallicSum = 0.0;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            float roughness, metallic;
+            if (!specularGlossiness.rgba.empty()) {
+                float sr = specularFactor * specularGlossiness.at(x, y, width, height, 0);
+                float sg = specularFactor * specularGlossiness.at(x, y, width, height, 1);
+                float sb = specularFactor * specularGlossiness.at(x, y, width, height, 2);
+                float diffuseBrightness = diffuse.rgba.empty() ? 0.0f
+                        : brightness(diffuse.at(x, y, width, height, 0), diffuse.at(x, y, width, height, 1),
+                                     diffuse.at(x, y, width, height, 2));
+                roughness = 1.0f - glossinessFactor * specularGlossiness.at(x, y, width, height, 3);
+                metallic = solveMetallic(diffuseBrightness, brightness(sr, sg, sb),
+                                         1.0f - std::max(sr, std::max(sg, sb)));
+            } else {
+                roughness = roughnessFactor * metallicRoughness.at(x, y, width, height, 1);
+                metallic = metallicFactor * metallicRoughness.at(x, y, width, height, 2);
+            }
+            unsigned char* texel = &orm[((size_t)y * width + x) * 4];
+            texel[0] = toByte(occlusion.at(x, y, width, height, 0));
+            texel[1] = toByte(roughness);
+            texel[2] = toByte(metallic);
+            texel[3] = 255;
+            roughnessSum += texel[1] / 255.0;
+            metallicSum += texel[2] / 255.0;
+        }
+
+    if (!writeTGA(argv[1], width, height, orm)) {
+        std::cout << "Can't write " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << "Packed " << argv[1] << " (" << width << "x" << height << ", average roughness "
+              << roughnessSum / ((double)width * height) << ", average metallic "
+              << metallicSum / ((double)width * height) << ")" << std::endl;
+    return 0;
+}
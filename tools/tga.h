@@ -0,0 +1,33 @@
+#ifndef PROJECT_BASE_TOOLS_TGA_H
+#define PROJECT_BASE_TOOLS_TGA_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// uncompressed 32 bit TGA with a top-left origin, which stb_image reads back in the same row order as the inputs
+inline bool writeTGA(const std::string& path, int width, int height, const std::vector<unsigned char>& rgba) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    unsigned char header[18] = {};
+    header[2] = 2;
+    header[12] = width & 0xFF;
+    header[13] = (width >> 8) & 0xFF;
+    header[14] = height & 0xFF;
+    header[15] = (height >> 8) & 0xFF;
+    header[16] = 32;
+    header[17] = 0x20 | 8;
+    std::fwrite(header, 1, sizeof(header), file);
+    std::vector<unsigned char> bgra(rgba.size());
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+        bgra[i + 0] = rgba[i + 2];
+        bgra[i + 1] = rgba[i + 1];
+        bgra[i + 2] = rgba[i + 0];
+        bgra[i + 3] = rgba[i + 3];
+    }
+    bool ok = std::fwrite(bgra.data(), 1, bgra.size(), file) == bgra.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+#endif //PROJECT_BASE_TOOLS_TGA_H